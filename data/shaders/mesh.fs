@@ -0,0 +1,72 @@
+#version 330 core
+
+// Must match MAX_LIGHTS in renderer.cpp and LIGHTMAP_AMBIENT_LIGHT in level_builder.cpp.
+#define MAX_LIGHTS 16
+#define AMBIENT_LIGHT 0.1
+
+struct Light
+{
+    vec3 position;
+    vec3 color;
+    float intensity;
+    float range;
+};
+
+in vec3 vPosition;
+in vec3 vNormal;
+in vec3 vColor;
+in vec2 vTexCoord0;
+in vec2 vTexCoord1;
+
+uniform vec3 uDiffuseColor;
+uniform bool uUseDiffuseTexture;
+uniform sampler2D uDiffuseTexture;
+uniform bool uUseLightmap;
+uniform sampler2D uLightmapTexture;
+uniform bool uUseAmbientCube;
+uniform vec3 uAmbientCube[6]; // +x, -x, +y, -y, +z, -z
+uniform Light uLights[MAX_LIGHTS];
+uniform int uLightCount;
+
+out vec4 fragColor;
+
+// Irradiance of the ambient cube for the normal, the colors of its axes weighted by the squared components.
+vec3 SampleAmbientCube(vec3 normal)
+{
+    vec3 weights = normal * normal;
+    return weights.x * (normal.x >= 0.0 ? uAmbientCube[0] : uAmbientCube[1]) +
+           weights.y * (normal.y >= 0.0 ? uAmbientCube[2] : uAmbientCube[3]) +
+           weights.z * (normal.z >= 0.0 ? uAmbientCube[4] : uAmbientCube[5]);
+}
+
+void main()
+{
+    vec3 normal = normalize(vNormal);
+    vec3 albedo = uDiffuseColor * vColor;
+    if (uUseDiffuseTexture)
+    {
+        albedo *= texture(uDiffuseTexture, vTexCoord0).rgb;
+    }
+
+    // The lightmap already holds the light of the level, other meshes get the ambient cube or the flat
+    // ambient light in its place plus the added lights, with the same linear falloff as the lightmap.
+    vec3 light;
+    if (uUseLightmap)
+    {
+        light = texture(uLightmapTexture, vTexCoord1).rgb;
+    }
+    else
+    {
+        light = uUseAmbientCube ? SampleAmbientCube(normal) : vec3(AMBIENT_LIGHT);
+        for (int i = 0; i < uLightCount; ++i)
+        {
+            vec3 toLight = uLights[i].position - vPosition;
+            float lightDistance = length(toLight);
+            float falloff = clamp(1.0 - lightDistance / uLights[i].range, 0.0, 1.0);
+            float facing = max(dot(normal, toLight / max(lightDistance, 0.0001)), 0.0);
+            light += uLights[i].color * uLights[i].intensity * falloff * facing;
+        }
+    }
+
+    fragColor = vec4(albedo * light, 1.0);
+}
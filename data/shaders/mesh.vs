@@ -0,0 +1,28 @@
+#version 330 core
+
+layout (location = 0) in vec3 aPosition;
+layout (location = 1) in vec3 aNormal;
+layout (location = 2) in vec3 aColor;
+layout (location = 3) in vec2 aTexCoord0;
+layout (location = 4) in vec2 aTexCoord1;
+
+uniform mat4 uProjectionMatrix;
+uniform mat4 uViewMatrix;
+uniform mat4 uModelMatrix;
+
+out vec3 vPosition;
+out vec3 vNormal;
+out vec3 vColor;
+out vec2 vTexCoord0;
+out vec2 vTexCoord1;
+
+void main()
+{
+    vec4 position = uModelMatrix * vec4(aPosition, 1.0);
+    vPosition = position.xyz;
+    vNormal = mat3(transpose(inverse(uModelMatrix))) * aNormal;
+    vColor = aColor;
+    vTexCoord0 = aTexCoord0;
+    vTexCoord1 = aTexCoord1;
+    gl_Position = uProjectionMatrix * uViewMatrix * position;
+}
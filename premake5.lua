@@ -1,3 +1,8 @@
+newoption {
+    trigger = "avx2",
+    description = "Build with AVX2, the lightmap bake shades 8 luxels at a time instead of 4"
+}
+
 workspace "Gunman"
     configurations { "Debug", "Release" }
     platforms { "x64" }
@@ -12,6 +17,9 @@ workspace "Gunman"
         defines { "NDEBUG" }
         optimize "On"
 
+    filter "options:avx2"
+        vectorextensions "AVX2"
+
 project "Gunman"
     kind "ConsoleApp"
     language "C++"
@@ -45,3 +53,53 @@ project "Gunman"
         postbuildcommands {
             "{COPY} extern/SDL3-3.2.8/lib/x64/SDL3.dll data"
         }
+
+-- Command line programs built from the engine sources without the game, with the settings of the game project.
+function EngineTool(name, mainFile)
+    project(name)
+        kind "ConsoleApp"
+        language "C++"
+        cppdialect "C++20"
+        debugdir "data"
+        targetdir "build/%{cfg.buildcfg}"
+        objdir "build/%{cfg.buildcfg}/obj/%{prj.name}"
+        files {
+            "src/core/**.h",
+            "src/core/**.cpp",
+            "src/renderer/**.h",
+            "src/renderer/**.cpp",
+            "src/scene/**.h",
+            "src/scene/**.cpp",
+            "extern/glad-3.3/src/glad.c",
+            mainFile
+        }
+        includedirs {
+            "src",
+            "extern/SDL3-3.2.8/include",
+            "extern/glad-3.3/include",
+            "extern/glm-1.0.1-light",
+            "extern/stb-master"
+        }
+
+        filter "system:windows"
+            defines {
+                "WIN32"
+            }
+            libdirs {
+                "extern/SDL3-3.2.8/lib/x64"
+            }
+            links {
+                "SDL3"
+            }
+            postbuildcommands {
+                "{COPY} extern/SDL3-3.2.8/lib/x64/SDL3.dll data"
+            }
+
+        filter {}
+end
+
+-- Checks that the SIMD lightmap kernel bakes the same atlas as the scalar one. Run it in the --avx2 build as well.
+EngineTool("LightmapSelfTest", "tools/lightmap_selftest.cpp")
+
+-- Compares the row-major and blocked tile layouts of Level on a generated level. Run it in the Release build.
+EngineTool("LevelBenchmark", "tools/level_benchmark.cpp")
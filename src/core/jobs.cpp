@@ -0,0 +1,350 @@
+#include "jobs.h"
+#include "platform.h"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstdlib>
+
+#define MAX_JOBS_PER_QUEUE 1024
+
+struct Job
+{
+    JobFunction function;
+    void* userData;
+    s32 begin;
+    s32 end;
+    std::atomic<s32>* pendingCount;
+};
+
+// Each thread owns a queue. The owner pops from the back, idle threads steal from the front.
+struct JobQueue
+{
+    std::mutex mutex;
+    Job jobs[MAX_JOBS_PER_QUEUE];
+    u32 head;
+    u32 tail;
+};
+
+struct JobSystem
+{
+    std::once_flag initFlag;
+    b32 initialized;
+    s32 workerCount;
+    std::thread workers[MAX_JOB_WORKERS];
+
+    // One queue per worker plus one shared by all threads that are not workers.
+    JobQueue queues[MAX_JOB_WORKERS + 1];
+    std::atomic<u32> nextQueue;
+
+    std::atomic<u64> scratchArenaSize; // Reserved size, JOB_SCRATCH_ARENA_SIZE when smaller.
+    std::atomic<s32> queuedJobs;
+    std::atomic<b32> quit;
+    std::mutex wakeMutex;
+    std::condition_variable wakeCondition;
+};
+
+static JobSystem jobs;
+static thread_local s32 currentQueue = -1;
+static thread_local Arena scratchArena;
+
+static s32 GetCurrentQueue()
+{
+    // Threads that are not workers share the last queue.
+    return currentQueue >= 0 ? currentQueue : jobs.workerCount;
+}
+
+static b32 JobQueue_Push(JobQueue* queue, const Job& job)
+{
+    std::lock_guard<std::mutex> lock(queue->mutex);
+    if (queue->tail - queue->head >= MAX_JOBS_PER_QUEUE)
+    {
+        return false;
+    }
+    queue->jobs[queue->tail % MAX_JOBS_PER_QUEUE] = job;
+    queue->tail++;
+    return true;
+}
+
+static b32 JobQueue_PopBack(JobQueue* queue, Job* outJob)
+{
+    std::lock_guard<std::mutex> lock(queue->mutex);
+    if (queue->tail == queue->head)
+    {
+        return false;
+    }
+    queue->tail--;
+    *outJob = queue->jobs[queue->tail % MAX_JOBS_PER_QUEUE];
+    return true;
+}
+
+static b32 JobQueue_PopFront(JobQueue* queue, Job* outJob)
+{
+    std::lock_guard<std::mutex> lock(queue->mutex);
+    if (queue->tail == queue->head)
+    {
+        return false;
+    }
+    *outJob = queue->jobs[queue->head % MAX_JOBS_PER_QUEUE];
+    queue->head++;
+    return true;
+}
+
+static b32 FindJob(s32 queueIndex, Job* outJob)
+{
+    if (JobQueue_PopBack(&jobs.queues[queueIndex], outJob))
+    {
+        jobs.queuedJobs--;
+        return true;
+    }
+
+    // Nothing left in our own queue, try to steal from the others.
+    s32 queueCount = jobs.workerCount + 1;
+    for (s32 i = 1; i < queueCount; ++i)
+    {
+        s32 victim = (queueIndex + i) % queueCount;
+        if (JobQueue_PopFront(&jobs.queues[victim], outJob))
+        {
+            jobs.queuedJobs--;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void RunJob(const Job& job, s32 queueIndex)
+{
+    // Restore instead of clearing, a thread helping out while it waits may still use what is below.
+    Arena* scratch = Jobs_GetScratchArena();
+    u64 scratchOffset = scratch->offset;
+    job.function(job.userData, job.begin, job.end, queueIndex);
+    scratch->offset = scratchOffset;
+    job.pendingCount->fetch_sub(1, std::memory_order_release);
+}
+
+static void WorkerMain(s32 workerIndex)
+{
+    currentQueue = workerIndex;
+
+    // Workers only leave once the queues are empty, so shutting down finishes the jobs queued before it.
+    for (;;)
+    {
+        Job job;
+        if (FindJob(workerIndex, &job))
+        {
+            RunJob(job, workerIndex);
+            continue;
+        }
+        if (jobs.quit)
+        {
+            break;
+        }
+
+        std::unique_lock<std::mutex> lock(jobs.wakeMutex);
+        jobs.wakeCondition.wait(lock, []() { return jobs.quit || jobs.queuedJobs > 0; });
+    }
+
+    Platform_Free(scratchArena.base);
+}
+
+static void StartWorkers(s32 workerCount)
+{
+    if (workerCount <= 0)
+    {
+        // The thread calling Jobs_ParallelFor helps out, so leave one core for it.
+        workerCount = (s32)std::thread::hardware_concurrency() - 1;
+    }
+    workerCount = glm::clamp(workerCount, 0, MAX_JOB_WORKERS);
+
+    jobs.workerCount = workerCount;
+    jobs.nextQueue = 0;
+    jobs.queuedJobs = 0;
+    jobs.quit = false;
+
+    for (s32 i = 0; i <= workerCount; ++i)
+    {
+        jobs.queues[i].head = 0;
+        jobs.queues[i].tail = 0;
+    }
+
+    for (s32 i = 0; i < workerCount; ++i)
+    {
+        jobs.workers[i] = std::thread(WorkerMain, i);
+    }
+
+    jobs.initialized = true;
+
+    // Runs before the static job system is destroyed, joinable threads would terminate the process.
+    std::atexit(Jobs_Shutdown);
+}
+
+void Jobs_Init(s32 workerCount)
+{
+    std::call_once(jobs.initFlag, StartWorkers, workerCount);
+}
+
+void Jobs_Shutdown()
+{
+    if (!jobs.initialized)
+    {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(jobs.wakeMutex);
+        jobs.quit = true;
+    }
+    jobs.wakeCondition.notify_all();
+
+    for (s32 i = 0; i < jobs.workerCount; ++i)
+    {
+        jobs.workers[i].join();
+    }
+
+    // Run what was queued while the workers were leaving.
+    s32 queueIndex = GetCurrentQueue();
+    Job job;
+    while (FindJob(queueIndex, &job))
+    {
+        RunJob(job, queueIndex);
+    }
+
+    Platform_Free(scratchArena.base);
+    scratchArena = {};
+
+    // The workers are not started again, from now on the calling thread runs every job.
+    jobs.workerCount = 0;
+    jobs.initialized = false;
+}
+
+s32 Jobs_GetThreadCount()
+{
+    Jobs_Init();
+    return jobs.workerCount + 1;
+}
+
+Arena* Jobs_GetScratchArena()
+{
+    u64 size = jobs.scratchArenaSize.load(std::memory_order_relaxed);
+    if (size < JOB_SCRATCH_ARENA_SIZE)
+    {
+        size = JOB_SCRATCH_ARENA_SIZE;
+    }
+
+    // Nothing points into an empty arena, so it can be replaced by a larger one.
+    if (scratchArena.base && scratchArena.size < size && scratchArena.offset == 0)
+    {
+        Platform_Free(scratchArena.base);
+        scratchArena = {};
+    }
+
+    if (!scratchArena.base)
+    {
+        Arena_Init(&scratchArena, size, Platform_Alloc(size));
+    }
+    return &scratchArena;
+}
+
+void Jobs_ReserveScratchArena(u64 size)
+{
+    u64 reserved = jobs.scratchArenaSize.load(std::memory_order_relaxed);
+    while (reserved < size && !jobs.scratchArenaSize.compare_exchange_weak(reserved, size, std::memory_order_relaxed))
+    {
+    }
+    Jobs_GetScratchArena();
+}
+
+static void QueueChunks(s32 count, s32 chunkSize, JobFunction function, void* userData, std::atomic<s32>* pendingCount)
+{
+    chunkSize = glm::max(chunkSize, 1);
+    s32 queueIndex = GetCurrentQueue();
+    s32 queueCount = jobs.workerCount + 1;
+    s32 chunkCount = (count + chunkSize - 1) / chunkSize;
+
+    pendingCount->fetch_add(chunkCount, std::memory_order_relaxed);
+
+    for (s32 i = 0; i < chunkCount; ++i)
+    {
+        Job job = {};
+        job.function = function;
+        job.userData = userData;
+        job.begin = i * chunkSize;
+        job.end = glm::min(job.begin + chunkSize, count);
+        job.pendingCount = pendingCount;
+
+        // Spread the chunks over all queues so the workers start without having to steal.
+        s32 target = (s32)(jobs.nextQueue++ % (u32)queueCount);
+        jobs.queuedJobs++;
+        if (!JobQueue_Push(&jobs.queues[target], job))
+        {
+            jobs.queuedJobs--;
+            RunJob(job, queueIndex);
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(jobs.wakeMutex);
+    }
+    jobs.wakeCondition.notify_all();
+}
+
+static void WaitForChunks(std::atomic<s32>* pendingCount)
+{
+    s32 queueIndex = GetCurrentQueue();
+
+    // Help out until every chunk has finished.
+    while (pendingCount->load(std::memory_order_acquire) > 0)
+    {
+        Job job;
+        if (FindJob(queueIndex, &job))
+        {
+            RunJob(job, queueIndex);
+        }
+        else
+        {
+            std::this_thread::yield();
+        }
+    }
+}
+
+void Jobs_ParallelFor(s32 count, s32 chunkSize, JobFunction function, void* userData)
+{
+    if (count <= 0)
+    {
+        return;
+    }
+
+    Jobs_Init();
+
+    std::atomic<s32> pendingCount = 0;
+    QueueChunks(count, chunkSize, function, userData, &pendingCount);
+    WaitForChunks(&pendingCount);
+}
+
+void Jobs_ParallelForAsync(s32 count, s32 chunkSize, JobFunction function, void* userData, JobCounter* counter)
+{
+    if (count <= 0)
+    {
+        return;
+    }
+
+    Jobs_Init();
+
+    QueueChunks(count, chunkSize, function, userData, &counter->pendingCount);
+    if (jobs.workerCount == 0)
+    {
+        WaitForChunks(&counter->pendingCount);
+    }
+}
+
+b32 Jobs_IsDone(const JobCounter* counter)
+{
+    return counter->pendingCount.load(std::memory_order_acquire) <= 0;
+}
+
+void Jobs_Wait(JobCounter* counter)
+{
+    WaitForChunks(&counter->pendingCount);
+}
@@ -0,0 +1,51 @@
+#pragma once
+#include "core/types.h"
+#include "core/memory.h"
+
+#include <atomic>
+
+#define MAX_JOB_WORKERS 64
+#define JOB_SCRATCH_ARENA_SIZE (16 * 1024 * 1024) // Smallest scratch arena, Jobs_ReserveScratchArena grows them.
+
+// Function executed by a job for the index range [begin, end). workerIndex is the pool worker running the job, every
+// thread that is not a pool worker passes Jobs_GetThreadCount() - 1. It is only unique among the pool workers, so
+// temporaries per thread belong in Jobs_GetScratchArena rather than in buffers indexed by it.
+typedef void(*JobFunction)(void* userData, s32 begin, s32 end, s32 workerIndex);
+
+// Chunks of an asynchronous Jobs_ParallelFor that have not finished yet.
+struct JobCounter
+{
+    std::atomic<s32> pendingCount;
+};
+
+// Starts the worker threads once, later calls do nothing. A worker count of 0 starts one worker per core but one,
+// the calling thread helps out. Called by the other functions when needed, safe to call from any thread.
+void Jobs_Init(s32 workerCount = 0);
+
+// Finishes the queued jobs, then stops and joins all worker threads. Runs at exit if the workers were started, jobs
+// queued afterwards run on the calling thread.
+void Jobs_Shutdown();
+
+// Returns the number of threads executing jobs, including the calling thread.
+s32 Jobs_GetThreadCount();
+
+// Returns the scratch arena of the calling thread. Whatever a job pushes onto it is popped when the job
+// returns, so it is meant for temporaries and never contends with other threads.
+Arena* Jobs_GetScratchArena();
+
+// Makes every scratch arena at least size bytes. The arena of the calling thread grows right away if it is empty, the
+// others the next time their thread gets its arena while it is empty, which workers do before every job.
+void Jobs_ReserveScratchArena(u64 size);
+
+// Splits [0, count) into chunks, runs them on the workers and waits for completion.
+void Jobs_ParallelFor(s32 count, s32 chunkSize, JobFunction function, void* userData);
+
+// Queues the chunks of [0, count) and returns right away, the counter tracks them. Runs the chunks
+// before returning when there are no workers. Threads helping with other jobs may pick the chunks up too.
+void Jobs_ParallelForAsync(s32 count, s32 chunkSize, JobFunction function, void* userData, JobCounter* counter);
+
+// Returns true once every chunk tracked by the counter has finished.
+b32 Jobs_IsDone(const JobCounter* counter);
+
+// Helps out until every chunk tracked by the counter has finished.
+void Jobs_Wait(JobCounter* counter);
@@ -247,6 +247,11 @@ FileHandle Platform_OpenFile(const char* filename, FileMode mode)
     const char* modeIdentifier[] = { "rb", "wb" };
     FILE* fp = {};
     fopen_s(&fp, filename, modeIdentifier[mode]);
+    if (!fp)
+    {
+        return FileHandle{};
+    }
+
     fseek(fp, 0, SEEK_END);
     u64 size = ftell(fp);
     rewind(fp);
@@ -274,6 +279,22 @@ void Platform_ReadDataFromFile(FileHandle* fileHandle, void* buffer, u64 size)
     fread_s(buffer, fileHandle->size, 1, size, (FILE*)fileHandle->handle);
 }
 
+void Platform_SeekFile(FileHandle* fileHandle, u64 offset)
+{
+    _fseeki64((FILE*)fileHandle->handle, (s64)offset, SEEK_SET);
+}
+
+void Platform_WriteDataToFile(FileHandle* fileHandle, const void* data, u64 size)
+{
+    fwrite(data, 1, size, (FILE*)fileHandle->handle);
+    fileHandle->size += size;
+}
+
+b32 Platform_CreateDirectory(const char* path)
+{
+    return SDL_CreateDirectory(path);
+}
+
 
 void Platform_LogInfo(const char* message, ...)
 {
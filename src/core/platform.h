@@ -64,7 +64,7 @@ enum FileMode
     FileMode_Write
 };
 
-// Opens a file from disk.
+// Opens a file from disk. The handle is null if the file could not be opened.
 FileHandle Platform_OpenFile(const char* filename, FileMode mode);
 
 // Closes a file handle.
@@ -73,6 +73,15 @@ void Platform_CloseFile(FileHandle* fileHandle);
 // Reads some amount of data.
 void Platform_ReadDataFromFile(FileHandle* fileHandle, void* buffer, u64 size);
 
+// Moves the position of the next read or write to an offset from the start of the file.
+void Platform_SeekFile(FileHandle* fileHandle, u64 offset);
+
+// Writes some amount of data.
+void Platform_WriteDataToFile(FileHandle* fileHandle, const void* data, u64 size);
+
+// Creates a directory, returns true if it exists afterwards.
+b32 Platform_CreateDirectory(const char* path);
+
 // Logging
 void Platform_LogInfo(const char* message, ...);
 void Platform_LogError(const char* message, ...);
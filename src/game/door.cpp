@@ -24,6 +24,7 @@ b32 DoorClose(Door* door, Level* level)
 
     if (!entity)
     {
+        LevelSetSolid(level, door->tile_x, door->tile_y, true);
         door->state = DoorState_Closing;
         door->timer = 0.0f;
         return true;
@@ -64,6 +65,7 @@ void DoorUpdate(Door* door, Level* level, f32 dt)
 
             if (door->timer >= kDoorTransitionTime)
             {
+                LevelSetSolid(level, door->tile_x, door->tile_y, false);
                 door->state = DoorState_Open;
                 door->timer = 0.0f;
             }
@@ -71,6 +73,7 @@ void DoorUpdate(Door* door, Level* level, f32 dt)
 
         default: {
             // invalid state
+            LevelSetSolid(level, door->tile_x, door->tile_y, true);
             door->state = DoorState_Closed;
             door->timer = 0.0f;
         } break;
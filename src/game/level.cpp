@@ -78,12 +78,18 @@ void LevelInit(Level* level, u32 width, u32 height, Arena* arena)
 {
     EntityManagerInit(&level->entity_manager, arena);
 
-    u64 arena_size = sizeof(u32) * width * height + width * height * sizeof(Tile);
+    u64 solid_words = (width * height + 63) / 64;
+    u64 arena_size = sizeof(u32) * width * height + width * height * sizeof(Tile) + solid_words * sizeof(u64);
     ArenaInit(&level->arena, arena_size, ArenaPushSize(arena, arena_size));
 
     level->width = width;
     level->height = height;
     level->tiles = (Tile*)ArenaPushSize(&level->arena, width * height * sizeof(Tile));
+    level->solid_bits = (u64*)ArenaPushSize(&level->arena, solid_words * sizeof(u64));
+    for (u64 i = 0; i < solid_words; ++i)
+    {
+        level->solid_bits[i] = 0;
+    }
 }
 
 void LevelFree(Level* level)
@@ -148,6 +154,9 @@ void LevelSetTile(Level* level, u32 x, u32 y, u32 tile_type)
     u32 index = y * level->width + x;
     level->tiles[index].type = tile_type;
 
+    // Doors start closed.
+    LevelSetSolid(level, x, y, tile_type == TILE_WALL || tile_type == TILE_DOOR);
+
     switch (tile_type)
     {
         case TILE_WALL: {
@@ -211,36 +220,39 @@ b32 LevelEntityCanMoveTo(Level* level, Entity* entity, f32 x, f32 y)
     {
         for (u32 x = left_tile; x <= right_tile; ++x)
         {
-            Tile* tile = LevelGetTile(level, x, y);
-            if (tile->type == TILE_WALL)
+            if (IsSolid(level, x, y))
             {
                 return false;
             }
-            else if (tile->type == TILE_DOOR)
-            {
-                Door* door = &level->doors[tile->door_index];
-                if (door->state != DoorState_Open)
-                {
-                    return false;
-                }
-            }
         }
     }
 
     return true;
 }
 
-b32 IsSolid(Level* level, u32 x, u32 y)
+void LevelSetSolid(Level* level, u32 x, u32 y, b32 solid)
 {
-    Tile* tile = LevelGetTile(level, x, y);
+    u32 index = y * level->width + x;
+    if (solid)
+    {
+        level->solid_bits[index / 64] |= 1ull << (index % 64);
+    }
+    else
+    {
+        level->solid_bits[index / 64] &= ~(1ull << (index % 64));
+    }
+}
 
-    if (tile->type == TILE_DOOR)
+b32 IsSolid(Level* level, u32 x, u32 y)
+{
+    // Negative coordinates wrap around to large values and are caught here too.
+    if (x >= level->width || y >= level->height)
     {
-        Door* door = &level->doors[tile->door_index];
-        return (door->state != DoorState_Open);
+        return true;
     }
 
-    return tile->type == TILE_WALL;
+    u32 index = y * level->width + x;
+    return (level->solid_bits[index / 64] >> (index % 64)) & 1;
 }
 
 b32 IsTrigger(Level* level, u32 x, u32 y)
@@ -291,8 +303,6 @@ RayCastInfo LevelCastRay(Level* level, Vec2 origin, Vec2 direction, u32 max_dept
             side = true;
         }
 
-        Tile* tile = LevelGetTile(level, level_position.x, level_position.y);
-
         if (IsSolid(level, level_position.x, level_position.y))
         {
             hit = true;
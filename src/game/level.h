@@ -76,6 +76,9 @@ struct Level
     u32 height;
     Tile* tiles;
 
+    // One bit per tile, set for walls and closed doors. Collision and ray casts read this instead of the tiles.
+    u64* solid_bits;
+
     u32 doors_count;
     Door doors[kMaxDoors];
 
@@ -103,7 +106,10 @@ Entity* LevelGetEntityAt(Level* level, u32 x, u32 y);
 // Returns true if the entity can move to the specified position.
 b32 LevelEntityCanMoveTo(Level* level, Entity* entity, f32 x, f32 y);
 
-// Returns true if the tile is solid.
+// Marks the tile as solid or not, called when a door opens or closes.
+void LevelSetSolid(Level* level, u32 x, u32 y, b32 solid);
+
+// Returns true if the tile is solid or outside the level.
 b32 IsSolid(Level* level, u32 x, u32 y);
 
 // Returns true if the tile is a trigger.
@@ -1,5 +1,6 @@
 ﻿#include "image.h"
 #include "core/platform.h"
+#include <string.h>
 #define _CRT_SECURE_NO_WARNINGS
 
 #define STB_IMAGE_IMPLEMENTATION
@@ -24,6 +25,346 @@ Image Image_LoadFromFile(const char* filename)
     return image;
 }
 
+Image Image_Create(s32 width, s32 height, Arena* arena)
+{
+    Image image = {};
+    image.width = width;
+    image.height = height;
+    image.pixels = ArenaPushArray(arena, u32, width * height);
+    Platform_Assert(image.pixels, "Arena is full.");
+    return image;
+}
+
+HdrImage HdrImage_Create(s32 width, s32 height, Arena* arena)
+{
+    HdrImage image = {};
+    image.width = width;
+    image.height = height;
+    image.pixels = ArenaPushArray(arena, glm::vec3, width * height);
+    Platform_Assert(image.pixels, "Arena is full.");
+    return image;
+}
+
+void HdrImage_Fill(HdrImage* image, glm::vec3 color)
+{
+    for (s32 i = 0; i < image->width * image->height; ++i)
+    {
+        image->pixels[i] = color;
+    }
+}
+
+void HdrImage_Downsample2x(HdrImage* dst, const HdrImage* src)
+{
+    for (s32 y = 0; y < dst->height; ++y)
+    {
+        const glm::vec3* top = src->pixels + y * 2 * src->width;
+        const glm::vec3* bottom = top + src->width;
+        for (s32 x = 0; x < dst->width; ++x)
+        {
+            dst->pixels[y * dst->width + x] = (top[x * 2] + top[x * 2 + 1] + bottom[x * 2] + bottom[x * 2 + 1]) * 0.25f;
+        }
+    }
+}
+
+static u32 QuantizeChannel(f32 value)
+{
+    return (u32)glm::min(glm::max(value * 255.0f, 0.0f), 255.0f);
+}
+
+void Image_QuantizeHdr(Image* dest, s32 x, s32 y, const HdrImage* src, s32 srcX, s32 srcY, s32 width, s32 height, const u8* alpha)
+{
+    for (s32 row = 0; row < height; ++row)
+    {
+        const glm::vec3* colors = src->pixels + (srcY + row) * src->width + srcX;
+        u32* pixels = (u32*)dest->pixels + (y + row) * dest->width + x;
+        for (s32 i = 0; i < width; ++i)
+        {
+            u32 a = alpha ? alpha[row * width + i] : 0xFF;
+            pixels[i] = (a << 24) | (QuantizeChannel(colors[i].b) << 16) | (QuantizeChannel(colors[i].g) << 8) | QuantizeChannel(colors[i].r);
+        }
+    }
+}
+
+u64 Image_GetFormatSize(s32 width, s32 height, TextureFormat format)
+{
+    if (format == TextureFormat_RGBA8)
+    {
+        return sizeof(u32) * width * height;
+    }
+    return (u64)(width / 4) * (height / 4) * (format == TextureFormat_BC1 ? 8 : 16);
+}
+
+static u16 PackRgb565(const u8* rgb)
+{
+    u32 r = (rgb[0] * 31 + 127) / 255;
+    u32 g = (rgb[1] * 63 + 127) / 255;
+    u32 b = (rgb[2] * 31 + 127) / 255;
+    return (u16)((r << 11) | (g << 5) | b);
+}
+
+static void UnpackRgb565(u16 color, u8* outRgb)
+{
+    u32 r = (color >> 11) & 31;
+    u32 g = (color >> 5) & 63;
+    u32 b = color & 31;
+    outRgb[0] = (u8)((r << 3) | (r >> 2));
+    outRgb[1] = (u8)((g << 2) | (g >> 4));
+    outRgb[2] = (u8)((b << 3) | (b >> 2));
+}
+
+// The four colors of a color block. Three colors and black when color0 <= color1, unless the block is part of BC3.
+static void GetBlockPalette(u16 color0, u16 color1, b32 alwaysFourColors, u8 outPalette[4][3])
+{
+    UnpackRgb565(color0, outPalette[0]);
+    UnpackRgb565(color1, outPalette[1]);
+    for (s32 i = 0; i < 3; ++i)
+    {
+        u32 a = outPalette[0][i];
+        u32 b = outPalette[1][i];
+        if (alwaysFourColors || color0 > color1)
+        {
+            outPalette[2][i] = (u8)((2 * a + b) / 3);
+            outPalette[3][i] = (u8)((a + 2 * b) / 3);
+        }
+        else
+        {
+            outPalette[2][i] = (u8)((a + b) / 2);
+            outPalette[3][i] = 0;
+        }
+    }
+}
+
+static s32 GetColorDistance(const u8* a, const u8* b)
+{
+    s32 dr = (s32)a[0] - (s32)b[0];
+    s32 dg = (s32)a[1] - (s32)b[1];
+    s32 db = (s32)a[2] - (s32)b[2];
+    return dr * dr + dg * dg + db * db;
+}
+
+// Picks the endpoints as the two pixels furthest apart along the main axis of the block colors,
+// then gives every pixel the closest of the four palette colors.
+static void CompressColorBlock(const u8 pixels[16][4], u8* out)
+{
+    glm::vec3 mean = glm::vec3(0.0f);
+    for (s32 i = 0; i < 16; ++i)
+    {
+        mean += glm::vec3(pixels[i][0], pixels[i][1], pixels[i][2]);
+    }
+    mean /= 16.0f;
+
+    f32 covariance[6] = {};
+    for (s32 i = 0; i < 16; ++i)
+    {
+        glm::vec3 d = glm::vec3(pixels[i][0], pixels[i][1], pixels[i][2]) - mean;
+        covariance[0] += d.r * d.r;
+        covariance[1] += d.r * d.g;
+        covariance[2] += d.r * d.b;
+        covariance[3] += d.g * d.g;
+        covariance[4] += d.g * d.b;
+        covariance[5] += d.b * d.b;
+    }
+
+    // A few power iterations are enough to find the main axis of 16 colors.
+    glm::vec3 axis = glm::vec3(1.0f, 1.0f, 1.0f);
+    for (s32 i = 0; i < 4; ++i)
+    {
+        glm::vec3 next = glm::vec3(axis.r * covariance[0] + axis.g * covariance[1] + axis.b * covariance[2],
+                                   axis.r * covariance[1] + axis.g * covariance[3] + axis.b * covariance[4],
+                                   axis.r * covariance[2] + axis.g * covariance[4] + axis.b * covariance[5]);
+        f32 length = glm::max(glm::abs(next.r), glm::max(glm::abs(next.g), glm::abs(next.b)));
+        if (length == 0.0f)
+        {
+            break;
+        }
+        axis = next / length;
+    }
+
+    s32 minIndex = 0;
+    s32 maxIndex = 0;
+    f32 minDot = 1e30f;
+    f32 maxDot = -1e30f;
+    for (s32 i = 0; i < 16; ++i)
+    {
+        f32 d = glm::dot(glm::vec3(pixels[i][0], pixels[i][1], pixels[i][2]), axis);
+        if (d < minDot) { minDot = d; minIndex = i; }
+        if (d > maxDot) { maxDot = d; maxIndex = i; }
+    }
+
+    u16 color0 = PackRgb565(pixels[maxIndex]);
+    u16 color1 = PackRgb565(pixels[minIndex]);
+    if (color0 < color1)
+    {
+        u16 swap = color0;
+        color0 = color1;
+        color1 = swap;
+    }
+
+    // With equal endpoints every pixel takes color0.
+    u32 indices = 0;
+    if (color0 != color1)
+    {
+        u8 palette[4][3];
+        GetBlockPalette(color0, color1, false, palette);
+        for (s32 i = 0; i < 16; ++i)
+        {
+            u32 best = 0;
+            s32 bestDistance = GetColorDistance(pixels[i], palette[0]);
+            for (u32 j = 1; j < 4; ++j)
+            {
+                s32 distance = GetColorDistance(pixels[i], palette[j]);
+                if (distance < bestDistance)
+                {
+                    bestDistance = distance;
+                    best = j;
+                }
+            }
+            indices |= best << (i * 2);
+        }
+    }
+
+    out[0] = (u8)color0;
+    out[1] = (u8)(color0 >> 8);
+    out[2] = (u8)color1;
+    out[3] = (u8)(color1 >> 8);
+    out[4] = (u8)indices;
+    out[5] = (u8)(indices >> 8);
+    out[6] = (u8)(indices >> 16);
+    out[7] = (u8)(indices >> 24);
+}
+
+// The eight alphas of an alpha block with alpha0 > alpha1, six evenly spaced ones between them.
+static void GetAlphaPalette(u8 alpha0, u8 alpha1, u8 outPalette[8])
+{
+    outPalette[0] = alpha0;
+    outPalette[1] = alpha1;
+    if (alpha0 > alpha1)
+    {
+        for (s32 i = 2; i < 8; ++i)
+        {
+            outPalette[i] = (u8)(((8 - i) * alpha0 + (i - 1) * alpha1) / 7);
+        }
+    }
+    else
+    {
+        for (s32 i = 2; i < 6; ++i)
+        {
+            outPalette[i] = (u8)(((6 - i) * alpha0 + (i - 1) * alpha1) / 5);
+        }
+        outPalette[6] = 0;
+        outPalette[7] = 255;
+    }
+}
+
+static void CompressAlphaBlock(const u8 pixels[16][4], u8* out)
+{
+    u8 alpha0 = 0;
+    u8 alpha1 = 255;
+    for (s32 i = 0; i < 16; ++i)
+    {
+        alpha0 = glm::max(alpha0, pixels[i][3]);
+        alpha1 = glm::min(alpha1, pixels[i][3]);
+    }
+
+    u64 indices = 0;
+    if (alpha0 != alpha1)
+    {
+        u8 palette[8];
+        GetAlphaPalette(alpha0, alpha1, palette);
+        for (s32 i = 0; i < 16; ++i)
+        {
+            u64 best = 0;
+            s32 bestDistance = 256;
+            for (u64 j = 0; j < 8; ++j)
+            {
+                s32 distance = glm::abs((s32)pixels[i][3] - (s32)palette[j]);
+                if (distance < bestDistance)
+                {
+                    bestDistance = distance;
+                    best = j;
+                }
+            }
+            indices |= best << (i * 3);
+        }
+    }
+
+    out[0] = alpha0;
+    out[1] = alpha1;
+    for (s32 i = 0; i < 6; ++i)
+    {
+        out[2 + i] = (u8)(indices >> (i * 8));
+    }
+}
+
+void Image_CompressRect(const Image* image, s32 x, s32 y, s32 width, s32 height, TextureFormat format, void* outBlocks)
+{
+    Platform_Assert(format != TextureFormat_RGBA8, "Texture format is not compressed.");
+    Platform_Assert(x % 4 == 0 && y % 4 == 0 && width % 4 == 0 && height % 4 == 0, "Rectangle is not made of whole blocks.");
+
+    u8* out = (u8*)outBlocks;
+    for (s32 blockY = y; blockY < y + height; blockY += 4)
+    {
+        for (s32 blockX = x; blockX < x + width; blockX += 4)
+        {
+            u8 pixels[16][4];
+            for (s32 i = 0; i < 4; ++i)
+            {
+                memcpy(pixels[i * 4], (const u32*)image->pixels + (blockY + i) * image->width + blockX, sizeof(u32) * 4);
+            }
+
+            if (format == TextureFormat_BC3)
+            {
+                CompressAlphaBlock(pixels, out);
+                out += 8;
+            }
+            CompressColorBlock(pixels, out);
+            out += 8;
+        }
+    }
+}
+
+void Image_DecompressRect(Image* image, s32 x, s32 y, s32 width, s32 height, TextureFormat format, const void* blocks)
+{
+    Platform_Assert(format != TextureFormat_RGBA8, "Texture format is not compressed.");
+    Platform_Assert(x % 4 == 0 && y % 4 == 0 && width % 4 == 0 && height % 4 == 0, "Rectangle is not made of whole blocks.");
+
+    const u8* in = (const u8*)blocks;
+    for (s32 blockY = y; blockY < y + height; blockY += 4)
+    {
+        for (s32 blockX = x; blockX < x + width; blockX += 4)
+        {
+            u8 alphas[8] = { 255, 255, 255, 255, 255, 255, 255, 255 };
+            u64 alphaIndices = 0;
+            if (format == TextureFormat_BC3)
+            {
+                GetAlphaPalette(in[0], in[1], alphas);
+                for (s32 i = 0; i < 6; ++i)
+                {
+                    alphaIndices |= (u64)in[2 + i] << (i * 8);
+                }
+                in += 8;
+            }
+
+            u16 color0 = (u16)(in[0] | (in[1] << 8));
+            u16 color1 = (u16)(in[2] | (in[3] << 8));
+            u32 indices = (u32)in[4] | ((u32)in[5] << 8) | ((u32)in[6] << 16) | ((u32)in[7] << 24);
+            u8 palette[4][3];
+            GetBlockPalette(color0, color1, format == TextureFormat_BC3, palette);
+            in += 8;
+
+            for (s32 i = 0; i < 16; ++i)
+            {
+                const u8* rgb = palette[(indices >> (i * 2)) & 3];
+                u8* pixel = (u8*)((u32*)image->pixels + (blockY + i / 4) * image->width + blockX + i % 4);
+                pixel[0] = rgb[0];
+                pixel[1] = rgb[1];
+                pixel[2] = rgb[2];
+                pixel[3] = alphas[(alphaIndices >> (i * 3)) & 7];
+            }
+        }
+    }
+}
+
 void Image_Free(Image* image)
 {
     if (image->pixels)
@@ -87,6 +428,37 @@ void Image_CopyPixel(Image* image, s32 srcX, s32 srcY, s32 dstX, s32 dstY)
     pixels[dstX + dstY * image->width] = color;
 }
 
+void Image_DilateRect(Image* image, s32 x, s32 y, s32 width, s32 height, s32 padding)
+{
+    Platform_Assert(x >= padding && y >= padding && x + width + padding <= image->width && y + height + padding <= image->height, "Dilated rectangle is out of the image.");
+
+    u32* pixels = (u32*)image->pixels;
+    s32 stride = image->width;
+
+    // Repeat the first and last pixel of every row into the padding beside it.
+    for (s32 row = y; row < y + height; ++row)
+    {
+        u32* line = pixels + row * stride;
+        u32 left = line[x];
+        u32 right = line[x + width - 1];
+        for (s32 i = 1; i <= padding; ++i)
+        {
+            line[x - i] = left;
+            line[x + width - 1 + i] = right;
+        }
+    }
+
+    // Then copy the padded first and last row over the rows above and below, which fills the corners too.
+    u64 rowSize = sizeof(u32) * (width + padding * 2);
+    const u32* top = pixels + y * stride + x - padding;
+    const u32* bottom = pixels + (y + height - 1) * stride + x - padding;
+    for (s32 i = 1; i <= padding; ++i)
+    {
+        Platform_CopyMemory(pixels + (y - i) * stride + x - padding, top, rowSize);
+        Platform_CopyMemory(pixels + (y + height - 1 + i) * stride + x - padding, bottom, rowSize);
+    }
+}
+
 void Image_Downsample2x(Image* dst, const Image* src)
 {
     for (s32 y = 0; y < dst->height; ++y)
@@ -1,6 +1,8 @@
 #pragma once
 #include "core/types.h"
 #include "renderer/color.h"
+#include "renderer/rhi.h"
+#include "core/memory.h"
 
 struct Image
 {
@@ -9,9 +11,42 @@ struct Image
     void* pixels;
 };
 
+// Image with a linear RGB float color per pixel, for accumulating light without clamping.
+struct HdrImage
+{
+    s32 width;
+    s32 height;
+    glm::vec3* pixels;
+};
+
 // Loads an image from a file and returns an Image struct.
 Image Image_LoadFromFile(const char* filename);
 
+// Creates an image with uninitialized pixels pushed onto the arena. The pixels go away with the arena, don't call Image_Free on it.
+Image Image_Create(s32 width, s32 height, Arena* arena);
+
+// Creates an HDR image with uninitialized pixels pushed onto the arena.
+HdrImage HdrImage_Create(s32 width, s32 height, Arena* arena);
+
+// Fills an HDR image with a single color.
+void HdrImage_Fill(HdrImage* image, glm::vec3 color);
+
+// Downsamples an HDR image by a factor of 2.
+void HdrImage_Downsample2x(HdrImage* dst, const HdrImage* src);
+
+// Clamps a rectangle of an HDR image to [0, 1] and writes it as ABGR pixels at x, y of the destination.
+// Alpha holds one value per pixel of the rectangle, the pixels are opaque without it.
+void Image_QuantizeHdr(Image* dest, s32 x, s32 y, const HdrImage* src, s32 srcX, s32 srcY, s32 width, s32 height, const u8* alpha = nullptr);
+
+// Returns the size in bytes of width x height pixels in a texture format, a multiple of 4 on both axes for the compressed ones.
+u64 Image_GetFormatSize(s32 width, s32 height, TextureFormat format);
+
+// Compresses a rectangle of ABGR pixels into 4x4 blocks written row by row. All of x, y, width and height are multiples of 4.
+void Image_CompressRect(const Image* image, s32 x, s32 y, s32 width, s32 height, TextureFormat format, void* outBlocks);
+
+// Decodes blocks written by Image_CompressRect into a rectangle of ABGR pixels, BC1 pixels are opaque.
+void Image_DecompressRect(Image* image, s32 x, s32 y, s32 width, s32 height, TextureFormat format, const void* blocks);
+
 // Frees the memory used by an Image struct.
 void Image_Free(Image* image);
 
@@ -27,6 +62,9 @@ void Image_Blit(Image* dest, Image* src, s32 x, s32 y);
 // Copies a pixel from one position to another in the same image.
 void Image_CopyPixel(Image* image, s32 srcX, s32 srcY, s32 dstX, s32 dstY);
 
+// Fills the padding around a rectangle of the image by repeating its edge pixels outwards, corners included.
+void Image_DilateRect(Image* image, s32 x, s32 y, s32 width, s32 height, s32 padding);
+
 // Downsamples an image by a factor of 2.
 void Image_Downsample2x(Image* dst, const Image* src);
 
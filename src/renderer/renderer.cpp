@@ -12,6 +12,8 @@ struct RenderCommand
     const Mesh* mesh;
     const Material* material;
     glm::mat4 transform;
+    AmbientCube ambientCube;
+    b32 useAmbientCube;
 };
 
 struct RenderState
@@ -24,6 +26,7 @@ struct RenderState
     RenderCommand commands[MAX_RENDER_COMMANDS];
     u32 commandCount;
 
+    ShaderId meshShader;
     ShaderId screenShader;
     VertexBufferId screenVbo;
     FramebufferId framebuffer;
@@ -49,6 +52,13 @@ Mesh CreateMesh(const Vertex* vertices, u32 vertexCount, const u32* indices, u32
     return mesh;
 }
 
+void DestroyMesh(Mesh* mesh)
+{
+    RHI_DestroyVertexBuffer(mesh->vbo);
+    RHI_DestroyIndexBuffer(mesh->ibo);
+    *mesh = {};
+}
+
 void Renderer_Init(Arena* arena)
 {
     // Init framebuffer
@@ -72,12 +82,15 @@ void Renderer_Init(Arena* arena)
         state.screenVbo = RHI_CreateVertexBuffer(screenVertices, sizeof(screenVertices), screenMeshLayout);
     }
 
+    state.meshShader = Asset_LoadShader("shaders/mesh.vs", "shaders/mesh.fs");
+
     LineRenderer_Init(arena);
 }
 
 void Renderer_Shutdown()
 {
     RHI_DestroyFramebuffer(state.framebuffer);
+    Asset_FreeShader(state.meshShader);
     LineRenderer_Shutdown();
 }
 
@@ -110,36 +123,44 @@ void Renderer_EndFrame()
         const RenderCommand* command = &state.commands[i];
         const Mesh* mesh = command->mesh;
         const Material* material = command->material;
+        ShaderId shader = material->shader ? material->shader : state.meshShader;
 
-        RHI_BindShader(material->shader);
-        RHI_SetShaderUniformMat4(material->shader, "uProjectionMatrix", state.projectionMatrix);
-        RHI_SetShaderUniformMat4(material->shader, "uViewMatrix", state.viewMatrix);
-        RHI_SetShaderUniformMat4(material->shader, "uModelMatrix", command->transform);
+        RHI_BindShader(shader);
+        RHI_SetShaderUniformMat4(shader, "uProjectionMatrix", state.projectionMatrix);
+        RHI_SetShaderUniformMat4(shader, "uViewMatrix", state.viewMatrix);
+        RHI_SetShaderUniformMat4(shader, "uModelMatrix", command->transform);
 
-        RHI_SetShaderUniformVec3(material->shader, "uDiffuseColor", material->diffuseColor);
+        RHI_SetShaderUniformVec3(shader, "uDiffuseColor", material->diffuseColor);
 
+        RHI_SetShaderUniformInt(shader, "uUseDiffuseTexture", material->diffuseTexture != 0);
         if (material->diffuseTexture)
         {
-            RHI_SetShaderUniformInt(material->shader, "uDiffuseTexture", 0);
+            RHI_SetShaderUniformInt(shader, "uDiffuseTexture", 0);
             RHI_BindTexture(material->diffuseTexture, 0);
         }
 
-        RHI_SetShaderUniformInt(material->shader, "uUseLightmap", (s32)material->useLightmap);
+        RHI_SetShaderUniformInt(shader, "uUseLightmap", (s32)material->useLightmap);
         if (material->useLightmap)
         {
-            RHI_SetShaderUniformInt(material->shader, "uLightmapTexture", 1);
+            RHI_SetShaderUniformInt(shader, "uLightmapTexture", 1);
             RHI_BindTexture(material->lightmapTexture, 1);
         }
 
+        RHI_SetShaderUniformInt(shader, "uUseAmbientCube", (s32)command->useAmbientCube);
+        if (command->useAmbientCube)
+        {
+            RHI_SetShaderUniformVec3Array(shader, "uAmbientCube", command->ambientCube.colors, 6);
+        }
+
         for (u32 i = 0; i < state.lightCount; ++i)
         {
             Light* light = &state.lights[i];
-            RHI_SetShaderUniformVec3(material->shader, TextFormat("uLights[%d].position", i), light->position);
-            RHI_SetShaderUniformVec3(material->shader, TextFormat("uLights[%d].color", i), light->color);
-            RHI_SetShaderUniformFloat(material->shader, TextFormat("uLights[%d].intensity", i), light->intensity);
-            RHI_SetShaderUniformFloat(material->shader, TextFormat("uLights[%d].range", i), light->range);
+            RHI_SetShaderUniformVec3(shader, TextFormat("uLights[%d].position", i), light->position);
+            RHI_SetShaderUniformVec3(shader, TextFormat("uLights[%d].color", i), light->color);
+            RHI_SetShaderUniformFloat(shader, TextFormat("uLights[%d].intensity", i), light->intensity);
+            RHI_SetShaderUniformFloat(shader, TextFormat("uLights[%d].range", i), light->range);
         }
-        RHI_SetShaderUniformInt(material->shader, "uLightCount", state.lightCount);
+        RHI_SetShaderUniformInt(shader, "uLightCount", state.lightCount);
 
         RHI_BindVertexBuffer(mesh->vbo);
         RHI_BindIndexBuffer(mesh->ibo);
@@ -212,7 +233,7 @@ void Renderer_DrawBox(glm::vec3 min, glm::vec3 max, glm::vec4 color)
     LineRenderer_DrawLine(v4, v8, color);
 }
 
-void Renderer_DrawMesh(const Mesh* mesh, const Material* material, const glm::mat4& transform)
+void Renderer_DrawMesh(const Mesh* mesh, const Material* material, const glm::mat4& transform, const AmbientCube* ambientCube)
 {
     if (state.commandCount >= MAX_RENDER_COMMANDS)
     {
@@ -223,4 +244,9 @@ void Renderer_DrawMesh(const Mesh* mesh, const Material* material, const glm::ma
     command->mesh = mesh;
     command->material = material;
     command->transform = transform;
+    command->useAmbientCube = ambientCube != nullptr;
+    if (ambientCube)
+    {
+        command->ambientCube = *ambientCube;
+    }
 }
@@ -39,7 +39,15 @@ struct Light
     f32 range;
 };
 
+// Irradiance arriving at a point from each axis direction: +x, -x, +y, -y, +z, -z.
+// A normal n is lit by the sum of the colors of its axes weighted by n.x^2, n.y^2 and n.z^2.
+struct AmbientCube
+{
+    glm::vec3 colors[6];
+};
+
 Mesh CreateMesh(const Vertex* vertices, u32 vertexCount, const u32* indices, u32 indexCount);
+void DestroyMesh(Mesh* mesh);
 
 
 void Renderer_Init(Arena* arena);
@@ -50,4 +58,6 @@ void Renderer_EndFrame();
 void Renderer_AddLight(const Light* light);
 void Renderer_DrawLine(glm::vec3 v1, glm::vec3 v2, glm::vec4 color = glm::vec4(1.0f, 1.0f, 1.0f, 1.0f));
 void Renderer_DrawBox(glm::vec3 min, glm::vec3 max, glm::vec4 color = glm::vec4(0.5f, 1.0f, 0.5f, 1.0f));
-void Renderer_DrawMesh(const Mesh* mesh, const Material* material, const glm::mat4& transform);
+// Meshes without a lightmap are lit by the added lights plus the ambient cube, or a flat ambient light without one.
+// Materials without a shader use shaders/mesh.vs and shaders/mesh.fs, which read every uniform set here.
+void Renderer_DrawMesh(const Mesh* mesh, const Material* material, const glm::mat4& transform, const AmbientCube* ambientCube = nullptr);
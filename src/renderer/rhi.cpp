@@ -174,6 +174,30 @@ static GLenum TextureFilterToOpenGL(TextureFilter filter)
     }
 }
 
+// S3TC formats, from EXT_texture_compression_s3tc.
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+    #define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+    #define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+static GLenum TextureFormatToOpenGL(TextureFormat format)
+{
+    switch (format)
+    {
+        case TextureFormat_RGBA8: return GL_RGBA8;
+        case TextureFormat_BC1: return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+        case TextureFormat_BC3: return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+        default: return GL_RGBA8;
+    }
+}
+
+static u32 GetCompressedBlockSize(TextureFormat format)
+{
+    return format == TextureFormat_BC1 ? 8 : 16;
+}
+
 void RHI_Init()
 {
     gladLoadGL();
@@ -333,6 +357,19 @@ void RHI_SetShaderUniformVec3(ShaderId shaderId, const char* name, const glm::ve
 
 }
 
+void RHI_SetShaderUniformVec3Array(ShaderId shaderId, const char* name, const glm::vec3* values, s32 count)
+{
+    if (shaderId == 0 || shaderId >= MAX_SHADERS)
+        return;
+
+    Shader& shader = shaders[shaderId];
+    GLint location = glGetUniformLocation(shader.id, name);
+    if (location != -1)
+    {
+        glUniform3fv(location, count, &values[0].x);
+    }
+}
+
 void RHI_SetShaderUniformVec4(ShaderId shaderId, const char* name, const glm::vec4& value)
 {
     if (shaderId == 0 || shaderId >= MAX_SHADERS)
@@ -504,6 +541,59 @@ TextureId RHI_CreateTexture(const void* pixels, u32 width, u32 height, TextureFi
     return 0;
 }
 
+void RHI_UpdateTexture(TextureId textureId, u32 x, u32 y, u32 width, u32 height, const void* pixels, u32 rowLength)
+{
+    if (textureId == 0 || textureId >= MAX_TEXTURES)
+        return;
+
+    Texture& texture = textures[textureId];
+    glBindTexture(GL_TEXTURE_2D, texture.id);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, rowLength);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+}
+
+TextureId RHI_CreateCompressedTexture(const void* blocks, u32 width, u32 height, TextureFormat format, TextureFilter filter)
+{
+    Platform_Assert(format != TextureFormat_RGBA8, "Texture format is not compressed.");
+
+    for (uint32_t i = 1; i < MAX_TEXTURES; ++i)
+    {
+        if (!textureUsed[i])
+        {
+            textureUsed[i] = true;
+            Texture& texture = textures[i];
+
+            u32 size = (width / 4) * (height / 4) * GetCompressedBlockSize(format);
+            glGenTextures(1, &texture.id);
+            glBindTexture(GL_TEXTURE_2D, texture.id);
+            glCompressedTexImage2D(GL_TEXTURE_2D, 0, TextureFormatToOpenGL(format), width, height, 0, size, blocks);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, TextureFilterToOpenGL(filter));
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, TextureFilterToOpenGL(filter));
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+
+            texture.width = width;
+            texture.height = height;
+
+            return i;
+        }
+    }
+    return 0;
+}
+
+void RHI_UpdateCompressedTexture(TextureId textureId, u32 x, u32 y, u32 width, u32 height, TextureFormat format, const void* blocks)
+{
+    if (textureId == 0 || textureId >= MAX_TEXTURES)
+        return;
+
+    Texture& texture = textures[textureId];
+    u32 size = (width / 4) * (height / 4) * GetCompressedBlockSize(format);
+    glBindTexture(GL_TEXTURE_2D, texture.id);
+    glCompressedTexSubImage2D(GL_TEXTURE_2D, 0, x, y, width, height, TextureFormatToOpenGL(format), size, blocks);
+}
+
 void RHI_DestroyTexture(TextureId textureId)
 {
     if (textureId == 0 || textureId >= MAX_TEXTURES)
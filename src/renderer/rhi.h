@@ -43,6 +43,13 @@ enum TextureFilter
     TextureFilter_Linear
 };
 
+enum TextureFormat
+{
+    TextureFormat_RGBA8,
+    TextureFormat_BC1, // S3TC DXT1, RGB in 8 bytes per 4x4 block.
+    TextureFormat_BC3  // S3TC DXT5, RGB like BC1 plus alpha in 16 bytes per 4x4 block.
+};
+
 struct BufferElement
 {
     s32 location;
@@ -79,6 +86,7 @@ void RHI_SetShaderUniformInt(ShaderId shader, const char* name, s32 value);
 void RHI_SetShaderUniformFloat(ShaderId shader, const char* name, f32 value);
 void RHI_SetShaderUniformVec2(ShaderId shader, const char* name, const glm::vec2& value);
 void RHI_SetShaderUniformVec3(ShaderId shader, const char* name, const glm::vec3& value);
+void RHI_SetShaderUniformVec3Array(ShaderId shader, const char* name, const glm::vec3* values, s32 count);
 void RHI_SetShaderUniformVec4(ShaderId shader, const char* name, const glm::vec4& value);
 void RHI_SetShaderUniformMat4(ShaderId shader, const char* name, const glm::mat4& value);
 
@@ -97,6 +105,13 @@ void RHI_UnbindIndexBuffer();
 
 // Texture
 TextureId RHI_CreateTexture(const void* pixels, u32 width, u32 height, TextureFilter filter = TextureFilter_Linear);
+// Replaces a sub-rectangle of an RGBA8 texture. Pixels has rowLength pixels per row, so a rect of a larger image
+// can be uploaded in place. Mipmaps are not regenerated.
+void RHI_UpdateTexture(TextureId texture, u32 x, u32 y, u32 width, u32 height, const void* pixels, u32 rowLength);
+// Creates a texture without mipmaps from 4x4 blocks of a compressed format laid out row by row. Width and height are multiples of 4.
+TextureId RHI_CreateCompressedTexture(const void* blocks, u32 width, u32 height, TextureFormat format, TextureFilter filter = TextureFilter_Linear);
+// Replaces a rectangle of a compressed texture with blocks laid out row by row. All of x, y, width and height are multiples of 4.
+void RHI_UpdateCompressedTexture(TextureId texture, u32 x, u32 y, u32 width, u32 height, TextureFormat format, const void* blocks);
 void RHI_DestroyTexture(TextureId texture);
 void RHI_BindTexture(TextureId texture, u32 slot = 0);
 void RHI_UnbindTexture(TextureId texture);
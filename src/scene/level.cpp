@@ -1,111 +1,1152 @@
 #include "level.h"
+#include "core/jobs.h"
+#include "core/platform.h"
 
-void Level_Init(Level* level, s32 width, s32 height, Arena* arena)
+#include <atomic>
+#include <cmath>
+
+#if defined(_M_X64) || defined(__SSE2__)
+    #include <emmintrin.h>
+    #define LEVEL_RAY_PACKET_SSE2
+#endif
+
+// Tiles per side of the blocks of each occupancy level, as a shift.
+static const s32 occupancyShifts[LEVEL_OCCUPANCY_LEVELS] = { 2, 4 };
+
+static s32 GetOccupancyWidth(const Level* level, s32 occupancyLevel)
+{
+    return (level->width + (1 << occupancyShifts[occupancyLevel]) - 1) >> occupancyShifts[occupancyLevel];
+}
+
+static s32 GetOccupancyHeight(const Level* level, s32 occupancyLevel)
+{
+    return (level->height + (1 << occupancyShifts[occupancyLevel]) - 1) >> occupancyShifts[occupancyLevel];
+}
+
+// Tiles in each layer, including the ones of LevelLayout_Blocked blocks that are outside the level.
+static s32 GetLayerTileCount(const Level* level)
+{
+    switch (level->layout)
+    {
+    case LevelLayout_Blocked: {
+        s32 blockRows = (level->height + (1 << LEVEL_TILE_BLOCK_SHIFT) - 1) >> LEVEL_TILE_BLOCK_SHIFT;
+        return (level->tileBlocksPerRow * blockRows) << (2 * LEVEL_TILE_BLOCK_SHIFT);
+    }
+    case LevelLayout_Chunked: return level->residentChunkCount * LEVEL_CHUNK_TILE_COUNT;
+    default: return level->width * level->height;
+    }
+}
+
+// Index of a tile in the level layers, -1 if its chunk is not resident.
+static s32 GetTileIndex(const Level* level, s32 x, s32 y)
+{
+    switch (level->layout)
+    {
+    case LevelLayout_Blocked: {
+        // The three low bits of a coordinate spread to every other bit, x takes the even bits and y the odd ones.
+        static const u8 mortonBits[1 << LEVEL_TILE_BLOCK_SHIFT] = { 0x00, 0x01, 0x04, 0x05, 0x10, 0x11, 0x14, 0x15 };
+        s32 mask = (1 << LEVEL_TILE_BLOCK_SHIFT) - 1;
+        s32 block = (y >> LEVEL_TILE_BLOCK_SHIFT) * level->tileBlocksPerRow + (x >> LEVEL_TILE_BLOCK_SHIFT);
+        return (block << (2 * LEVEL_TILE_BLOCK_SHIFT)) | mortonBits[x & mask] | (mortonBits[y & mask] << 1);
+    }
+    case LevelLayout_Chunked: {
+        s32 slot = level->chunkSlots[(y >> LEVEL_CHUNK_SHIFT) * level->chunksPerRow + (x >> LEVEL_CHUNK_SHIFT)];
+        if (slot < 0)
+        {
+            return -1;
+        }
+        return slot * LEVEL_CHUNK_TILE_COUNT + (y & (LEVEL_CHUNK_SIZE - 1)) * LEVEL_CHUNK_SIZE + (x & (LEVEL_CHUNK_SIZE - 1));
+    }
+    default: return y * level->width + x;
+    }
+}
+
+static s32 GetSolidBitsWordCount(const Level* level)
+{
+    return (level->width * level->height + 63) / 64;
+}
+
+static b32 IsSolidIndex(const u64* solidBits, s32 index)
+{
+    return (solidBits[index >> 6] >> (index & 63)) & 1;
+}
+
+static void UpdateSolidCounts(Level* level, s32 x, s32 y, s32 change)
+{
+    for (s32 i = 0; i < LEVEL_OCCUPANCY_LEVELS; ++i)
+    {
+        s32 shift = occupancyShifts[i];
+        level->solidCounts[i][(y >> shift) * GetOccupancyWidth(level, i) + (x >> shift)] += (u16)change;
+    }
+}
+
+// Brings the solid bit of a tile in line with its wall and blocking state.
+static void UpdateSolidity(Level* level, s32 x, s32 y)
+{
+    s32 index = y * level->width + x;
+    s32 tileIndex = GetTileIndex(level, x, y);
+    b32 solid = tileIndex < 0 || level->tiles[Layer_Wall][tileIndex] != 0 || IsSolidIndex(level->blockingBits, index);
+    if (solid != IsSolidIndex(level->solidBits, index))
+    {
+        level->solidBits[index >> 6] ^= 1ull << (index & 63);
+        UpdateSolidCounts(level, x, y, solid ? 1 : -1);
+    }
+}
+
+static void RebuildSolidity(Level* level)
+{
+    Platform_ClearMemory(level->solidBits, sizeof(u64) * GetSolidBitsWordCount(level));
+    for (s32 i = 0; i < LEVEL_OCCUPANCY_LEVELS; ++i)
+    {
+        Platform_ClearMemory(level->solidCounts[i], sizeof(u16) * GetOccupancyWidth(level, i) * GetOccupancyHeight(level, i));
+    }
+
+    for (s32 y = 0; y < level->height; ++y)
+    {
+        for (s32 x = 0; x < level->width; ++x)
+        {
+            UpdateSolidity(level, x, y);
+        }
+    }
+}
+
+// Allocates the tile layers for the layout and the solidity of the whole level, then works out the solidity.
+static void InitLevel(Level* level, s32 width, s32 height, LevelLayout layout, Arena* arena)
 {
     level->width = width;
     level->height = height;
+    level->layout = layout;
+    level->tileBlocksPerRow = (width + (1 << LEVEL_TILE_BLOCK_SHIFT) - 1) >> LEVEL_TILE_BLOCK_SHIFT;
 
-    u64 layerSizeInBytes = sizeof(u32) * width * height;
+    u64 layerSizeInBytes = sizeof(u32) * GetLayerTileCount(level);
     level->tiles[Layer_Floor] = (u32*)Arena_PushSize(arena, layerSizeInBytes);
     level->tiles[Layer_Ceiling] = (u32*)Arena_PushSize(arena, layerSizeInBytes);
     level->tiles[Layer_Wall] = (u32*)Arena_PushSize(arena, layerSizeInBytes);
+    level->solidBits = ArenaPushArray(arena, u64, GetSolidBitsWordCount(level));
+    level->blockingBits = ArenaPushArray(arena, u64, GetSolidBitsWordCount(level));
+    for (s32 i = 0; i < LEVEL_OCCUPANCY_LEVELS; ++i)
+    {
+        level->solidCounts[i] = ArenaPushArray(arena, u16, GetOccupancyWidth(level, i) * GetOccupancyHeight(level, i));
+    }
+    level->dirtyRegionCount = 0;
+
+    Platform_ClearMemory(level->blockingBits, sizeof(u64) * GetSolidBitsWordCount(level));
+    RebuildSolidity(level);
 }
 
+void Level_Init(Level* level, s32 width, s32 height, Arena* arena, LevelLayout layout)
+{
+    Platform_Assert(layout != LevelLayout_Chunked, "Chunked levels are set up by Level_InitChunked.");
+
+    level->chunksPerRow = 0;
+    level->chunkRows = 0;
+    level->residentChunkCount = 0;
+    level->chunkSlots = nullptr;
+    level->residentChunks = nullptr;
+    InitLevel(level, width, height, layout, arena);
+}
+
+void Level_InitChunked(Level* level, s32 width, s32 height, s32 residentChunkCount, Arena* arena)
+{
+    Platform_Assert((s64)width * height <= 0x7fffffff, "Level is too large for 32 bit tile indices.");
+
+    level->chunksPerRow = (width + LEVEL_CHUNK_SIZE - 1) >> LEVEL_CHUNK_SHIFT;
+    level->chunkRows = (height + LEVEL_CHUNK_SIZE - 1) >> LEVEL_CHUNK_SHIFT;
+    level->residentChunkCount = residentChunkCount;
+    level->chunkSlots = ArenaPushArray(arena, s32, level->chunksPerRow * level->chunkRows);
+    level->residentChunks = ArenaPushArray(arena, s32, residentChunkCount);
+    Platform_FillMemory(level->chunkSlots, 0xff, sizeof(s32) * level->chunksPerRow * level->chunkRows);
+    Platform_FillMemory(level->residentChunks, 0xff, sizeof(s32) * residentChunkCount);
+    InitLevel(level, width, height, LevelLayout_Chunked, arena);
+}
 
 void Level_Clear(Level* level)
 {
     for (s32 i = 0; i < Layer_Count; ++i)
     {
-        for (s32 j = 0; j < level->width * level->height; ++j)
+        for (s32 j = 0; j < GetLayerTileCount(level); ++j)
         {
             level->tiles[i][j] = {};
         }
     }
+    Platform_ClearMemory(level->blockingBits, sizeof(u64) * GetSolidBitsWordCount(level));
+    RebuildSolidity(level);
 }
 
 u32 Level_GetTileAt(const Level* level, s32 x, s32 y, Layer layer)
 {
     if (x >= 0 && y >= 0 && x < level->width && y < level->height)
     {
-        return level->tiles[layer][y * level->width + x];
+        s32 index = GetTileIndex(level, x, y);
+        if (index >= 0)
+        {
+            return level->tiles[layer][index];
+        }
     }
     return -1;
 }
 
+static s32 GetRegionArea(const LevelRegion* region)
+{
+    return (region->maxX - region->minX + 1) * (region->maxY - region->minY + 1);
+}
+
+static LevelRegion MergeRegions(const LevelRegion* a, const LevelRegion* b)
+{
+    LevelRegion result = {};
+    result.minX = glm::min(a->minX, b->minX);
+    result.minY = glm::min(a->minY, b->minY);
+    result.maxX = glm::max(a->maxX, b->maxX);
+    result.maxY = glm::max(a->maxY, b->maxY);
+    return result;
+}
+
+static void MarkTileDirty(Level* level, s32 x, s32 y)
+{
+    LevelRegion tile = { x, y, x, y };
+
+    // Grow the region that needs the smallest increase in area, unless the tile
+    // is far enough away from all of them to justify a region of its own.
+    s32 bestIndex = -1;
+    s32 bestGrowth = 0;
+    for (s32 i = 0; i < level->dirtyRegionCount; ++i)
+    {
+        LevelRegion merged = MergeRegions(&level->dirtyRegions[i], &tile);
+        s32 growth = GetRegionArea(&merged) - GetRegionArea(&level->dirtyRegions[i]);
+        if (bestIndex < 0 || growth < bestGrowth)
+        {
+            bestIndex = i;
+            bestGrowth = growth;
+        }
+    }
+
+    b32 isAdjacent = bestIndex >= 0 && bestGrowth <= glm::max(level->dirtyRegions[bestIndex].maxX - level->dirtyRegions[bestIndex].minX + 1,
+                                                              level->dirtyRegions[bestIndex].maxY - level->dirtyRegions[bestIndex].minY + 1);
+    if (bestIndex >= 0 && (isAdjacent || level->dirtyRegionCount == MAX_LEVEL_DIRTY_REGIONS))
+    {
+        level->dirtyRegions[bestIndex] = MergeRegions(&level->dirtyRegions[bestIndex], &tile);
+        return;
+    }
+
+    level->dirtyRegions[level->dirtyRegionCount++] = tile;
+}
+
 void Level_SetTileAt(Level* level, s32 x, s32 y, u32 data, Layer layer)
 {
-    if (x < level->width && y < level->height)
+    if (x >= 0 && y >= 0 && x < level->width && y < level->height)
+    {
+        s32 index = GetTileIndex(level, x, y);
+        if (index < 0)
+        {
+            return;
+        }
+
+        u32* tile = &level->tiles[layer][index];
+        if (*tile != data)
+        {
+            *tile = data;
+            if (layer == Layer_Wall)
+            {
+                UpdateSolidity(level, x, y);
+            }
+            MarkTileDirty(level, x, y);
+        }
+    }
+}
+
+void Level_ClearDirtyRegions(Level* level)
+{
+    level->dirtyRegionCount = 0;
+}
+
+void Level_SetBlocking(Level* level, s32 x, s32 y, b32 blocking)
+{
+    if (x >= 0 && y >= 0 && x < level->width && y < level->height)
+    {
+        s32 index = y * level->width + x;
+        if (!blocking == !IsSolidIndex(level->blockingBits, index))
+        {
+            return;
+        }
+
+        level->blockingBits[index >> 6] ^= 1ull << (index & 63);
+        UpdateSolidity(level, x, y);
+        MarkTileDirty(level, x, y);
+    }
+}
+
+// Brings the solidity of the tiles of a chunk in line with its tiles after it was loaded or evicted.
+static void UpdateChunkSolidity(Level* level, s32 chunkX, s32 chunkY)
+{
+    s32 minX = chunkX << LEVEL_CHUNK_SHIFT;
+    s32 minY = chunkY << LEVEL_CHUNK_SHIFT;
+    s32 maxX = glm::min(minX + LEVEL_CHUNK_SIZE, level->width);
+    s32 maxY = glm::min(minY + LEVEL_CHUNK_SIZE, level->height);
+    for (s32 y = minY; y < maxY; ++y)
+    {
+        for (s32 x = minX; x < maxX; ++x)
+        {
+            UpdateSolidity(level, x, y);
+        }
+    }
+}
+
+b32 Level_LoadChunk(Level* level, s32 chunkX, s32 chunkY, const u32* const layers[Layer_Count])
+{
+    Platform_Assert(level->layout == LevelLayout_Chunked, "Only chunked levels load chunks.");
+    Platform_Assert(chunkX >= 0 && chunkY >= 0 && chunkX < level->chunksPerRow && chunkY < level->chunkRows, "Chunk is outside the level.");
+
+    s32 chunk = chunkY * level->chunksPerRow + chunkX;
+    s32 slot = level->chunkSlots[chunk];
+    for (s32 i = 0; i < level->residentChunkCount && slot < 0; ++i)
+    {
+        if (level->residentChunks[i] < 0)
+        {
+            slot = i;
+        }
+    }
+    if (slot < 0)
+    {
+        return false;
+    }
+
+    level->chunkSlots[chunk] = slot;
+    level->residentChunks[slot] = chunk;
+    for (s32 i = 0; i < Layer_Count; ++i)
+    {
+        Platform_CopyMemory(level->tiles[i] + slot * LEVEL_CHUNK_TILE_COUNT, layers[i], sizeof(u32) * LEVEL_CHUNK_TILE_COUNT);
+    }
+    UpdateChunkSolidity(level, chunkX, chunkY);
+    return true;
+}
+
+void Level_EvictChunk(Level* level, s32 chunkX, s32 chunkY)
+{
+    if (!Level_IsChunkResident(level, chunkX, chunkY))
+    {
+        return;
+    }
+
+    s32 chunk = chunkY * level->chunksPerRow + chunkX;
+    level->residentChunks[level->chunkSlots[chunk]] = -1;
+    level->chunkSlots[chunk] = -1;
+    UpdateChunkSolidity(level, chunkX, chunkY);
+}
+
+b32 Level_IsChunkResident(const Level* level, s32 chunkX, s32 chunkY)
+{
+    if (level->layout != LevelLayout_Chunked || chunkX < 0 || chunkY < 0 || chunkX >= level->chunksPerRow || chunkY >= level->chunkRows)
+    {
+        return false;
+    }
+    return level->chunkSlots[chunkY * level->chunksPerRow + chunkX] >= 0;
+}
+
+b32 Level_IsSolid(const Level* level, s32 x, s32 y)
+{
+    if (x >= 0 && y >= 0 && x < level->width && y < level->height)
+    {
+        return IsSolidIndex(level->solidBits, y * level->width + x);
+    }
+    return true;
+}
+
+// Distance along a ray to its k-th crossing of a tile edge on one axis. Computed from the first crossing instead of
+// summed up crossing by crossing, so a ray jumping over many tiles lands on exactly the values of stepping through them.
+static f32 GetCrossingDistance(f32 first, f32 delta, s32 k)
+{
+    return first + (f32)k * delta;
+}
+
+// Index of the first crossing from k on whose distance is above limit, or at or above it when inclusive is false.
+// Estimated with a division, then corrected so the rounding matches GetCrossingDistance exactly.
+static s32 CountCrossingsBefore(f32 first, f32 delta, s32 k, f32 limit, b32 inclusive)
+{
+    s32 count = glm::max(k, (s32)((limit - first) / delta));
+    if (inclusive)
+    {
+        while (count > k && GetCrossingDistance(first, delta, count - 1) > limit)
+        {
+            count--;
+        }
+        while (GetCrossingDistance(first, delta, count) <= limit)
+        {
+            count++;
+        }
+    }
+    else
     {
-        level->tiles[layer][y * level->width + x]= data;
+        while (count > k && GetCrossingDistance(first, delta, count - 1) >= limit)
+        {
+            count--;
+        }
+        while (GetCrossingDistance(first, delta, count) < limit)
+        {
+            count++;
+        }
     }
+    return count;
+}
+
+// DDA state of a ray in Level_CastRay.
+struct RayTraversal
+{
+    glm::ivec2 start;    // Tile the ray starts in.
+    glm::ivec2 position;
+    glm::ivec2 step;
+    glm::vec2 first;     // Distance to the first tile edge crossing on each axis.
+    glm::vec2 delta;     // Distance between crossings on each axis.
+    glm::ivec2 crossings;
+    glm::vec2 next;      // Distance to the next crossing on each axis.
+    s32 side;
+    f32 distance;        // Distance at which the ray entered the current tile.
+};
+
+enum BlockWalk
+{
+    BlockWalk_Moved,  // The ray is on the first tile of a block with solid tiles.
+    BlockWalk_Missed, // The ray left the level or went past maxDistance without reaching a solid tile.
+};
+
+static b32 IsOccupancyBlockEmpty(const Level* level, s32 occupancyLevel, s32 blockX, s32 blockY)
+{
+    return level->solidCounts[occupancyLevel][blockY * GetOccupancyWidth(level, occupancyLevel) + blockX] == 0;
+}
+
+// Rays only start walking in the largest blocks. Walking through the small ones on their own costs about as much
+// as stepping through their tiles, they are used once a walk reaches a large block with solid tiles.
+static const s32 rayWalkLevel = LEVEL_OCCUPANCY_LEVELS - 1;
+static const s32 rayWalkShift = occupancyShifts[rayWalkLevel];
+
+// Largest occupancy level whose block around the tile holds no solid tiles, or -1.
+static s32 GetEmptyOccupancyLevel(const Level* level, glm::ivec2 position)
+{
+    s32 emptyLevel = -1;
+    for (s32 i = 0; i < LEVEL_OCCUPANCY_LEVELS; ++i)
+    {
+        s32 shift = occupancyShifts[i];
+        if (!IsOccupancyBlockEmpty(level, i, position.x >> shift, position.y >> shift))
+        {
+            break;
+        }
+        emptyLevel = i;
+    }
+    return emptyLevel;
+}
+
+// Index of the crossing through which the ray leaves a block on one axis.
+static s32 GetBlockLeavingCrossing(s32 start, s32 step, s32 block, s32 shift)
+{
+    s32 lastTile = step > 0 ? ((block + 1) << shift) - 1 : block << shift;
+    return (lastTile - start) * step;
+}
+
+// Distance at which the ray leaves the block of an occupancy level it is in.
+static f32 GetBlockExitDistance(const RayTraversal* ray, s32 occupancyLevel)
+{
+    s32 shift = occupancyShifts[occupancyLevel];
+    s32 crossingX = GetBlockLeavingCrossing(ray->start.x, ray->step.x, ray->position.x >> shift, shift);
+    s32 crossingY = GetBlockLeavingCrossing(ray->start.y, ray->step.y, ray->position.y >> shift, shift);
+    return glm::min(
+        GetCrossingDistance(ray->first.x, ray->delta.x, crossingX),
+        GetCrossingDistance(ray->first.y, ray->delta.y, crossingY)
+    );
+}
+
+// Puts the ray on the tile it enters through a crossing, with the same tile and distances stepping tile by tile gives.
+static void EnterThroughCrossing(RayTraversal* ray, s32 side, s32 crossing, f32 distance)
+{
+    // The DDA steps along x only when the x crossing is strictly closer, so ties go to y.
+    if (side == 0)
+    {
+        ray->crossings.x = crossing + 1;
+        ray->crossings.y = CountCrossingsBefore(ray->first.y, ray->delta.y, ray->crossings.y, distance, true);
+    }
+    else
+    {
+        ray->crossings.y = crossing + 1;
+        ray->crossings.x = CountCrossingsBefore(ray->first.x, ray->delta.x, ray->crossings.x, distance, false);
+    }
+
+    ray->position = ray->start + ray->step * ray->crossings;
+    ray->next.x = GetCrossingDistance(ray->first.x, ray->delta.x, ray->crossings.x);
+    ray->next.y = GetCrossingDistance(ray->first.y, ray->delta.y, ray->crossings.y);
+    ray->side = side;
+    ray->distance = distance;
+}
+
+// Distance at which the ray entered the tile before the current one, zero if that is the tile it started in.
+static f32 GetPreviousCrossingDistance(const RayTraversal* ray)
+{
+    s32 lastX = ray->crossings.x - (ray->side == 0 ? 2 : 1);
+    s32 lastY = ray->crossings.y - (ray->side == 1 ? 2 : 1);
+    f32 distanceX = lastX >= 0 ? GetCrossingDistance(ray->first.x, ray->delta.x, lastX) : 0.0f;
+    f32 distanceY = lastY >= 0 ? GetCrossingDistance(ray->first.y, ray->delta.y, lastY) : 0.0f;
+    return glm::max(distanceX, distanceY);
+}
+
+// Moves the ray from block to block through the occupancy pyramid while the blocks hold no solid tiles, starting from
+// an empty block around its tile. Only the crossings leaving each block are computed, the tile the ray is on is worked
+// out again when it reaches a block with solid tiles, and the walk goes on in the smaller blocks inside it.
+static BlockWalk WalkEmptyBlocks(const Level* level, RayTraversal* ray, f32 maxDistance)
+{
+    s32 occupancyLevel = GetEmptyOccupancyLevel(level, ray->position);
+    while (occupancyLevel >= 0)
+    {
+        // DDA over the blocks, the crossings leaving a block are tile edge crossings of the ray too.
+        s32 shift = occupancyShifts[occupancyLevel];
+        glm::ivec2 block = glm::ivec2(ray->position.x >> shift, ray->position.y >> shift);
+        glm::ivec2 crossing = glm::ivec2(
+            GetBlockLeavingCrossing(ray->start.x, ray->step.x, block.x, shift),
+            GetBlockLeavingCrossing(ray->start.y, ray->step.y, block.y, shift)
+        );
+        glm::vec2 exit = glm::vec2(
+            GetCrossingDistance(ray->first.x, ray->delta.x, crossing.x),
+            GetCrossingDistance(ray->first.y, ray->delta.y, crossing.y)
+        );
+
+        for (;;)
+        {
+            s32 side;
+            s32 enteringCrossing;
+            f32 distance;
+            if (exit.x < exit.y)
+            {
+                side = 0;
+                enteringCrossing = crossing.x;
+                distance = exit.x;
+                block.x += ray->step.x;
+                crossing.x += 1 << shift;
+                exit.x = GetCrossingDistance(ray->first.x, ray->delta.x, crossing.x);
+            }
+            else
+            {
+                side = 1;
+                enteringCrossing = crossing.y;
+                distance = exit.y;
+                block.y += ray->step.y;
+                crossing.y += 1 << shift;
+                exit.y = GetCrossingDistance(ray->first.y, ray->delta.y, crossing.y);
+            }
+
+            if (block.x < 0 || block.x >= GetOccupancyWidth(level, occupancyLevel) ||
+                block.y < 0 || block.y >= GetOccupancyHeight(level, occupancyLevel))
+            {
+                return BlockWalk_Missed;
+            }
+
+            if (!IsOccupancyBlockEmpty(level, occupancyLevel, block.x, block.y))
+            {
+                // Stepping tile by tile goes one tile past maxDistance, do the same.
+                EnterThroughCrossing(ray, side, enteringCrossing, distance);
+                if (distance > maxDistance && GetPreviousCrossingDistance(ray) > maxDistance)
+                {
+                    return BlockWalk_Missed;
+                }
+                break;
+            }
+
+            if (distance > maxDistance)
+            {
+                return BlockWalk_Missed;
+            }
+
+            // Blocks nest, so the larger block around this one is found from its position.
+            if (occupancyLevel + 1 < LEVEL_OCCUPANCY_LEVELS)
+            {
+                s32 parentShift = occupancyShifts[occupancyLevel + 1] - shift;
+                glm::ivec2 parent = glm::ivec2(block.x >> parentShift, block.y >> parentShift);
+                if (IsOccupancyBlockEmpty(level, occupancyLevel + 1, parent.x, parent.y))
+                {
+                    occupancyLevel++;
+                    shift = occupancyShifts[occupancyLevel];
+                    block = parent;
+                    crossing = glm::ivec2(
+                        GetBlockLeavingCrossing(ray->start.x, ray->step.x, block.x, shift),
+                        GetBlockLeavingCrossing(ray->start.y, ray->step.y, block.y, shift)
+                    );
+                    exit = glm::vec2(
+                        GetCrossingDistance(ray->first.x, ray->delta.x, crossing.x),
+                        GetCrossingDistance(ray->first.y, ray->delta.y, crossing.y)
+                    );
+                }
+            }
+        }
+
+        if (ray->position.x < 0 || ray->position.x >= level->width ||
+            ray->position.y < 0 || ray->position.y >= level->height)
+        {
+            return BlockWalk_Missed;
+        }
+        occupancyLevel = GetEmptyOccupancyLevel(level, ray->position);
+    }
+    return BlockWalk_Moved;
 }
 
 b32 Level_CastRay(const Level* level, glm::vec2 origin, glm::vec2 direction, RayCastHit* out, f32 maxDistance)
 {
-    glm::ivec2 levelPostion = glm::ivec2(
+    RayTraversal ray = {};
+    ray.start = glm::ivec2(
         (s32)origin.x,
         (s32)origin.y
     );
+    ray.position = ray.start;
 
-    glm::vec2 deltaDistance = glm::vec2(
+    ray.delta = glm::vec2(
         (direction.x == 0) ? 1e30f : glm::abs(1.0f / direction.x),
         (direction.y == 0) ? 1e30f : glm::abs(1.0f / direction.y)
     );
 
-    glm::vec2 step = glm::vec2(
-        direction.x > 0.0f ? 1.0f : -1.0f,
-        direction.y > 0.0f ? 1.0f : -1.0f
+    ray.step = glm::ivec2(
+        direction.x > 0.0f ? 1 : -1,
+        direction.y > 0.0f ? 1 : -1
     );
 
-    glm::vec2 sideDistance = glm::vec2(
-        (direction.x > 0.0f ? (levelPostion.x + 1.0f - origin.x) : (origin.x - levelPostion.x)) * deltaDistance.x,
-        (direction.y > 0.0f ? (levelPostion.y + 1.0f - origin.y) : (origin.y - levelPostion.y)) * deltaDistance.y
+    ray.first = glm::vec2(
+        (direction.x > 0.0f ? (ray.position.x + 1.0f - origin.x) : (origin.x - ray.position.x)) * ray.delta.x,
+        (direction.y > 0.0f ? (ray.position.y + 1.0f - origin.y) : (origin.y - ray.position.y)) * ray.delta.y
     );
+    ray.next = ray.first;
 
     b32 hit = 0;
-    b32 side = 0;
-    f32 distance = 0.0f;
+    b32 outside = 0;
 
-    while (!hit && distance <= maxDistance)
+    while (!hit && !outside && ray.distance <= maxDistance)
     {
-        if (sideDistance.x < sideDistance.y)
+        b32 inside = ray.position.x >= 0 && ray.position.x < level->width &&
+            ray.position.y >= 0 && ray.position.y < level->height;
+
+        if (inside && IsOccupancyBlockEmpty(level, rayWalkLevel, ray.position.x >> rayWalkShift, ray.position.y >> rayWalkShift))
         {
-            sideDistance.x += deltaDistance.x;
-            levelPostion.x += (s32)step.x;
-            side = 0;
+            RayTraversal walked = ray;
+            if (WalkEmptyBlocks(level, &walked, maxDistance) == BlockWalk_Missed)
+            {
+                break;
+            }
+            ray = walked;
+            hit = IsSolidIndex(level->solidBits, ray.position.y * level->width + ray.position.x);
+            continue;
         }
-        else
+
+        // Step tile by tile through the block, at least once. Leaving the block ends the loop through the distance
+        // limit, so the steps cost no more than without the pyramid. The tile entered through the exit crossing is
+        // the first one at or past blockExit. A ray starting outside the level looks again after every step.
+        f32 limit = -1.0f;
+        if (inside)
         {
-            sideDistance.y += deltaDistance.y;
-            levelPostion.y += (s32)step.y;
-            side = 1;
+            f32 blockExit = GetBlockExitDistance(&ray, rayWalkLevel);
+            limit = glm::min(maxDistance, std::nextafter(blockExit, 0.0f));
         }
 
-        if (levelPostion.x < 0 || levelPostion.x >= level->width ||
-            levelPostion.y < 0 || levelPostion.y >= level->height)
+        do
+        {
+            if (ray.next.x < ray.next.y)
+            {
+                ray.distance = ray.next.x;
+                ray.crossings.x++;
+                ray.next.x = GetCrossingDistance(ray.first.x, ray.delta.x, ray.crossings.x);
+                ray.position.x += ray.step.x;
+                ray.side = 0;
+            }
+            else
+            {
+                ray.distance = ray.next.y;
+                ray.crossings.y++;
+                ray.next.y = GetCrossingDistance(ray.first.y, ray.delta.y, ray.crossings.y);
+                ray.position.y += ray.step.y;
+                ray.side = 1;
+            }
+
+            if (ray.position.x < 0 || ray.position.x >= level->width ||
+                ray.position.y < 0 || ray.position.y >= level->height)
+            {
+                outside = 1;
+                break;
+            }
+
+            if (IsSolidIndex(level->solidBits, ray.position.y * level->width + ray.position.x))
+            {
+                hit = 1;
+            }
+        } while (!hit && ray.distance <= limit);
+    }
+
+    if (hit)
+    {
+        out->distance = ray.distance;
+        out->hit = origin + direction * out->distance;
+        out->normal = ray.side ? glm::vec2(-1.0f, 0.0f) : glm::vec2(0.0f, -1.0f);
+        out->tileX = ray.position.x;
+        out->tileY = ray.position.y;
+        out->layer = Layer_Wall;
+    }
+
+    return hit;
+}
+
+static void WritePacketHit(const RayPacket* packet, s32 lane, f32 distance, s32 side, s32 tileX, s32 tileY, RayCastHit* out)
+{
+    glm::vec2 origin = glm::vec2(packet->originX[lane], packet->originY[lane]);
+    glm::vec2 direction = glm::vec2(packet->directionX[lane], packet->directionY[lane]);
+
+    out->distance = distance;
+    out->hit = origin + direction * out->distance;
+    out->normal = side ? glm::vec2(-1.0f, 0.0f) : glm::vec2(0.0f, -1.0f);
+    out->tileX = tileX;
+    out->tileY = tileY;
+    out->layer = Layer_Wall;
+}
+
+#if defined(LEVEL_RAY_PACKET_SSE2)
+
+// Distance a lane steps tile by tile before it looks for an empty block again. A walk costs about as much as stepping
+// through a few blocks in every lane, so lanes only look at their start and now and then.
+#define LEVEL_LANE_WALK_CHECK_DISTANCE 64.0f
+
+// DDA state of the rays in the lanes of Level_CastRayPacket and CastRayStream, kept here while a lane walks through
+// the occupancy pyramid or takes a new ray.
+struct RayLanes
+{
+    alignas(16) f32 firstX[RAY_PACKET_SIZE];
+    alignas(16) f32 firstY[RAY_PACKET_SIZE];
+    alignas(16) f32 crossingsX[RAY_PACKET_SIZE];
+    alignas(16) f32 crossingsY[RAY_PACKET_SIZE];
+    alignas(16) f32 nextX[RAY_PACKET_SIZE];
+    alignas(16) f32 nextY[RAY_PACKET_SIZE];
+    alignas(16) f32 distance[RAY_PACKET_SIZE];
+    alignas(16) f32 deltaX[RAY_PACKET_SIZE];
+    alignas(16) f32 deltaY[RAY_PACKET_SIZE];
+    alignas(16) s32 positionX[RAY_PACKET_SIZE];
+    alignas(16) s32 positionY[RAY_PACKET_SIZE];
+    alignas(16) s32 stepX[RAY_PACKET_SIZE];
+    alignas(16) s32 stepY[RAY_PACKET_SIZE];
+    alignas(16) s32 side[RAY_PACKET_SIZE];
+    alignas(16) s32 tileIndex[RAY_PACKET_SIZE];  // positionY * level width + positionX, stepped along with them.
+    alignas(16) s32 tileStepY[RAY_PACKET_SIZE];  // stepY * level width.
+    alignas(16) f32 walkCheck[RAY_PACKET_SIZE];  // Distance at which the lane looks for an empty block again.
+    s32 ray[RAY_PACKET_SIZE];
+};
+
+enum LaneWalk
+{
+    LaneWalk_Stepping, // The lane goes on stepping tile by tile.
+    LaneWalk_Hit,
+    LaneWalk_Missed
+};
+
+static RayTraversal GetLaneTraversal(const RayLanes* lanes, s32 lane)
+{
+    RayTraversal ray = {};
+    ray.position = glm::ivec2(lanes->positionX[lane], lanes->positionY[lane]);
+    ray.step = glm::ivec2(lanes->stepX[lane], lanes->stepY[lane]);
+    ray.crossings = glm::ivec2((s32)lanes->crossingsX[lane], (s32)lanes->crossingsY[lane]);
+    ray.start = ray.position - ray.step * ray.crossings;
+    ray.first = glm::vec2(lanes->firstX[lane], lanes->firstY[lane]);
+    ray.delta = glm::vec2(lanes->deltaX[lane], lanes->deltaY[lane]);
+    ray.next = glm::vec2(lanes->nextX[lane], lanes->nextY[lane]);
+    ray.side = lanes->side[lane];
+    ray.distance = lanes->distance[lane];
+    return ray;
+}
+
+static void SetLaneTraversal(RayLanes* lanes, s32 lane, const Level* level, const RayTraversal* ray)
+{
+    lanes->positionX[lane] = ray->position.x;
+    lanes->positionY[lane] = ray->position.y;
+    lanes->crossingsX[lane] = (f32)ray->crossings.x;
+    lanes->crossingsY[lane] = (f32)ray->crossings.y;
+    lanes->nextX[lane] = ray->next.x;
+    lanes->nextY[lane] = ray->next.y;
+    lanes->side[lane] = ray->side;
+    lanes->distance[lane] = ray->distance;
+    lanes->tileIndex[lane] = ray->position.y * level->width + ray->position.x;
+}
+
+// Walks a lane on a tile of an empty block of the walk level through the pyramid, the way Level_CastRay does, until
+// it reaches a block with solid tiles. Walking gives the tiles and distances of stepping, so lanes can start walking
+// from any tile of an empty block.
+static LaneWalk WalkLane(const Level* level, RayLanes* lanes, s32 lane, f32 maxDistance)
+{
+    RayTraversal ray = GetLaneTraversal(lanes, lane);
+    if (WalkEmptyBlocks(level, &ray, maxDistance) == BlockWalk_Missed)
+    {
+        return LaneWalk_Missed;
+    }
+
+    SetLaneTraversal(lanes, lane, level, &ray);
+    if (IsSolidIndex(level->solidBits, lanes->tileIndex[lane]))
+    {
+        return LaneWalk_Hit;
+    }
+    lanes->walkCheck[lane] = ray.distance + LEVEL_LANE_WALK_CHECK_DISTANCE;
+    return ray.distance > maxDistance ? LaneWalk_Missed : LaneWalk_Stepping;
+}
+
+// Walks a lane on a tile inside the level if the block around it is empty, otherwise it goes on stepping.
+static LaneWalk CheckLaneBlock(const Level* level, RayLanes* lanes, s32 lane, f32 maxDistance)
+{
+    if (IsOccupancyBlockEmpty(level, rayWalkLevel, lanes->positionX[lane] >> rayWalkShift, lanes->positionY[lane] >> rayWalkShift))
+    {
+        return WalkLane(level, lanes, lane, maxDistance);
+    }
+    lanes->walkCheck[lane] = lanes->distance[lane] + LEVEL_LANE_WALK_CHECK_DISTANCE;
+    return LaneWalk_Stepping;
+}
+
+// Sets up a lane with the same start state as Level_CastRay.
+static LaneWalk StartLaneRay(RayLanes* lanes, s32 lane, const Level* level, f32 originX, f32 originY, f32 directionX, f32 directionY, f32 maxDistance)
+{
+    s32 positionX = (s32)originX;
+    s32 positionY = (s32)originY;
+    f32 deltaX = directionX == 0 ? 1e30f : glm::abs(1.0f / directionX);
+    f32 deltaY = directionY == 0 ? 1e30f : glm::abs(1.0f / directionY);
+
+    lanes->firstX[lane] = (directionX > 0.0f ? (positionX + 1.0f - originX) : (originX - positionX)) * deltaX;
+    lanes->firstY[lane] = (directionY > 0.0f ? (positionY + 1.0f - originY) : (originY - positionY)) * deltaY;
+    lanes->crossingsX[lane] = 0.0f;
+    lanes->crossingsY[lane] = 0.0f;
+    lanes->nextX[lane] = lanes->firstX[lane];
+    lanes->nextY[lane] = lanes->firstY[lane];
+    lanes->distance[lane] = 0.0f;
+    lanes->deltaX[lane] = deltaX;
+    lanes->deltaY[lane] = deltaY;
+    lanes->positionX[lane] = positionX;
+    lanes->positionY[lane] = positionY;
+    lanes->stepX[lane] = directionX > 0.0f ? 1 : -1;
+    lanes->stepY[lane] = directionY > 0.0f ? 1 : -1;
+    lanes->side[lane] = 0;
+    lanes->tileIndex[lane] = positionY * level->width + positionX;
+    lanes->tileStepY[lane] = lanes->stepY[lane] * level->width;
+    lanes->walkCheck[lane] = LEVEL_LANE_WALK_CHECK_DISTANCE;
+
+    b32 inside = positionX >= 0 && positionX < level->width && positionY >= 0 && positionY < level->height;
+    if (inside && IsOccupancyBlockEmpty(level, rayWalkLevel, positionX >> rayWalkShift, positionY >> rayWalkShift))
+    {
+        return WalkLane(level, lanes, lane, maxDistance);
+    }
+    return LaneWalk_Stepping;
+}
+
+// Steps the active lanes tile by tile until at least one of them is done. Returns the lanes that are done, those
+// that hit a wall are set in outHitLanes and those that reached their walk check in outCheckLanes, the others missed.
+static u32 StepLanes(const Level* level, RayLanes* lanes, u32 activeLanes, f32 maxDistance, u32* outHitLanes, u32* outCheckLanes)
+{
+    const __m128i width = _mm_set1_epi32(level->width);
+    const __m128i height = _mm_set1_epi32(level->height);
+    const __m128i laneBits = _mm_setr_epi32(1, 2, 4, 8);
+    const __m128 maximum = _mm_set1_ps(maxDistance);
+    const __m128 one = _mm_set1_ps(1.0f);
+    const u64* solidBits = level->solidBits;
+
+    __m128 firstX = _mm_load_ps(lanes->firstX);
+    __m128 firstY = _mm_load_ps(lanes->firstY);
+    __m128 crossingsX = _mm_load_ps(lanes->crossingsX);
+    __m128 crossingsY = _mm_load_ps(lanes->crossingsY);
+    __m128 nextX = _mm_load_ps(lanes->nextX);
+    __m128 nextY = _mm_load_ps(lanes->nextY);
+    __m128 distance = _mm_load_ps(lanes->distance);
+    __m128 deltaX = _mm_load_ps(lanes->deltaX);
+    __m128 deltaY = _mm_load_ps(lanes->deltaY);
+    __m128i positionX = _mm_load_si128((const __m128i*)lanes->positionX);
+    __m128i positionY = _mm_load_si128((const __m128i*)lanes->positionY);
+    __m128i stepX = _mm_load_si128((const __m128i*)lanes->stepX);
+    __m128i stepY = _mm_load_si128((const __m128i*)lanes->stepY);
+    __m128i side = _mm_load_si128((const __m128i*)lanes->side);
+    __m128i tileIndex = _mm_load_si128((const __m128i*)lanes->tileIndex);
+    __m128i tileStepY = _mm_load_si128((const __m128i*)lanes->tileStepY);
+    __m128 walkCheck = _mm_load_ps(lanes->walkCheck);
+    __m128i active = _mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32((s32)activeLanes), laneBits), laneBits);
+
+    u32 doneLanes = 0;
+    u32 hitLanes = 0;
+    u32 checkLanes = 0;
+    while (!doneLanes)
+    {
+        __m128i moveX = _mm_and_si128(_mm_castps_si128(_mm_cmplt_ps(nextX, nextY)), active);
+        __m128i moveY = _mm_andnot_si128(moveX, active);
+
+        distance = _mm_or_ps(_mm_andnot_ps(_mm_castsi128_ps(active), distance),
+                             _mm_or_ps(_mm_and_ps(_mm_castsi128_ps(moveX), nextX), _mm_and_ps(_mm_castsi128_ps(moveY), nextY)));
+        crossingsX = _mm_add_ps(crossingsX, _mm_and_ps(_mm_castsi128_ps(moveX), one));
+        crossingsY = _mm_add_ps(crossingsY, _mm_and_ps(_mm_castsi128_ps(moveY), one));
+        nextX = _mm_add_ps(firstX, _mm_mul_ps(crossingsX, deltaX));
+        nextY = _mm_add_ps(firstY, _mm_mul_ps(crossingsY, deltaY));
+        positionX = _mm_add_epi32(positionX, _mm_and_si128(moveX, stepX));
+        positionY = _mm_add_epi32(positionY, _mm_and_si128(moveY, stepY));
+        tileIndex = _mm_add_epi32(tileIndex, _mm_or_si128(_mm_and_si128(moveX, stepX), _mm_and_si128(moveY, tileStepY)));
+        side = _mm_or_si128(_mm_and_si128(moveY, _mm_set1_epi32(1)), _mm_andnot_si128(active, side));
+
+        __m128i insideX = _mm_andnot_si128(_mm_cmplt_epi32(positionX, _mm_setzero_si128()), _mm_cmplt_epi32(positionX, width));
+        __m128i insideY = _mm_andnot_si128(_mm_cmplt_epi32(positionY, _mm_setzero_si128()), _mm_cmplt_epi32(positionY, height));
+        __m128i inside = _mm_and_si128(_mm_and_si128(insideX, insideY), active);
+        u32 insideLanes = (u32)_mm_movemask_ps(_mm_castsi128_ps(inside));
+
+        // Lanes outside the level read tile 0 and ignore it, so the loads need no branches.
+        alignas(16) s32 tiles[RAY_PACKET_SIZE];
+        _mm_store_si128((__m128i*)tiles, _mm_and_si128(tileIndex, inside));
+        u32 wallLanes = IsSolidIndex(solidBits, tiles[0]) | (IsSolidIndex(solidBits, tiles[1]) << 1) |
+                        (IsSolidIndex(solidBits, tiles[2]) << 2) | (IsSolidIndex(solidBits, tiles[3]) << 3);
+        hitLanes = wallLanes & insideLanes;
+
+        u32 farLanes = (u32)_mm_movemask_ps(_mm_cmpgt_ps(distance, maximum));
+        u32 missedLanes = ~insideLanes | farLanes;
+        checkLanes = insideLanes & ~hitLanes & ~farLanes & (u32)_mm_movemask_ps(_mm_cmpge_ps(distance, walkCheck));
+
+        doneLanes = activeLanes & (hitLanes | missedLanes | checkLanes);
+    }
+
+    _mm_store_ps(lanes->crossingsX, crossingsX);
+    _mm_store_ps(lanes->crossingsY, crossingsY);
+    _mm_store_ps(lanes->nextX, nextX);
+    _mm_store_ps(lanes->nextY, nextY);
+    _mm_store_ps(lanes->distance, distance);
+    _mm_store_si128((__m128i*)lanes->positionX, positionX);
+    _mm_store_si128((__m128i*)lanes->positionY, positionY);
+    _mm_store_si128((__m128i*)lanes->side, side);
+    _mm_store_si128((__m128i*)lanes->tileIndex, tileIndex);
+
+    *outHitLanes = hitLanes & doneLanes;
+    *outCheckLanes = checkLanes & doneLanes;
+    return doneLanes;
+}
+
+u32 Level_CastRayPacket(const Level* level, const RayPacket* packet, u32 activeMask, RayCastHit* outHits, f32 maxDistance)
+{
+    // Same traversal as Level_CastRay with one lane per ray. Lanes step tile by tile together, a lane in an empty block
+    // at its start or at a walk check walks through the pyramid on its own. Lanes that hit, leave the level or exceed
+    // maxDistance drop out.
+    RayLanes lanes = {};
+    u32 activeLanes = 0;
+    u32 hitMask = 0;
+    for (s32 lane = 0; lane < RAY_PACKET_SIZE; ++lane)
+    {
+        if (activeMask & (1u << lane))
+        {
+            LaneWalk walk = StartLaneRay(&lanes, lane, level, packet->originX[lane], packet->originY[lane], packet->directionX[lane], packet->directionY[lane], maxDistance);
+            if (walk == LaneWalk_Hit)
+            {
+                hitMask |= 1u << lane;
+            }
+            else if (walk == LaneWalk_Stepping)
+            {
+                activeLanes |= 1u << lane;
+            }
+        }
+    }
+
+    while (activeLanes)
+    {
+        u32 hitLanes;
+        u32 checkLanes;
+        u32 doneLanes = StepLanes(level, &lanes, activeLanes, maxDistance, &hitLanes, &checkLanes);
+        hitMask |= hitLanes;
+
+        for (s32 lane = 0; lane < RAY_PACKET_SIZE; ++lane)
+        {
+            if (checkLanes & (1u << lane))
+            {
+                LaneWalk walk = CheckLaneBlock(level, &lanes, lane, maxDistance);
+                if (walk == LaneWalk_Stepping)
+                {
+                    doneLanes &= ~(1u << lane);
+                }
+                else if (walk == LaneWalk_Hit)
+                {
+                    hitMask |= 1u << lane;
+                }
+            }
+        }
+        activeLanes &= ~doneLanes;
+    }
+
+    for (s32 lane = 0; lane < RAY_PACKET_SIZE; ++lane)
+    {
+        if (hitMask & (1u << lane))
+        {
+            WritePacketHit(packet, lane, lanes.distance[lane], lanes.side[lane], lanes.positionX[lane], lanes.positionY[lane], &outHits[lane]);
+        }
+    }
+
+    return hitMask;
+}
+
+#else
+
+u32 Level_CastRayPacket(const Level* level, const RayPacket* packet, u32 activeMask, RayCastHit* outHits, f32 maxDistance)
+{
+    u32 hitMask = 0;
+    for (s32 lane = 0; lane < RAY_PACKET_SIZE; ++lane)
+    {
+        if (activeMask & (1u << lane))
+        {
+            glm::vec2 origin = glm::vec2(packet->originX[lane], packet->originY[lane]);
+            glm::vec2 direction = glm::vec2(packet->directionX[lane], packet->directionY[lane]);
+            if (Level_CastRay(level, origin, direction, &outHits[lane], maxDistance))
+            {
+                hitMask |= 1u << lane;
+            }
+        }
+    }
+    return hitMask;
+}
+
+#endif
+
+// Rays per job of a parallel Level_CastRays.
+#define LEVEL_RAYS_PER_JOB 256
+
+struct RayBatchJob
+{
+    const Level* level;
+    const RayBatch* rays;
+    RayBatchHits* hits;
+    f32 maxDistance;
+    std::atomic<s32> hitCount;
+};
+
+static void WriteBatchHit(RayBatchHits* hits, s32 index, const RayCastHit* hit)
+{
+    hits->distance[index] = hit ? hit->distance : -1.0f;
+    if (hits->tileX) hits->tileX[index] = hit ? hit->tileX : -1;
+    if (hits->tileY) hits->tileY[index] = hit ? hit->tileY : -1;
+    if (hits->normalX) hits->normalX[index] = hit ? hit->normal.x : 0.0f;
+    if (hits->normalY) hits->normalY[index] = hit ? hit->normal.y : 0.0f;
+}
+
+#if defined(LEVEL_RAY_PACKET_SSE2)
+
+static void WriteLaneHit(RayBatchHits* hits, const RayLanes* lanes, s32 lane)
+{
+    RayCastHit hit = {};
+    hit.distance = lanes->distance[lane];
+    hit.normal = lanes->side[lane] ? glm::vec2(-1.0f, 0.0f) : glm::vec2(0.0f, -1.0f);
+    hit.tileX = lanes->positionX[lane];
+    hit.tileY = lanes->positionY[lane];
+    WriteBatchHit(hits, lanes->ray[lane], &hit);
+}
+
+// Same traversal as Level_CastRayPacket, but a lane whose ray is done takes the next ray of the range right away,
+// so rays of different lengths keep every lane busy instead of waiting for the longest one in the packet.
+static s32 CastRayStream(const Level* level, const RayBatch* rays, s32 begin, s32 end, RayBatchHits* hits, f32 maxDistance)
+{
+    RayLanes lanes = {};
+    u32 activeLanes = 0;
+    s32 next = begin;
+    s32 hitCount = 0;
+
+    for (;;)
+    {
+        for (s32 lane = 0; lane < RAY_PACKET_SIZE && next < end; ++lane)
+        {
+            // Rays that already end while walking from their start leave the lane free for the next one.
+            while (!(activeLanes & (1u << lane)) && next < end)
+            {
+                s32 index = next++;
+                lanes.ray[lane] = index;
+                LaneWalk walk = StartLaneRay(&lanes, lane, level, rays->originX[index], rays->originY[index], rays->directionX[index], rays->directionY[index], maxDistance);
+                if (walk == LaneWalk_Stepping)
+                {
+                    activeLanes |= 1u << lane;
+                }
+                else if (walk == LaneWalk_Hit)
+                {
+                    WriteLaneHit(hits, &lanes, lane);
+                    hitCount++;
+                }
+                else
+                {
+                    WriteBatchHit(hits, index, 0);
+                }
+            }
+        }
+
+        if (!activeLanes)
         {
             break;
         }
 
-        u32 tile = Level_GetTileAt(level, levelPostion.x, levelPostion.y, Layer_Wall);
+        u32 hitLanes;
+        u32 checkLanes;
+        u32 doneLanes = StepLanes(level, &lanes, activeLanes, maxDistance, &hitLanes, &checkLanes);
 
-        if (tile)
+        for (s32 lane = 0; lane < RAY_PACKET_SIZE; ++lane)
         {
-            hit = 1;
+            if (!(doneLanes & (1u << lane)))
+            {
+                continue;
+            }
+
+            LaneWalk walk = LaneWalk_Missed;
+            if (hitLanes & (1u << lane))
+            {
+                walk = LaneWalk_Hit;
+            }
+            else if (checkLanes & (1u << lane))
+            {
+                walk = CheckLaneBlock(level, &lanes, lane, maxDistance);
+            }
+
+            if (walk == LaneWalk_Stepping)
+            {
+                doneLanes &= ~(1u << lane);
+            }
+            else if (walk == LaneWalk_Hit)
+            {
+                WriteLaneHit(hits, &lanes, lane);
+                hitCount++;
+            }
+            else
+            {
+                WriteBatchHit(hits, lanes.ray[lane], 0);
+            }
         }
+        activeLanes &= ~doneLanes;
+    }
+
+    return hitCount;
+}
 
-        distance = side ? sideDistance.y : sideDistance.x;
+#else
+
+static s32 CastRayStream(const Level* level, const RayBatch* rays, s32 begin, s32 end, RayBatchHits* hits, f32 maxDistance)
+{
+    s32 hitCount = 0;
+    for (s32 i = begin; i < end; ++i)
+    {
+        RayCastHit hit = {};
+        b32 isHit = Level_CastRay(level, glm::vec2(rays->originX[i], rays->originY[i]), glm::vec2(rays->directionX[i], rays->directionY[i]), &hit, maxDistance);
+        WriteBatchHit(hits, i, isHit ? &hit : 0);
+        hitCount += isHit;
     }
+    return hitCount;
+}
 
-    if (hit)
+#endif
+
+static void CastRayBatchRange(void* userData, s32 begin, s32 end, s32 workerIndex)
+{
+    RayBatchJob* job = (RayBatchJob*)userData;
+    s32 hitCount = CastRayStream(job->level, job->rays, begin, end, job->hits, job->maxDistance);
+    job->hitCount.fetch_add(hitCount, std::memory_order_relaxed);
+}
+
+s32 Level_CastRays(const Level* level, const RayBatch* rays, RayBatchHits* outHits, f32 maxDistance, b32 parallel)
+{
+    RayBatchJob job;
+    job.level = level;
+    job.rays = rays;
+    job.hits = outHits;
+    job.maxDistance = maxDistance;
+    job.hitCount = 0;
+
+    if (parallel && rays->count > LEVEL_RAYS_PER_JOB)
     {
-        out->distance = side ? sideDistance.y - deltaDistance.y : sideDistance.x - deltaDistance.x;
-        out->hit = origin + direction * out->distance;
-        out->normal = side ? glm::vec2(-1.0f, 0.0f) : glm::vec2(0.0f, -1.0f);
-        out->tileX = levelPostion.x;
-        out->tileY = levelPostion.y;
-        out->layer = Layer_Wall;
+        Jobs_ParallelFor(rays->count, LEVEL_RAYS_PER_JOB, CastRayBatchRange, &job);
+    }
+    else
+    {
+        CastRayBatchRange(&job, 0, rays->count, 0);
     }
 
-    return hit;
-}
\ No newline at end of file
+    return job.hitCount.load(std::memory_order_relaxed);
+}
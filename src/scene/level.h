@@ -31,6 +31,38 @@ struct RayCastHit
     glm::vec2 normal;
 };
 
+#define RAY_PACKET_SIZE 4
+
+// Rays in structure-of-arrays layout, traced together by Level_CastRayPacket.
+struct RayPacket
+{
+    f32 originX[RAY_PACKET_SIZE];
+    f32 originY[RAY_PACKET_SIZE];
+    f32 directionX[RAY_PACKET_SIZE];
+    f32 directionY[RAY_PACKET_SIZE];
+};
+
+// Rays in structure-of-arrays layout for Level_CastRays, count entries per array.
+struct RayBatch
+{
+    const f32* originX;
+    const f32* originY;
+    const f32* directionX;
+    const f32* directionY;
+    s32 count;
+};
+
+// Results of Level_CastRays, one entry per ray. Every array but distance may be null.
+// A ray that hits no wall gets a negative distance, tile -1, -1 and a zero normal.
+struct RayBatchHits
+{
+    f32* distance;
+    s32* tileX;
+    s32* tileY;
+    f32* normalX;
+    f32* normalY;
+};
+
 struct Tileset
 {
     Image image;
@@ -41,18 +73,101 @@ struct Tileset
     s32 columns;
 };
 
+// Inclusive tile rectangle.
+struct LevelRegion
+{
+    s32 minX;
+    s32 minY;
+    s32 maxX;
+    s32 maxY;
+};
+
+#define MAX_LEVEL_DIRTY_REGIONS 16
+
+// Order of the tiles in the level layers, picked at Level_Init.
+enum LevelLayout
+{
+    LevelLayout_RowMajor, // One row of tiles after the other.
+    LevelLayout_Blocked,  // Blocks of 8x8 tiles row by row, the tiles of each block in Morton (Z-curve) order.
+    LevelLayout_Chunked   // Only some chunks of 32x32 tiles are resident, each row-major. Set up by Level_InitChunked.
+};
+
+// Tiles per side of the blocks of LevelLayout_Blocked, as a shift.
+#define LEVEL_TILE_BLOCK_SHIFT 3
+
+// Tiles per side of the chunks of LevelLayout_Chunked, as a shift.
+#define LEVEL_CHUNK_SHIFT 5
+#define LEVEL_CHUNK_SIZE (1 << LEVEL_CHUNK_SHIFT)
+#define LEVEL_CHUNK_TILE_COUNT (LEVEL_CHUNK_SIZE * LEVEL_CHUNK_SIZE)
+
+// Levels of the solid tile occupancy pyramid, with blocks of 4x4 and 16x16 tiles.
+#define LEVEL_OCCUPANCY_LEVELS 2
+
 struct Level
 {
     s32 width;
     s32 height;
-    u32* tiles[Layer_Count];
+    LevelLayout layout;
+    s32 tileBlocksPerRow; // Blocks of LevelLayout_Blocked per row of blocks, the last ones partly outside the level.
+    u32* tiles[Layer_Count]; // In the order of layout, go through Level_GetTileAt and Level_SetTileAt.
+
+    // Chunks of LevelLayout_Chunked. The tile layers hold residentChunkCount chunks one after the other.
+    s32 chunksPerRow;
+    s32 chunkRows;
+    s32 residentChunkCount;
+    s32* chunkSlots;    // Slot of each chunk in the tile layers, row-major over the chunks. -1 when not resident.
+    s32* residentChunks; // Chunk index in each slot, -1 when the slot is free.
+
+    // One bit per tile in row-major tile order, 64 tiles to a word, so a 512x512 level takes 32 KB. Set for walls
+    // and for tiles blocked with Level_SetBlocking. Ray casts read these instead of the wall layer.
+    u64* solidBits;
+    u64* blockingBits; // Tiles blocked with Level_SetBlocking, same layout as solidBits.
+
+    // Solid tiles per block of each occupancy level, row-major over the blocks. Rays jump over blocks without any.
+    u16* solidCounts[LEVEL_OCCUPANCY_LEVELS];
+
+    // Tiles changed by Level_SetTileAt or Level_SetBlocking since the last Level_ClearDirtyRegions.
+    LevelRegion dirtyRegions[MAX_LEVEL_DIRTY_REGIONS];
+    s32 dirtyRegionCount;
 };
 
-void Level_Init(Level* level, s32 width, s32 height, Arena* arena);
+void Level_Init(Level* level, s32 width, s32 height, Arena* arena, LevelLayout layout = LevelLayout_RowMajor);
+
+// Initializes a level of LevelLayout_Chunked with room for residentChunkCount chunks and none of them resident.
+// Tiles of chunks that are not resident read like tiles outside the level: -1 and solid. Writes to them are dropped.
+// Solidity and the occupancy pyramid still cover the whole level, at about three bits per tile.
+void Level_InitChunked(Level* level, s32 width, s32 height, s32 residentChunkCount, Arena* arena);
+
+// Copies the tiles of a chunk into a free slot, LEVEL_CHUNK_TILE_COUNT row-major tiles per layer.
+// Replaces the tiles if the chunk is resident already. Returns false if every slot is taken.
+b32 Level_LoadChunk(Level* level, s32 chunkX, s32 chunkY, const u32* const layers[Layer_Count]);
+
+// Frees the slot of a resident chunk, its tiles become solid. Edits made to them are lost.
+void Level_EvictChunk(Level* level, s32 chunkX, s32 chunkY);
+
+// Whether a chunk of a chunked level has its tiles in memory.
+b32 Level_IsChunkResident(const Level* level, s32 chunkX, s32 chunkY);
 void Level_Clear(Level* level);
 u32 Level_GetTileAt(const Level* level, s32 x, s32 y, Layer layer);
 void Level_SetTileAt(Level* level, s32 x, s32 y, u32 data, Layer layer);
+void Level_ClearDirtyRegions(Level* level);
+
+// Blocks or unblocks a tile for ray casts and movement without changing its wall, for doors and other blockers that
+// open and close. Marks the tile dirty when its state changes, since blocked tiles cast shadows in the baked lighting.
+void Level_SetBlocking(Level* level, s32 x, s32 y, b32 blocking);
+
+// Whether the tile stops rays and movement: a wall, a blocked tile or a tile outside the level.
+b32 Level_IsSolid(const Level* level, s32 x, s32 y);
+
 b32 Level_CastRay(const Level* level, glm::vec2 origin, glm::vec2 direction, RayCastHit* out, f32 maxDistance = 128.0f);
 
+// Casts the rays of a packet whose bit is set in activeMask. Returns the mask of rays that hit a wall,
+// outHits[i] is only written for those. Each ray gives the same result as Level_CastRay.
+u32 Level_CastRayPacket(const Level* level, const RayPacket* packet, u32 activeMask, RayCastHit* outHits, f32 maxDistance = 128.0f);
+
+// Casts a batch of rays a packet at a time, split across the job workers when parallel is set. Each ray gives the
+// same result as Level_CastRay. Returns the number of rays that hit a wall.
+s32 Level_CastRays(const Level* level, const RayBatch* rays, RayBatchHits* outHits, f32 maxDistance = 128.0f, b32 parallel = false);
+
 
 void Tileset_GetTileUVs(const Tileset* tileset, s32 tileId, glm::vec2* outMin, glm::vec2* outMax);
\ No newline at end of file
@@ -0,0 +1,204 @@
+#include "level_benchmark.h"
+#include "level_builder.h"
+#include "core/platform.h"
+
+#define LEVEL_BENCHMARK_RUNS 3
+#define LEVEL_BENCHMARK_RAYS 200000
+#define LEVEL_BENCHMARK_ENTITIES 4096
+#define LEVEL_BENCHMARK_ENTITY_STEPS 256
+#define LEVEL_BENCHMARK_ROOM_SIZE 16
+
+struct LevelBenchmarkTimes
+{
+    f64 rayCasts;
+    f64 surfaces;
+    f64 collision;
+    s32 hits;
+    s32 surfaceCount;
+    s32 blockedMoves;
+};
+
+static u32 NextRandom(u32* state)
+{
+    u32 x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+static f32 NextRandomFloat(u32* state)
+{
+    return (f32)(NextRandom(state) >> 8) / (f32)(1 << 24);
+}
+
+// Rooms with a door in the middle of each side, some pillars and a solid border.
+static void GenerateLevel(Level* level)
+{
+    u32 random = 12345;
+    for (s32 y = 0; y < level->height; ++y)
+    {
+        for (s32 x = 0; x < level->width; ++x)
+        {
+            s32 roomX = x % LEVEL_BENCHMARK_ROOM_SIZE;
+            s32 roomY = y % LEVEL_BENCHMARK_ROOM_SIZE;
+            b32 border = x == 0 || y == 0 || x == level->width - 1 || y == level->height - 1;
+            b32 roomWall = (roomX == 0 && roomY != LEVEL_BENCHMARK_ROOM_SIZE / 2) ||
+                           (roomY == 0 && roomX != LEVEL_BENCHMARK_ROOM_SIZE / 2);
+            b32 pillar = NextRandom(&random) % 64 == 0;
+
+            Level_SetTileAt(level, x, y, 1, Layer_Floor);
+            Level_SetTileAt(level, x, y, 2, Layer_Ceiling);
+            Level_SetTileAt(level, x, y, (border || roomWall || pillar) ? 3 + NextRandom(&random) % 2 : 0, Layer_Wall);
+        }
+    }
+    Level_ClearDirtyRegions(level);
+}
+
+static glm::vec2 GetRandomOpenPosition(const Level* level, u32* random)
+{
+    for (;;)
+    {
+        glm::vec2 position = glm::vec2(NextRandomFloat(random) * level->width, NextRandomFloat(random) * level->height);
+        if (Level_GetTileAt(level, (s32)position.x, (s32)position.y, Layer_Wall) == 0)
+        {
+            return position;
+        }
+    }
+}
+
+static s32 CastRays(const Level* level)
+{
+    u32 random = 777;
+    s32 hits = 0;
+    for (s32 i = 0; i < LEVEL_BENCHMARK_RAYS; ++i)
+    {
+        glm::vec2 origin = GetRandomOpenPosition(level, &random);
+        f32 angle = NextRandomFloat(&random) * 6.2831853f;
+        RayCastHit hit = {};
+        if (Level_CastRay(level, origin, glm::vec2(glm::cos(angle), glm::sin(angle)), &hit, 64.0f))
+        {
+            hits++;
+        }
+    }
+    return hits;
+}
+
+// Whether a box of half size radius around the position overlaps a wall tile, read from the wall layer.
+static b32 IsBoxBlocked(const Level* level, glm::vec2 position, f32 radius)
+{
+    s32 minX = (s32)(position.x - radius);
+    s32 minY = (s32)(position.y - radius);
+    s32 maxX = (s32)(position.x + radius);
+    s32 maxY = (s32)(position.y + radius);
+    for (s32 y = minY; y <= maxY; ++y)
+    {
+        for (s32 x = minX; x <= maxX; ++x)
+        {
+            if (Level_GetTileAt(level, x, y, Layer_Wall) != 0)
+            {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// Entities wander through the level, trying each move against the walls and turning when it is blocked.
+static s32 MoveEntities(const Level* level)
+{
+    const f32 radius = 0.3f;
+    const f32 speed = 0.25f;
+
+    u32 random = 4242;
+    s32 blockedMoves = 0;
+    for (s32 i = 0; i < LEVEL_BENCHMARK_ENTITIES; ++i)
+    {
+        glm::vec2 position = GetRandomOpenPosition(level, &random);
+        position = glm::floor(position) + 0.5f;
+        f32 angle = NextRandomFloat(&random) * 6.2831853f;
+        for (s32 step = 0; step < LEVEL_BENCHMARK_ENTITY_STEPS; ++step)
+        {
+            glm::vec2 moved = position + glm::vec2(glm::cos(angle), glm::sin(angle)) * speed;
+            if (IsBoxBlocked(level, moved, radius))
+            {
+                angle = NextRandomFloat(&random) * 6.2831853f;
+                blockedMoves++;
+                continue;
+            }
+            position = moved;
+        }
+    }
+    return blockedMoves;
+}
+
+static LevelBenchmarkTimes RunBenchmark(const Level* level, Arena* surfaceArena)
+{
+    Tileset tileset = {};
+    tileset.image.width = 256;
+    tileset.image.height = 256;
+    tileset.tileWidth = 32;
+    tileset.tileHeight = 32;
+    tileset.columns = 8;
+
+    LevelBenchmarkTimes best = {};
+    for (s32 run = 0; run < LEVEL_BENCHMARK_RUNS; ++run)
+    {
+        f64 startTime = Platform_GetTime();
+        s32 hits = CastRays(level);
+        f64 rayCasts = Platform_GetTime() - startTime;
+
+        Arena_Clear(surfaceArena);
+        startTime = Platform_GetTime();
+        s32 surfaceCount = 0;
+        CreateLevelSurfaces(level, &tileset, surfaceArena, &surfaceCount);
+        f64 surfaces = Platform_GetTime() - startTime;
+
+        startTime = Platform_GetTime();
+        s32 blockedMoves = MoveEntities(level);
+        f64 collision = Platform_GetTime() - startTime;
+
+        if (run == 0 || rayCasts < best.rayCasts) best.rayCasts = rayCasts;
+        if (run == 0 || surfaces < best.surfaces) best.surfaces = surfaces;
+        if (run == 0 || collision < best.collision) best.collision = collision;
+        best.hits = hits;
+        best.surfaceCount = surfaceCount;
+        best.blockedMoves = blockedMoves;
+    }
+    return best;
+}
+
+void LevelBenchmark_RunLayouts(s32 width, s32 height)
+{
+    static const LevelLayout layouts[] = { LevelLayout_RowMajor, LevelLayout_Blocked };
+    static const char* layoutNames[] = { "row-major", "blocked" };
+
+    // Layers, solidity bits and occupancy counts take less than 16 bytes per tile, with room for the padding of the
+    // blocked layout. Merged surfaces are far fewer than tiles.
+    u64 levelArenaSize = (u64)(width + 8) * (height + 8) * 16 + 4096;
+    u64 surfaceArenaSize = (u64)width * height * sizeof(Surface) / 4 + sizeof(Surface);
+    Arena levelArena;
+    Arena surfaceArena;
+    Arena_Init(&levelArena, levelArenaSize, Platform_Alloc(levelArenaSize));
+    Arena_Init(&surfaceArena, surfaceArenaSize, Platform_Alloc(surfaceArenaSize));
+
+    Platform_LogInfo("Level layout benchmark, %dx%d tiles: %d rays, surfaces, %d entities moving %d steps\n",
+        width, height, LEVEL_BENCHMARK_RAYS, LEVEL_BENCHMARK_ENTITIES, LEVEL_BENCHMARK_ENTITY_STEPS);
+
+    for (s32 i = 0; i < (s32)(sizeof(layouts) / sizeof(layouts[0])); ++i)
+    {
+        Arena_Clear(&levelArena);
+        Level level = {};
+        Level_Init(&level, width, height, &levelArena, layouts[i]);
+        Level_Clear(&level);
+        GenerateLevel(&level);
+
+        LevelBenchmarkTimes times = RunBenchmark(&level, &surfaceArena);
+        Platform_LogInfo("  %-9s rays %.1fms (%d hits), surfaces %.1fms (%d), collision %.1fms (%d blocked)\n", layoutNames[i],
+            times.rayCasts * 1000.0, times.hits, times.surfaces * 1000.0, times.surfaceCount, times.collision * 1000.0, times.blockedMoves);
+    }
+
+    Platform_Free(surfaceArena.base);
+    Platform_Free(levelArena.base);
+}
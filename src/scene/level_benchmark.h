@@ -0,0 +1,6 @@
+#pragma once
+#include "core/types.h"
+
+// Generates the same level of width x height tiles in every tile layout and logs how long ray casts, surface
+// building and collision queries take in each. The numbers are the best of a few runs on the calling thread.
+void LevelBenchmark_RunLayouts(s32 width, s32 height);
@@ -1,10 +1,14 @@
 #include "level_builder.h"
+#include "lightmap_kernel.h"
+#include "light_visibility.h"
 #include "renderer/color.h"
 #include "core/platform.h"
+#include "core/jobs.h"
 
-#include <vector>
-#include <thread>
-#include <mutex>
+#include <algorithm>
+#include <atomic>
+#include <new>
+#include <string.h>
 
 static void CreateSurfaceTexCoords(Surface* surface, const Tileset* tileset, s32 tileId)
 {
@@ -32,177 +36,596 @@ static void CreateSurfaceTexCoords(Surface* surface, const Tileset* tileset, s32
     */
 }
 
-static void CreateFloorVertices(Surface* surface, glm::vec2 position, const Tileset* tileset, s32 tileId = 0)
+// Longest run of tiles merged into one surface, keeps single bake jobs and atlas tiles small.
+#define MAX_MERGED_SURFACE_SIZE 16
+
+// Faces that can be merged with their neighbours into one surface.
+enum FaceType
+{
+    FaceType_Floor,
+    FaceType_Ceiling,
+    FaceType_WallNorth,
+    FaceType_WallEast,
+    FaceType_WallSouth,
+    FaceType_WallWest,
+    FaceType_Count
+};
+
+// Returns the tile data of the face of a tile, 0 if the tile has no such face.
+static u32 GetFaceData(const Level* level, FaceType type, s32 x, s32 y)
 {
-    surface->vertices[0] = glm::vec3(position.x + 0.0f, 0.0f, position.y + 0.0f);
-    surface->vertices[1] = glm::vec3(position.x + 0.0f, 0.0f, position.y + 1.0f);
-    surface->vertices[2] = glm::vec3(position.x + 1.0f, 0.0f, position.y + 1.0f);
-    surface->vertices[3] = glm::vec3(position.x + 1.0f, 0.0f, position.y + 0.0f);
+    switch (type)
+    {
+    case FaceType_Floor: return Level_GetTileAt(level, x, y, Layer_Floor);
+    case FaceType_Ceiling: return Level_GetTileAt(level, x, y, Layer_Ceiling);
+    default: break;
+    }
 
-    glm::vec3 v1 = surface->vertices[1] - surface->vertices[0];
-    glm::vec3 v2 = surface->vertices[2] - surface->vertices[0];
-    surface->normal = glm::normalize(glm::cross(v1, v2));
+    static const glm::ivec2 neighbours[] = { glm::ivec2(0, 1), glm::ivec2(1, 0), glm::ivec2(0, -1), glm::ivec2(-1, 0) };
+    glm::ivec2 neighbour = neighbours[type - FaceType_WallNorth];
 
-    CreateSurfaceTexCoords(surface, tileset, tileId);
+    u32 data = Level_GetTileAt(level, x, y, Layer_Wall);
+    if (data == 0 || Level_GetTileAt(level, x + neighbour.x, y + neighbour.y, Layer_Wall) != 0)
+    {
+        return 0;
+    }
+    return data;
 }
 
-static void CreateCeilingVertices(Surface* surface, glm::vec2 position, const Tileset* tileset, s32 tileId = 0)
+// Creates the surface covering width x height tiles starting at tile x, y. Vertices keep the
+// winding of a single tile face, so the u and v axes point the same way for any size.
+static void CreateFaceSurface(Surface* surface, FaceType type, s32 x, s32 y, s32 width, s32 height, const Tileset* tileset, u32 data)
 {
-    surface->vertices[0] = glm::vec3(position.x + 0.0f, 1.0f, position.y + 0.0f);
-    surface->vertices[1] = glm::vec3(position.x + 1.0f, 1.0f, position.y + 0.0f);
-    surface->vertices[2] = glm::vec3(position.x + 1.0f, 1.0f, position.y + 1.0f);
-    surface->vertices[3] = glm::vec3(position.x + 0.0f, 1.0f, position.y + 1.0f);
+    f32 x0 = (f32)x;
+    f32 y0 = (f32)y;
+    f32 x1 = (f32)(x + width);
+    f32 y1 = (f32)(y + height);
 
-    glm::vec3 v1 = surface->vertices[1] - surface->vertices[0];
-    glm::vec3 v2 = surface->vertices[2] - surface->vertices[0];
-    surface->normal = glm::normalize(glm::cross(v1, v2));
+    switch (type)
+    {
+    case FaceType_Floor: {
+        surface->vertices[0] = glm::vec3(x0, 0.0f, y0);
+        surface->vertices[1] = glm::vec3(x0, 0.0f, y1);
+        surface->vertices[2] = glm::vec3(x1, 0.0f, y1);
+        surface->vertices[3] = glm::vec3(x1, 0.0f, y0);
+    } break;
 
-    CreateSurfaceTexCoords(surface, tileset, tileId);
-}
+    case FaceType_Ceiling: {
+        surface->vertices[0] = glm::vec3(x0, 1.0f, y0);
+        surface->vertices[1] = glm::vec3(x1, 1.0f, y0);
+        surface->vertices[2] = glm::vec3(x1, 1.0f, y1);
+        surface->vertices[3] = glm::vec3(x0, 1.0f, y1);
+    } break;
 
-static void CreateWallVertices(Surface* surface, WallDirection direction, glm::vec2 position, const Tileset* tileset, s32 tileId = 0)
-{
-    switch (direction)
-    {
-    case WallDirection_North: {
-        surface->vertices[0] = glm::vec3(position.x + 0.0f, 0.0f, position.y + 1.0f);
-        surface->vertices[1] = glm::vec3(position.x + 1.0f, 0.0f, position.y + 1.0f);
-        surface->vertices[2] = glm::vec3(position.x + 1.0f, 1.0f, position.y + 1.0f);
-        surface->vertices[3] = glm::vec3(position.x + 0.0f, 1.0f, position.y + 1.0f);
+    case FaceType_WallNorth: {
+        surface->vertices[0] = glm::vec3(x0, 0.0f, y1);
+        surface->vertices[1] = glm::vec3(x1, 0.0f, y1);
+        surface->vertices[2] = glm::vec3(x1, 1.0f, y1);
+        surface->vertices[3] = glm::vec3(x0, 1.0f, y1);
     } break;
 
-    case WallDirection_South: {
-        surface->vertices[0] = glm::vec3(position.x + 1.0f, 0.0f, position.y + 0.0f);
-        surface->vertices[1] = glm::vec3(position.x + 0.0f, 0.0f, position.y + 0.0f);
-        surface->vertices[2] = glm::vec3(position.x + 0.0f, 1.0f, position.y + 0.0f);
-        surface->vertices[3] = glm::vec3(position.x + 1.0f, 1.0f, position.y + 0.0f);
+    case FaceType_WallSouth: {
+        surface->vertices[0] = glm::vec3(x1, 0.0f, y0);
+        surface->vertices[1] = glm::vec3(x0, 0.0f, y0);
+        surface->vertices[2] = glm::vec3(x0, 1.0f, y0);
+        surface->vertices[3] = glm::vec3(x1, 1.0f, y0);
     } break;
 
-    case WallDirection_East: {
-        surface->vertices[0] = glm::vec3(position.x + 1.0f, 0.0f, position.y + 1.0f);
-        surface->vertices[1] = glm::vec3(position.x + 1.0f, 0.0f, position.y + 0.0f);
-        surface->vertices[2] = glm::vec3(position.x + 1.0f, 1.0f, position.y + 0.0f);
-        surface->vertices[3] = glm::vec3(position.x + 1.0f, 1.0f, position.y + 1.0f);
+    case FaceType_WallEast: {
+        surface->vertices[0] = glm::vec3(x1, 0.0f, y1);
+        surface->vertices[1] = glm::vec3(x1, 0.0f, y0);
+        surface->vertices[2] = glm::vec3(x1, 1.0f, y0);
+        surface->vertices[3] = glm::vec3(x1, 1.0f, y1);
     } break;
 
-    case WallDirection_West: {
-        surface->vertices[0] = glm::vec3(position.x + 0.0f, 0.0f, position.y + 0.0f);
-        surface->vertices[1] = glm::vec3(position.x + 0.0f, 0.0f, position.y + 1.0f);
-        surface->vertices[2] = glm::vec3(position.x + 0.0f, 1.0f, position.y + 1.0f);
-        surface->vertices[3] = glm::vec3(position.x + 0.0f, 1.0f, position.y + 0.0f);
+    case FaceType_WallWest: {
+        surface->vertices[0] = glm::vec3(x0, 0.0f, y0);
+        surface->vertices[1] = glm::vec3(x0, 0.0f, y1);
+        surface->vertices[2] = glm::vec3(x0, 1.0f, y1);
+        surface->vertices[3] = glm::vec3(x0, 1.0f, y0);
     } break;
-    };
+
+    default: break;
+    }
 
     glm::vec3 v1 = surface->vertices[1] - surface->vertices[0];
     glm::vec3 v2 = surface->vertices[2] - surface->vertices[0];
+    glm::vec3 v3 = surface->vertices[3] - surface->vertices[0];
     surface->normal = glm::normalize(glm::cross(v1, v2));
+    surface->size = glm::vec2(glm::length(v1), glm::length(v3));
+    surface->texture = data - 1;
+    surface->lightmapTile = {};
 
-    CreateSurfaceTexCoords(surface, tileset, tileId);
+    CreateSurfaceTexCoords(surface, tileset, (s32)data - 1);
 }
 
-Surface* CreateLevelSurfaces(const Level* level, const Tileset* tileset, Arena* transientStorage, s32* outSurfaceCount)
+// Greedily merges the faces of a type inside the region into rectangles of the same tile data. Each rectangle grows
+// along x first, then along y while the whole next row matches. Walls are one tile high, so they only merge along
+// their face. Only counts the surfaces when outSurfaces is null.
+static s32 MergeFaces(const Level* level, const LevelRegion* region, FaceType type, const Tileset* tileset, u8* merged, Surface* outSurfaces)
 {
-    *outSurfaceCount = 0;
-    const u64 MAX_SURFACES = level->width * level->height * 4;
-    Surface *surfaces = (Surface*)Arena_PushSize(transientStorage, sizeof(Surface) * MAX_SURFACES);
-    s32 surfaceIndex = 0;
+    b32 growX = type != FaceType_WallEast && type != FaceType_WallWest;
+    b32 growY = type != FaceType_WallNorth && type != FaceType_WallSouth;
+    s32 regionWidth = region->maxX - region->minX + 1;
+    s32 regionHeight = region->maxY - region->minY + 1;
+    s32 surfaceCount = 0;
+
+    Platform_ClearMemory(merged, regionWidth * regionHeight);
 
-    for (s32 layer = 0; layer < Layer_Count; ++layer)
+    for (s32 y = 0; y < regionHeight; ++y)
     {
-        for (s32 y = 0; y < level->height; ++y)
+        for (s32 x = 0; x < regionWidth; ++x)
         {
-            for (s32 x = 0; x < level->width; ++x)
+            u32 data = GetFaceData(level, type, region->minX + x, region->minY + y);
+            if (data == 0 || merged[y * regionWidth + x])
             {
-                u32 data = Level_GetTileAt(level, x, y, (Layer)layer);
-                s32 tileId = (s32)data - 1;
-                switch (layer)
+                continue;
+            }
+
+            s32 width = 1;
+            while (growX && width < MAX_MERGED_SURFACE_SIZE && x + width < regionWidth &&
+                   !merged[y * regionWidth + x + width] && GetFaceData(level, type, region->minX + x + width, region->minY + y) == data)
+            {
+                width++;
+            }
+
+            s32 height = 1;
+            while (growY && height < MAX_MERGED_SURFACE_SIZE && y + height < regionHeight)
+            {
+                b32 rowMatches = true;
+                for (s32 i = 0; i < width && rowMatches; ++i)
                 {
-                    case Layer_Floor: {
-                        if (data == 0) continue;
-                        Surface& surface = surfaces[surfaceIndex++];
-                        surface.texture = data - 1;
-                        CreateFloorVertices(&surface, glm::vec2(x, y), tileset, tileId);
-                    } break;
-
-                    case Layer_Ceiling: {
-                        if (data == 0) continue;
-                        Surface& surface = surfaces[surfaceIndex++];
-                        surface.texture = data - 1;
-                        CreateCeilingVertices(&surface, glm::vec2(x, y), tileset, tileId);
-                    } break;
-
-                    case Layer_Wall: {
-                        if (data == 0) continue;
-                        u32 northData = Level_GetTileAt(level, x, y + 1, (Layer)layer);
-                        if (northData == 0)
-                        {
-                            Surface& surface = surfaces[surfaceIndex++];
-                            surface.texture = data - 1;
-                            CreateWallVertices(&surface, WallDirection_North, glm::vec2(x, y), tileset, tileId);
-                        }
+                    rowMatches = !merged[(y + height) * regionWidth + x + i] &&
+                                 GetFaceData(level, type, region->minX + x + i, region->minY + y + height) == data;
+                }
+                if (!rowMatches)
+                {
+                    break;
+                }
+                height++;
+            }
 
-                        u32 southData = Level_GetTileAt(level, x, y - 1, (Layer)layer);
-                        if (southData == 0)
-                        {
-                            Surface& surface = surfaces[surfaceIndex++];
-                            surface.texture = data - 1;
-                            CreateWallVertices(&surface, WallDirection_South, glm::vec2(x, y), tileset, tileId);
-                        }
-                        
-                        u32 eastData = Level_GetTileAt(level, x + 1, y, (Layer)layer);
-                        if (eastData == 0)
-                        {
-                            Surface& surface = surfaces[surfaceIndex++];
-                            surface.texture = data - 1;
-                            CreateWallVertices(&surface, WallDirection_East, glm::vec2(x, y), tileset, tileId);
-                        }
-                        u32 westData = Level_GetTileAt(level, x - 1, y, (Layer)layer);
-                        if (westData == 0)
-                        {
-                            Surface& surface = surfaces[surfaceIndex++];
-                            surface.texture = data - 1;
-                            CreateWallVertices(&surface, WallDirection_West, glm::vec2(x, y), tileset, tileId);
-                        }                        
-                    } break;
+            for (s32 j = 0; j < height; ++j)
+            {
+                for (s32 i = 0; i < width; ++i)
+                {
+                    merged[(y + j) * regionWidth + x + i] = 1;
                 }
             }
+
+            if (outSurfaces)
+            {
+                CreateFaceSurface(&outSurfaces[surfaceCount], type, region->minX + x, region->minY + y, width, height, tileset, data);
+            }
+            surfaceCount++;
         }
     }
 
+    return surfaceCount;
+}
+
+Surface* CreateLevelSurfaces(const Level* level, const Tileset* tileset, Arena* transientStorage, s32* outSurfaceCount)
+{
+    LevelRegion region = { 0, 0, level->width - 1, level->height - 1 };
+    return CreateLevelRegionSurfaces(level, &region, tileset, transientStorage, outSurfaceCount);
+}
+
+Surface* CreateLevelRegionSurfaces(const Level* level, const LevelRegion* region, const Tileset* tileset, Arena* transientStorage, s32* outSurfaceCount)
+{
+    s32 regionWidth = glm::max(region->maxX - region->minX + 1, 0);
+    s32 regionHeight = glm::max(region->maxY - region->minY + 1, 0);
+    u8* merged = (u8*)Platform_Alloc(glm::max(regionWidth * regionHeight, 1));
+
+    // Count the merged surfaces first, so the arena only holds what is used.
+    s32 surfaceCount = 0;
+    for (s32 type = 0; type < FaceType_Count; ++type)
+    {
+        surfaceCount += MergeFaces(level, region, (FaceType)type, tileset, merged, 0);
+    }
+
+    Surface* surfaces = (Surface*)Arena_PushSize(transientStorage, sizeof(Surface) * glm::max(surfaceCount, 1));
+    s32 surfaceIndex = 0;
+    for (s32 type = 0; type < FaceType_Count; ++type)
+    {
+        surfaceIndex += MergeFaces(level, region, (FaceType)type, tileset, merged, surfaces + surfaceIndex);
+    }
+
+    Platform_Free(merged);
+
     *outSurfaceCount = surfaceIndex;
 
     return surfaces;
 }
 
-Atlas CreateAtlas(s32 width, s32 height, s32 tileWidth, s32 tileHeight, s32 padding, Arena* arena)
+// Returns the number of level tiles a surface covers along each axis.
+static glm::ivec2 GetSurfaceTileCount(const Surface* surface)
 {
-    Atlas atlas = {};
-    atlas.image.width = width;
-    atlas.image.height = height;
-    atlas.image.pixels = Arena_PushSize(arena, width * height * sizeof(u32));
+    return glm::ivec2((s32)(surface->size.x + 0.5f), (s32)(surface->size.y + 0.5f));
+}
 
+Mesh CreateSurfaceMesh(const Surface* surfaces, s32 surfaceCount)
+{
+    s32 quadCount = 0;
+    for (s32 i = 0; i < surfaceCount; ++i)
+    {
+        glm::ivec2 tileCount = GetSurfaceTileCount(&surfaces[i]);
+        quadCount += tileCount.x * tileCount.y;
+    }
+
+    Vertex* vertices = (Vertex*)Platform_Alloc(sizeof(Vertex) * 4 * glm::max(quadCount, 1));
+    u32* indices = (u32*)Platform_Alloc(sizeof(u32) * 6 * glm::max(quadCount, 1));
+
+    // Corners of a quad in surface space, in the order of the surface vertices.
+    static const glm::vec2 corners[4] = { glm::vec2(0.0f, 0.0f), glm::vec2(1.0f, 0.0f), glm::vec2(1.0f, 1.0f), glm::vec2(0.0f, 1.0f) };
+    static const u32 quadIndices[6] = { 0, 1, 2, 0, 2, 3 };
+
+    s32 quad = 0;
+    for (s32 i = 0; i < surfaceCount; ++i)
+    {
+        const Surface* surface = &surfaces[i];
+        glm::vec3 uAxis = surface->vertices[1] - surface->vertices[0];
+        glm::vec3 vAxis = surface->vertices[3] - surface->vertices[0];
+        glm::ivec2 tileCount = GetSurfaceTileCount(surface);
+
+        // A quad per level tile, each with the whole tileset tile. The lightmap UVs span the merged surface.
+        for (s32 tileY = 0; tileY < tileCount.y; ++tileY)
+        {
+            for (s32 tileX = 0; tileX < tileCount.x; ++tileX)
+            {
+                for (s32 j = 0; j < 4; ++j)
+                {
+                    f32 u = (tileX + corners[j].x) / tileCount.x;
+                    f32 v = (tileY + corners[j].y) / tileCount.y;
+
+                    Vertex* vertex = &vertices[quad * 4 + j];
+                    vertex->position = surface->vertices[0] + uAxis * u + vAxis * v;
+                    vertex->normal = surface->normal;
+                    vertex->color = glm::vec3(1.0f);
+                    vertex->texCoord0 = surface->texcoords[j];
+                    vertex->texCoord1 = surface->lightmap[0] * ((1.0f - u) * (1.0f - v)) + surface->lightmap[1] * (u * (1.0f - v)) +
+                                        surface->lightmap[2] * (u * v) + surface->lightmap[3] * ((1.0f - u) * v);
+                }
+
+                for (s32 j = 0; j < 6; ++j)
+                {
+                    indices[quad * 6 + j] = (u32)(quad * 4) + quadIndices[j];
+                }
+                quad++;
+            }
+        }
+    }
+
+    Mesh mesh = CreateMesh(vertices, 4 * quadCount, indices, 6 * quadCount);
+
+    Platform_Free(indices);
+    Platform_Free(vertices);
+
+    return mesh;
+}
+
+#define LIGHTMAP_DEFAULT_BOUNCE_TIME_BUDGET 2.0f
+#define LIGHTMAP_DEFAULT_OCCLUSION_STRENGTH 0.5f
+
+Atlas CreateAtlas(s32 pageWidth, s32 pageHeight, s32 luxelsPerUnit, s32 padding, Arena* arena)
+{
+    Atlas atlas = {};
     atlas.padding = padding;
-    atlas.tileWidth = tileWidth;
-    atlas.tileHeight = tileHeight;
-    atlas.tilesPerRow = width / (tileWidth + padding * 2);
-    atlas.tilesPerCol = height / (tileHeight + padding * 2);
+    atlas.luxelsPerUnit = luxelsPerUnit;
+    atlas.pageWidth = pageWidth;
+    atlas.pageHeight = pageHeight;
+    atlas.arena = arena;
+    atlas.quality = LightmapQuality_Adaptive;
+    atlas.bounceTimeBudget = LIGHTMAP_DEFAULT_BOUNCE_TIME_BUDGET;
+    atlas.occlusionStrength = LIGHTMAP_DEFAULT_OCCLUSION_STRENGTH;
+    atlas.format = TextureFormat_BC1;
 
     return atlas;
 }
 
-glm::ivec2 Atlas_GetTileMinAt(const Atlas* atlas, s32 tileId)
+static void AtlasPage_Reset(AtlasPage* page, s32 pageWidth)
+{
+    page->skyline[0].x = 0;
+    page->skyline[0].y = 0;
+    page->skyline[0].width = pageWidth;
+    page->skylineCount = 1;
+    page->encoded = false;
+}
+
+// Returns the lowest y a tile of width x height can be placed at with its left edge on the skyline node.
+static b32 AtlasPage_FitTile(const AtlasPage* page, s32 nodeIndex, s32 width, s32 height, s32 pageWidth, s32 pageHeight, s32* outY)
+{
+    s32 x = page->skyline[nodeIndex].x;
+    if (x + width > pageWidth)
+    {
+        return false;
+    }
+
+    s32 y = 0;
+    for (s32 i = nodeIndex, remaining = width; remaining > 0; ++i)
+    {
+        y = glm::max(y, page->skyline[i].y);
+        if (y + height > pageHeight)
+        {
+            return false;
+        }
+        remaining -= page->skyline[i].width;
+    }
+
+    *outY = y;
+    return true;
+}
+
+// Places the tile where its top ends up lowest, on the narrowest node for ties, then raises the skyline under it.
+static b32 AtlasPage_AllocateTile(AtlasPage* page, s32 width, s32 height, s32 pageWidth, s32 pageHeight, glm::ivec2* outPosition)
+{
+    s32 bestIndex = -1;
+    s32 bestTop = pageHeight + 1;
+    s32 bestWidth = pageWidth + 1;
+    s32 bestY = 0;
+
+    for (s32 i = 0; i < page->skylineCount; ++i)
+    {
+        s32 y;
+        if (AtlasPage_FitTile(page, i, width, height, pageWidth, pageHeight, &y) &&
+            (y + height < bestTop || (y + height == bestTop && page->skyline[i].width < bestWidth)))
+        {
+            bestIndex = i;
+            bestTop = y + height;
+            bestWidth = page->skyline[i].width;
+            bestY = y;
+        }
+    }
+
+    if (bestIndex < 0)
+    {
+        return false;
+    }
+
+    SkylineNode node = { page->skyline[bestIndex].x, bestY + height, width };
+    for (s32 i = page->skylineCount; i > bestIndex; --i)
+    {
+        page->skyline[i] = page->skyline[i - 1];
+    }
+    page->skyline[bestIndex] = node;
+    page->skylineCount++;
+
+    // Cut the nodes now covered by the tile.
+    for (s32 i = bestIndex + 1; i < page->skylineCount;)
+    {
+        SkylineNode* next = &page->skyline[i];
+        s32 overlap = node.x + node.width - next->x;
+        if (overlap <= 0)
+        {
+            break;
+        }
+
+        next->x += overlap;
+        next->width -= overlap;
+        if (next->width > 0)
+        {
+            break;
+        }
+
+        for (s32 j = i; j < page->skylineCount - 1; ++j)
+        {
+            page->skyline[j] = page->skyline[j + 1];
+        }
+        page->skylineCount--;
+    }
+
+    // Merge neighbours at the same height.
+    for (s32 i = 0; i < page->skylineCount - 1;)
+    {
+        if (page->skyline[i].y == page->skyline[i + 1].y)
+        {
+            page->skyline[i].width += page->skyline[i + 1].width;
+            for (s32 j = i + 1; j < page->skylineCount - 1; ++j)
+            {
+                page->skyline[j] = page->skyline[j + 1];
+            }
+            page->skylineCount--;
+        }
+        else
+        {
+            ++i;
+        }
+    }
+
+    outPosition->x = node.x;
+    outPosition->y = bestY;
+    return true;
+}
+
+void Atlas_Clear(Atlas* atlas)
+{
+    for (s32 i = 0; i < atlas->pageCount; ++i)
+    {
+        AtlasPage_Reset(&atlas->pages[i], atlas->pageWidth);
+    }
+    atlas->pageCount = 0;
+}
+
+b32 Atlas_AllocateTile(Atlas* atlas, s32 width, s32 height, AtlasTile* outTile)
+{
+    s32 paddedWidth = width + atlas->padding * 2;
+    s32 paddedHeight = height + atlas->padding * 2;
+    if (paddedWidth > atlas->pageWidth || paddedHeight > atlas->pageHeight)
+    {
+        return false;
+    }
+
+    for (s32 page = 0; page < MAX_ATLAS_PAGES; ++page)
+    {
+        // Spill into a new page once the tile fits in none of the used ones.
+        if (page == atlas->pageCount)
+        {
+            AtlasPage* newPage = &atlas->pages[page];
+            if (!newPage->image.pixels)
+            {
+                // The arena may only have room for some of the pages.
+                void* pixels = Arena_PushSize(atlas->arena, sizeof(u32) * atlas->pageWidth * atlas->pageHeight);
+                SkylineNode* skyline = pixels ? (SkylineNode*)Arena_PushSize(atlas->arena, sizeof(SkylineNode) * (atlas->pageWidth + 1)) : nullptr;
+                if (!pixels || !skyline)
+                {
+                    return false;
+                }
+                newPage->image.width = atlas->pageWidth;
+                newPage->image.height = atlas->pageHeight;
+                newPage->image.pixels = pixels;
+                newPage->skyline = skyline;
+            }
+            AtlasPage_Reset(newPage, atlas->pageWidth);
+            atlas->pageCount++;
+        }
+
+        glm::ivec2 position;
+        if (AtlasPage_AllocateTile(&atlas->pages[page], paddedWidth, paddedHeight, atlas->pageWidth, atlas->pageHeight, &position))
+        {
+            outTile->page = page;
+            outTile->x = position.x + atlas->padding;
+            outTile->y = position.y + atlas->padding;
+            outTile->width = width;
+            outTile->height = height;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Luxels of the surface tile, proportional to its extent. Surfaces too large for a page get fewer luxels per unit.
+static glm::ivec2 GetSurfaceTileSize(const Atlas* atlas, const Surface* surface)
 {
-    s32 atlasCol = tileId % atlas->tilesPerRow;
-    s32 atlasRow = tileId / atlas->tilesPerRow;
-    s32 tilePaddedWidth = atlas->tileWidth + atlas->padding * 2;
-    s32 tilePaddedHeight = atlas->tileHeight + atlas->padding * 2;
+    glm::vec2 luxels = surface->size * (f32)atlas->luxelsPerUnit;
+    glm::vec2 maxLuxels = glm::vec2((f32)(atlas->pageWidth - atlas->padding * 2), (f32)(atlas->pageHeight - atlas->padding * 2));
+    f32 scale = glm::min(glm::min(maxLuxels.x / luxels.x, maxLuxels.y / luxels.y), 1.0f);
+
+    glm::ivec2 size;
+    size.x = glm::max((s32)(luxels.x * scale + 0.5f), 1);
+    size.y = glm::max((s32)(luxels.y * scale + 0.5f), 1);
+    return size;
+}
+
+b32 Atlas_PackSurfaces(Atlas* atlas, Surface* surfaces, s32 surfaceCount)
+{
+    Atlas_Clear(atlas);
+
+    // Tallest tiles first, so the skyline stays flat and wastes little space under the shorter ones.
+    s32* order = (s32*)Platform_Alloc(sizeof(s32) * glm::max(surfaceCount, 1));
+    for (s32 i = 0; i < surfaceCount; ++i)
+    {
+        order[i] = i;
+    }
+    std::stable_sort(order, order + surfaceCount, [surfaces](s32 a, s32 b) {
+        if (surfaces[a].size.y != surfaces[b].size.y) return surfaces[a].size.y > surfaces[b].size.y;
+        return surfaces[a].size.x > surfaces[b].size.x;
+    });
+
+    b32 result = true;
+    for (s32 i = 0; i < surfaceCount && result; ++i)
+    {
+        Surface* surface = &surfaces[order[i]];
+        glm::ivec2 size = GetSurfaceTileSize(atlas, surface);
+        result = Atlas_AllocateTile(atlas, size.x, size.y, &surface->lightmapTile);
+    }
 
-    glm::ivec2 result = {};
-    result.x = atlasCol * tilePaddedWidth;
-    result.y = atlasRow * tilePaddedHeight;
+    Platform_Free(order);
     return result;
 }
 
+struct AtlasCompressJob
+{
+    const Image* image;
+    TextureFormat format;
+    u8* blocks;
+    u64 blockRowSize;
+};
+
+static void CompressBlockRows(void* userData, s32 begin, s32 end, s32 workerIndex)
+{
+    AtlasCompressJob* job = (AtlasCompressJob*)userData;
+    Image_CompressRect(job->image, 0, begin * 4, job->image->width, (end - begin) * 4, job->format, job->blocks + begin * job->blockRowSize);
+}
+
+void Atlas_DecodePages(Atlas* atlas)
+{
+    for (s32 i = 0; i < atlas->pageCount; ++i)
+    {
+        AtlasPage* page = &atlas->pages[i];
+        if (page->encoded)
+        {
+            Image_DecompressRect(&page->image, 0, 0, atlas->pageWidth, atlas->pageHeight, atlas->format, page->blocks);
+            page->encoded = false;
+        }
+    }
+}
+
+void Atlas_CompressPage(const Atlas* atlas, s32 page, void* outBlocks)
+{
+    Platform_Assert(atlas->pageWidth % 4 == 0 && atlas->pageHeight % 4 == 0, "Atlas pages are not made of whole blocks.");
+
+    if (atlas->pages[page].encoded)
+    {
+        Platform_CopyMemory(outBlocks, atlas->pages[page].blocks, Image_GetFormatSize(atlas->pageWidth, atlas->pageHeight, atlas->format));
+        return;
+    }
+
+    AtlasCompressJob job = {};
+    job.image = &atlas->pages[page].image;
+    job.format = atlas->format;
+    job.blocks = (u8*)outBlocks;
+    job.blockRowSize = Image_GetFormatSize(atlas->pageWidth, 4, atlas->format);
+    Jobs_ParallelFor(atlas->pageHeight / 4, 16, CompressBlockRows, &job);
+}
+
+TextureId Atlas_CreatePageTexture(const Atlas* atlas, s32 page)
+{
+    if (atlas->format == TextureFormat_RGBA8)
+    {
+        return RHI_CreateTexture(atlas->pages[page].image.pixels, atlas->pageWidth, atlas->pageHeight);
+    }
+
+    // Pages loaded from the lightmap cache are uploaded as they were stored, without encoding them again.
+    if (atlas->pages[page].encoded)
+    {
+        return RHI_CreateCompressedTexture(atlas->pages[page].blocks, atlas->pageWidth, atlas->pageHeight, atlas->format);
+    }
+
+    void* blocks = Platform_Alloc(Image_GetFormatSize(atlas->pageWidth, atlas->pageHeight, atlas->format));
+    Atlas_CompressPage(atlas, page, blocks);
+    TextureId texture = RHI_CreateCompressedTexture(blocks, atlas->pageWidth, atlas->pageHeight, atlas->format);
+    Platform_Free(blocks);
+    return texture;
+}
+
+void Atlas_UpdatePageTexture(const Atlas* atlas, TextureId texture, s32 page, s32 x, s32 y, s32 width, s32 height)
+{
+    const Image* image = &atlas->pages[page].image;
+    if (atlas->format == TextureFormat_RGBA8)
+    {
+        RHI_UpdateTexture(texture, x, y, width, height, (const u32*)image->pixels + y * atlas->pageWidth + x, atlas->pageWidth);
+        return;
+    }
+
+    // Blocks are uploaded whole, the pixels of the neighbours sharing them are compressed again as they are.
+    s32 minX = x & ~3;
+    s32 minY = y & ~3;
+    s32 maxX = glm::min((x + width + 3) & ~3, atlas->pageWidth);
+    s32 maxY = glm::min((y + height + 3) & ~3, atlas->pageHeight);
+
+    u64 blockSize = Image_GetFormatSize(maxX - minX, maxY - minY, atlas->format);
+    Jobs_ReserveScratchArena(blockSize + MEMORY_DEFAULT_ALIGNMENT);
+    Arena* scratch = Jobs_GetScratchArena();
+    u64 scratchOffset = scratch->offset;
+    void* blocks = Arena_PushSize(scratch, blockSize);
+    Platform_Assert(blocks, "Scratch arena is full.");
+
+    Image_CompressRect(image, minX, minY, maxX - minX, maxY - minY, atlas->format, blocks);
+    RHI_UpdateCompressedTexture(texture, minX, minY, maxX - minX, maxY - minY, atlas->format, blocks);
+
+    scratch->offset = scratchOffset;
+}
+
 f32 ComputeAttenuation(f32 distance, f32 range)
 {
     f32 lConstant = 1.0f;
@@ -219,178 +642,1881 @@ f32 ComputeLightFallOff(const Light* light, f32 distance)
     return lightFalloff;
 }
 
-glm::vec4 ComputeLuxelLighting(const Level* level, glm::vec3 luxelPosition, const Light* light, const Atlas* atlas, s32 surfaceIndex, s32 x, s32 y)
+// Lights bucketed by the level tiles their range reaches, so a luxel only visits the lights of its tile.
+struct LightGrid
+{
+    s32 minX; // Level tile of the first cell, the grid only covers the tiles of the baked surfaces.
+    s32 minY;
+    s32 width;
+    s32 height;
+    s32* cellStart; // Offsets into entries per cell, one past the end for the last.
+    s32* entries;   // Indices into the bake lights, ascending per cell.
+};
+
+// Lights that reach a surface, in the order of the bake lights.
+struct SurfaceLights
 {
-    glm::vec3 ray = glm::normalize(luxelPosition - light->position);
-    glm::vec2 direction = glm::normalize(glm::vec2(ray.x, ray.z));
-    glm::vec2 origin = glm::vec2(light->position.x, light->position.z) + direction * 0.01f;
+    const Light* lights;
+    const LightVisibility* visibility; // Parallel to lights.
+    const s32* indices;                // Index of each light among the bake lights.
+    s32 count;
+    const LightGrid* grid;
+};
+
+// Shades spans of the luxel rows of a surface. A span is split into runs of luxels whose level tiles
+// register the same lights, and each run only gets those. Lights out of range add nothing, the sums stay the same.
+struct SurfaceShader
+{
+    LuxelRow row;
+    SurfaceLights lights;
+    s32* runLights;  // Lights of the run being gathered, as indices into lights.
+    s32* cellLights; // Lights of the tile of the current luxel.
+    Light* spanLights;
+    LightVisibility* spanVisibility;
+    s32 luxelsPerCol;
+    s32 padding;
+    Arena* scratch;
+    u64 scratchOffset; // Scratch arena offset before the shader, restored when it is destroyed.
+};
+
+static void SurfaceShader_Init(SurfaceShader* shader, const Surface* surface, const Level* level, const SurfaceLights* lights, f32 ambientLight, s32 luxelsPerRow, s32 luxelsPerCol, s32 padding)
+{
+    *shader = {};
+    shader->row.level = level;
+    shader->row.ambientLight = ambientLight;
+    shader->row.origin = surface->vertices[0];
+    shader->row.normal = surface->normal;
+    shader->row.uAxis = surface->vertices[1] - surface->vertices[0];
+    shader->row.vAxis = surface->vertices[3] - surface->vertices[0];
+    shader->row.luxelsPerRow = luxelsPerRow;
+    shader->lights = *lights;
+    shader->scratch = Jobs_GetScratchArena();
+    shader->scratchOffset = shader->scratch->offset;
+    s32 lightCount = glm::max(lights->count, 1);
+    shader->runLights = ArenaPushArray(shader->scratch, s32, lightCount);
+    shader->cellLights = ArenaPushArray(shader->scratch, s32, lightCount);
+    shader->spanLights = ArenaPushArray(shader->scratch, Light, lightCount);
+    shader->spanVisibility = ArenaPushArray(shader->scratch, LightVisibility, lightCount);
+    Platform_Assert(shader->runLights && shader->cellLights && shader->spanLights && shader->spanVisibility, "Scratch arena is full.");
+    shader->row.lights = shader->spanLights;
+    shader->row.visibility = shader->spanVisibility;
+    shader->luxelsPerCol = luxelsPerCol;
+    shader->padding = padding;
+}
 
-    f32 luxelDist = glm::distance(glm::vec2(luxelPosition.x, luxelPosition.z), glm::vec2(light->position.x, light->position.z));
+static void SurfaceShader_Destroy(SurfaceShader* shader)
+{
+    shader->scratch->offset = shader->scratchOffset;
+}
 
-    // Get the current color in the lightmap
-    glm::ivec2 pixelPosition = Atlas_GetTileMinAt(atlas, surfaceIndex);
-    pixelPosition.x += x;
-    pixelPosition.y += y;
-    u32 prevPixel = ((u32*)atlas->image.pixels)[pixelPosition.x + pixelPosition.y * atlas->image.width];
-    glm::vec4 color = Color_ConvertToVec4(Color_ConvertToRGBA(prevPixel, PixelFormat_ABGR));
+// Gathers the lights of the surface that the grid registers in the cell, keeping their order.
+static s32 SurfaceShader_GetCellLights(const SurfaceShader* shader, glm::ivec2 cell, s32* outLights)
+{
+    const LightGrid* grid = shader->lights.grid;
+    s32 entry = grid->cellStart[cell.y * grid->width + cell.x];
+    s32 entryEnd = grid->cellStart[cell.y * grid->width + cell.x + 1];
 
-    RayCastHit hit = {};
-    if (Level_CastRay(level, origin, direction, &hit))
+    // Both lists are sorted by light index.
+    s32 count = 0;
+    for (s32 i = 0; i < shader->lights.count && entry < entryEnd; ++i)
     {
-        if (hit.distance + 0.02f > luxelDist)
+        while (entry < entryEnd && grid->entries[entry] < shader->lights.indices[i]) ++entry;
+        if (entry < entryEnd && grid->entries[entry] == shader->lights.indices[i])
         {
-            luxelDist = glm::distance(luxelPosition, light->position);
-            //f32 attenuation = ComputeAttenuation(luxelDist, light->range);
-            f32 attenuation = ComputeLightFallOff(light, luxelDist);
-
-            color += glm::vec4(light->color * light->intensity * attenuation, 1.0f);
-            color = glm::clamp(color, 0.0f, 1.0f);
+            outLights[count++] = i;
         }
     }
-
-    return color;
+    return count;
 }
 
-glm::vec4 ComputeLuxelLighting(const Level* level, const Light* light, const glm::vec3& luxelPosition)
+// Shades the luxels [firstLuxel, firstLuxel + luxelCount) of the current row with the gathered run lights.
+static s32 SurfaceShader_ShadeRun(SurfaceShader* shader, s32 firstLuxel, s32 luxelCount, s32 lightCount, glm::vec3* outColors)
 {
-    glm::vec3 ray = glm::normalize(luxelPosition - light->position);
-    glm::vec2 direction = glm::normalize(glm::vec2(ray.x, ray.z));
-    glm::vec2 origin = glm::vec2(light->position.x, light->position.z) + direction * 0.01f;
-
-    f32 luxelDist = glm::distance(glm::vec2(luxelPosition.x, luxelPosition.z), glm::vec2(light->position.x, light->position.z));
+    LuxelRow* row = &shader->row;
 
-    glm::vec4 color = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
-
-    RayCastHit hit = {};
-    if (Level_CastRay(level, origin, direction, &hit))
+    // Moving the padding by the first luxel keeps the luxel positions exactly those of the full row.
+    row->padding = shader->padding - firstLuxel;
+    row->luxelCount = luxelCount;
+    row->lightCount = lightCount;
+    for (s32 i = 0; i < lightCount; ++i)
     {
-        if (hit.distance + 0.02f > luxelDist)
-        {
-            luxelDist = glm::distance(luxelPosition, light->position);
-            f32 attenuation = ComputeLightFallOff(light, luxelDist);
-            color = glm::vec4(light->color * light->intensity * attenuation, 1.0f);
-            color = glm::clamp(color, 0.0f, 1.0f);
-        }
+        shader->spanLights[i] = shader->lights.lights[shader->runLights[i]];
+        shader->spanVisibility[i] = shader->lights.visibility[shader->runLights[i]];
     }
 
-    return color;
+    return ShadeLuxelRow(row, outColors);
 }
 
-void DilateTile(Image* image, glm::ivec2 tileMin, s32 tileWidth, s32 tileHeight, s32 padding)
+// Shades the luxels [firstLuxel, firstLuxel + luxelCount) of row y, both counted with padding.
+// Returns the number of shadow rays cast.
+static s32 SurfaceShader_ShadeSpan(SurfaceShader* shader, s32 y, s32 firstLuxel, s32 luxelCount, glm::vec3* outColors)
 {
-    for (s32 i = 1; i <= padding; i++)
+    LuxelRow* row = &shader->row;
+    row->vOffset = ((f32)y + 0.5f - shader->padding) / shader->luxelsPerCol;
+
+    const LightGrid* grid = shader->lights.grid;
+    glm::vec3 rowOrigin = row->origin + row->vAxis * row->vOffset;
+    s32 end = firstLuxel + luxelCount;
+
+    s32 rayCount = 0;
+    s32 runStart = firstLuxel;
+    s32 runLightCount = 0;
+    glm::ivec2 previousCell(-1);
+    for (s32 x = firstLuxel; x < end; ++x)
     {
-        // Dilate the top and bottom row
-        for (s32 x = 0; x < tileWidth; ++x)
+        glm::vec3 position = rowOrigin + row->uAxis * (((f32)x + 0.5f - shader->padding) / row->luxelsPerRow);
+        glm::ivec2 cell;
+        cell.x = glm::clamp((s32)glm::floor(position.x) - grid->minX, 0, grid->width - 1);
+        cell.y = glm::clamp((s32)glm::floor(position.z) - grid->minY, 0, grid->height - 1);
+        if (cell == previousCell)
         {
-            Image_CopyPixel(image, tileMin.x + x, tileMin.y, tileMin.x + x, tileMin.y - i);
-            Image_CopyPixel(image, tileMin.x + x, tileMin.y + tileHeight - 1, tileMin.x + x, tileMin.y + tileHeight - 1 + i);
+            continue;
         }
+        previousCell = cell;
 
-        // Dilate the left and right column
-        for (s32 y = 0; y < tileHeight + padding * 2; ++y)
+        // Neighbouring tiles with the same lights stay in one run.
+        s32 cellLightCount = SurfaceShader_GetCellLights(shader, cell, shader->cellLights);
+        if (x > runStart && (cellLightCount != runLightCount || memcmp(shader->cellLights, shader->runLights, sizeof(s32) * cellLightCount) != 0))
         {
-            Image_CopyPixel(image, tileMin.x, tileMin.y + y, tileMin.x - i, tileMin.y + y);
-            Image_CopyPixel(image, tileMin.x + tileWidth - 1, tileMin.y + y, tileMin.x + tileWidth - 1 + i, tileMin.y + y);
+            rayCount += SurfaceShader_ShadeRun(shader, runStart, x - runStart, runLightCount, outColors + (runStart - firstLuxel));
+            runStart = x;
         }
 
-        // Dilate the corners
-        Image_CopyPixel(image, tileMin.x, tileMin.y, tileMin.x - i, tileMin.y - i); // top left
-        Image_CopyPixel(image, tileMin.x + tileWidth - 1, tileMin.y, tileMin.x + tileWidth - 1 + i, tileMin.y - i); // top right
-        Image_CopyPixel(image, tileMin.x, tileMin.y + tileHeight - 1, tileMin.x - i, tileMin.y + tileHeight - 1 + i); // bottom left
-        Image_CopyPixel(image, tileMin.x + tileWidth - 1, tileMin.y + tileHeight - 1, tileMin.x + tileWidth - 1 + i, tileMin.y + tileHeight - 1 + i); // bottom right
+        s32* swap = shader->runLights;
+        shader->runLights = shader->cellLights;
+        shader->cellLights = swap;
+        runLightCount = cellLightCount;
     }
+
+    rayCount += SurfaceShader_ShadeRun(shader, runStart, end - runStart, runLightCount, outColors + (runStart - firstLuxel));
+    return rayCount;
 }
 
-void CreateLightmapForSurface(Image* image, const Surface* surface, const Level* level, const Light* light, s32 luxelsPerRow, s32 luxelsPerCol, s32 padding)
+s32 CreateLightmapForSurface(HdrImage* image, const Surface* surface, const Level* level, const SurfaceLights* lights, f32 ambientLight, s32 luxelsPerRow, s32 luxelsPerCol, s32 padding)
 {
-    Image_FillColor(image, Color{ 0, 0, 0, 255 });
+    SurfaceShader shader;
+    SurfaceShader_Init(&shader, surface, level, lights, ambientLight, luxelsPerRow, luxelsPerCol, padding);
 
-    glm::vec3 uAxis = glm::normalize(surface->vertices[1] - surface->vertices[0]);
-    glm::vec3 vAxis = glm::normalize(surface->vertices[3] - surface->vertices[0]);
-
-    for (s32 y = 0; y < luxelsPerCol + padding * 2; ++y)
+    // Only the luxels of the surface are shaded, the padding is dilated from them afterwards.
+    s32 rayCount = 0;
+    for (s32 y = padding; y < luxelsPerCol + padding; ++y)
     {
-        for (s32 x = 0; x < luxelsPerRow + padding * 2; ++x)
-        {
-            f32 xOffset = ((f32)x + 0.5f - padding) / (luxelsPerRow + padding * 2 - 2 * padding);
-            f32 yOffset = ((f32)y + 0.5f - padding) / (luxelsPerCol + padding * 2 - 2 * padding);
-
-            glm::vec3 luxelPosition = surface->vertices[0] + uAxis * xOffset + vAxis * yOffset;
-            glm::vec4 luxelColor = ComputeLuxelLighting(level, light, luxelPosition);
-
-            Color color = Color_ConvertToColor(luxelColor);
-            u32 pixelColor = Color_ConvertToU32(color, PixelFormat_ABGR);
-            ((u32*)image->pixels)[(y * image->width) + x] = pixelColor;
-        }
+        rayCount += SurfaceShader_ShadeSpan(&shader, y, padding, luxelsPerRow, image->pixels + y * image->width + padding);
     }
+
+    SurfaceShader_Destroy(&shader);
+    return rayCount;
 }
 
-static std::mutex atlasMutex;
+// Largest difference of a color channel between neighbouring luxels, in 8 bit steps, that is still
+// shaded at base resolution. Anything steeper is a light or shadow edge and gets supersampled.
+#define LIGHTMAP_SUPERSAMPLE_THRESHOLD 6
 
-void ComputeLightmap(Atlas* atlas, const Level* level, const Surface* surfaces, s32 surfaceCount, const Light* lights, s32 lightCount)
+static f32 GetMaxChannelDifference(glm::vec3 a, glm::vec3 b)
 {
-    f32 ambientLight = 0.1f;
-
-    Image_FillColor(&atlas->image, Color_ConvertToColor(glm::vec4(glm::vec3(ambientLight), 1.0f)));
+    // Differences above 1 all quantize to white, so compare the clamped colors.
+    glm::vec3 difference = glm::abs(glm::clamp(a, 0.0f, 1.0f) - glm::clamp(b, 0.0f, 1.0f)) * 255.0f;
+    return glm::max(difference.r, glm::max(difference.g, difference.b));
+}
 
-    s32 tileWidth = (atlas->tileWidth + atlas->padding * 2);
-    s32 tileHeight = (atlas->tileHeight + atlas->padding * 2);
+// Box filter of four luxels, the same as HdrImage_Downsample2x.
+static glm::vec3 AverageLuxels(glm::vec3 a, glm::vec3 b, glm::vec3 c, glm::vec3 d)
+{
+    return (a + b + c + d) * 0.25f;
+}
 
-    for (s32 i = 0; i < lightCount; ++i)
+// Shades the surface at base resolution, then shades 2x2 subsamples only for the luxels that differ
+// from a neighbour by more than the threshold and replaces them with their average.
+static s32 CreateAdaptiveLightmapForSurface(HdrImage* image, const Surface* surface, const Level* level, const SurfaceLights* lights, f32 ambientLight,
+    s32 luxelsPerRow, s32 luxelsPerCol, s32 padding, s32* outBaseRayCount, s32* outSupersampledCount)
+{
+    s32 rayCount = CreateLightmapForSurface(image, surface, level, lights, ambientLight, luxelsPerRow, luxelsPerCol, padding);
+    *outBaseRayCount = rayCount;
+    *outSupersampledCount = 0;
+
+    s32 width = image->width;
+    s32 height = image->height;
+    glm::vec3* pixels = image->pixels;
+
+    Arena* scratch = Jobs_GetScratchArena();
+    u64 scratchOffset = scratch->offset;
+    u8* supersample = ArenaPushArray(scratch, u8, width * height);
+    Platform_Assert(supersample, "Scratch arena is full.");
+    Platform_ClearMemory(supersample, width * height);
+
+    // Only the luxels of the surface are compared, the padding is not shaded yet.
+    s32 right = padding + luxelsPerRow;
+    s32 bottom = padding + luxelsPerCol;
+    for (s32 y = padding; y < bottom; ++y)
     {
-        const Light* light = &lights[i];
+        for (s32 x = padding; x < right; ++x)
+        {
+            glm::vec3 luxel = pixels[y * width + x];
+            if (x + 1 < right && GetMaxChannelDifference(luxel, pixels[y * width + x + 1]) > LIGHTMAP_SUPERSAMPLE_THRESHOLD)
+            {
+                supersample[y * width + x] = supersample[y * width + x + 1] = 1;
+            }
+            if (y + 1 < bottom && GetMaxChannelDifference(luxel, pixels[(y + 1) * width + x]) > LIGHTMAP_SUPERSAMPLE_THRESHOLD)
+            {
+                supersample[y * width + x] = supersample[(y + 1) * width + x] = 1;
+            }
+        }
+    }
 
-        std::vector<std::thread> threads;
+    SurfaceShader shader;
+    SurfaceShader_Init(&shader, surface, level, lights, ambientLight, luxelsPerRow * 2, luxelsPerCol * 2, padding * 2);
+    glm::vec3* subsamples = ArenaPushArray(scratch, glm::vec3, width * 4);
+    Platform_Assert(subsamples, "Scratch arena is full.");
 
-        for (s32 j = 0; j < surfaceCount; ++j)
+    // Subsamples of luxel x, y are the luxels 2x, 2y to 2x + 1, 2y + 1 of the surface shaded at twice the resolution.
+    for (s32 y = 0; y < height; ++y)
+    {
+        for (s32 x = 0; x < width;)
         {
-            threads.emplace_back([=]() {
-                const Surface* surface = &surfaces[j];
-            
-                Image tImage = {};
-                tImage.width = tileWidth;
-                tImage.height = tileHeight;
-                tImage.pixels = Platform_Alloc(sizeof(u32) * tImage.width * tImage.height);
+            if (!supersample[y * width + x])
+            {
+                ++x;
+                continue;
+            }
 
-                Image tImage2 = {};
-                tImage2.width = tileWidth * 2;
-                tImage2.height = tileHeight * 2;
-                tImage2.pixels = Platform_Alloc(sizeof(u32) * tImage2.width * tImage2.height);
+            s32 runStart = x;
+            while (x < width && supersample[y * width + x]) ++x;
+            s32 runLength = x - runStart;
 
-                Image tImage3 = {};
-                tImage3.width = tileWidth;
-                tImage3.height = tileHeight;
-                tImage3.pixels = Platform_Alloc(sizeof(u32) * tImage3.width * tImage3.height);
+            glm::vec3* top = subsamples;
+            glm::vec3* bottom = subsamples + runLength * 2;
+            rayCount += SurfaceShader_ShadeSpan(&shader, y * 2, runStart * 2, runLength * 2, top);
+            rayCount += SurfaceShader_ShadeSpan(&shader, y * 2 + 1, runStart * 2, runLength * 2, bottom);
 
-                s32 luxelsPerRow = atlas->tileWidth * 2;
-                s32 luxelsPerCol = atlas->tileHeight * 2;
-                s32 lightmapPadding = atlas->padding * 2;
+            for (s32 i = 0; i < runLength; ++i)
+            {
+                pixels[y * width + runStart + i] = AverageLuxels(top[i * 2], top[i * 2 + 1], bottom[i * 2], bottom[i * 2 + 1]);
+            }
+            *outSupersampledCount += runLength;
+        }
+    }
 
-                CreateLightmapForSurface(&tImage2, surface, level, light, luxelsPerRow, luxelsPerCol, lightmapPadding);
-                Image_Downsample2x(&tImage, &tImage2);
+    SurfaceShader_Destroy(&shader);
+    scratch->offset = scratchOffset;
 
-                glm::ivec2 tileMin = Atlas_GetTileMinAt(atlas, j);
-                {
-                    std::lock_guard<std::mutex> lock(atlasMutex);
+    return rayCount;
+}
 
-                    Image_Crop(&tImage3, &atlas->image, tileMin.x, tileMin.y, tileWidth, tileHeight);
-                    Image_AddImages(&tImage, &tImage3, &tImage);
-                    Image_Blit(&atlas->image, &tImage, tileMin.x, tileMin.y);
+// Shades one sample per level tile the surface spans and gives every luxel the sample of its tile.
+static s32 CreateCoarseLightmapForSurface(HdrImage* image, const Surface* surface, const Level* level, const SurfaceLights* lights, f32 ambientLight, s32 padding)
+{
+    Arena* scratch = Jobs_GetScratchArena();
+    u64 scratchOffset = scratch->offset;
+    HdrImage samples = HdrImage_Create(glm::max((s32)(surface->size.x + 0.5f), 1), glm::max((s32)(surface->size.y + 0.5f), 1), scratch);
+
+    s32 rayCount = CreateLightmapForSurface(&samples, surface, level, lights, ambientLight, samples.width, samples.height, 0);
+
+    s32 luxelsPerRow = image->width - padding * 2;
+    s32 luxelsPerCol = image->height - padding * 2;
+    for (s32 y = padding; y < luxelsPerCol + padding; ++y)
+    {
+        s32 sampleY = (y - padding) * samples.height / luxelsPerCol;
+        for (s32 x = padding; x < luxelsPerRow + padding; ++x)
+        {
+            s32 sampleX = (x - padding) * samples.width / luxelsPerRow;
+            image->pixels[y * image->width + x] = samples.pixels[sampleY * samples.width + sampleX];
+        }
+    }
+
+    scratch->offset = scratchOffset;
+    return rayCount;
+}
+
+// Surfaces per job, small enough for the workers to balance merged surfaces of very different sizes.
+#define LIGHTMAP_SURFACES_PER_JOB 4
+
+#define LIGHTMAP_AMBIENT_LIGHT 0.1f
+
+// Piece of a surface the size of a level tile. Patches send and gather the indirect light.
+struct BouncePatch
+{
+    glm::vec3 position;
+    glm::vec3 normal;
+    f32 area;
+    glm::vec3 direct;   // Average direct light of the luxels, without the ambient light.
+    glm::vec3 indirect; // Light gathered from the other patches in the last bounce.
+};
+
+// Node of a quadtree over the patches facing one way. Far away nodes send as a whole.
+struct BounceNode
+{
+    glm::vec3 position; // Area weighted center of the patches below.
+    glm::vec3 normal;
+    f32 area;
+    f32 size;           // Extent in level tiles of the square the node covers.
+    glm::vec3 power;    // Radiance times area of the patches below.
+    s32 firstChild;
+    s32 childCount;
+    s32 patch;          // Patch of a leaf, -1 for the other nodes.
+};
+
+struct LightBounce
+{
+    s32 surfaceCount;
+    s32* patchStart;          // First patch per baked surface, one past the end for the last.
+    glm::ivec2* patchGrid;    // Patches along each axis per baked surface.
+    BouncePatch* patches;
+    s32 patchCount;
+    glm::vec3* gathered;      // Light gathered by each patch in the running bounce.
+    BounceNode* nodes;
+    s32 nodeCount;
+    s32 roots[6];             // One tree per facing, -1 when no patch faces that way.
+    s64* luxelStart;          // First luxel per baked surface, one past the end for the last.
+    glm::vec3* luxels;        // Direct light of the luxels of the baked tiles, quantized once the bounces are added.
+    u8* occlusion;            // Ambient occlusion per luxel, null without ambient occlusion.
+};
+
+struct LightmapJob
+{
+    Atlas* atlas;
+    const Level* level;
+    const Surface* surfaces;
+    const s32* surfaceIndices; // Surfaces to bake, all of them when null.
+    const s32* lightStart;     // Offsets into surfaceLights per baked surface, one past the end for the last.
+    const Light* surfaceLights;
+    const LightVisibility* surfaceVisibility; // Parallel to surfaceLights.
+    const s32* surfaceLightIndices;           // Parallel to surfaceLights.
+    LightGrid lightGrid;
+    LightBounce* bounce;                      // Gets the direct light of every patch, null without bounces.
+    f32 ambientLight;
+    b32 coarse;       // One sample per level tile instead of the atlas quality.
+    s32 firstSurface; // Offset of the job range into the baked surfaces.
+
+    s32 count;
+    LightVisibility* visibility; // One per light.
+    s32 lightCount;
+    f64 startTime;
+
+    std::atomic<s64> raysCast;
+    std::atomic<s64> raysSaved;
+    std::atomic<s64> supersampledLuxels;
+};
+
+// Distance in level tiles over which a wall, the floor or the ceiling stops occluding.
+#define LIGHTMAP_OCCLUSION_RADIUS 0.5f
+
+// Occlusion by the closest point of an occluder, fading out with distance. An occluder beside the luxel
+// hides half as much of its hemisphere as one right in front of it, one behind it hides nothing.
+static f32 GetOccluderWeight(glm::vec3 position, glm::vec3 normal, glm::vec3 closest)
+{
+    glm::vec3 delta = closest - position;
+    f32 distance = glm::length(delta);
+    if (distance >= LIGHTMAP_OCCLUSION_RADIUS)
+    {
+        return 0.0f;
+    }
+
+    f32 facing = distance > 0.0001f ? 0.5f + 0.5f * glm::dot(normal, delta / distance) : 0.5f;
+    f32 falloff = 1.0f - distance / LIGHTMAP_OCCLUSION_RADIUS;
+    return falloff * falloff * facing;
+}
+
+// Ambient occlusion of a point on a surface from the walls in the tiles around it and from the floor and ceiling
+// planes, 1 when nothing is close. Tiles outside the level count as walls.
+static f32 GetAmbientOcclusion(const Level* level, glm::vec3 position, glm::vec3 normal, f32 strength)
+{
+    // Step off the surface so the point lies in the open tile in front of it.
+    glm::vec3 p = position + normal * 0.01f;
+    s32 tileX = (s32)glm::floor(p.x);
+    s32 tileY = (s32)glm::floor(p.z);
+
+    f32 occlusion = 0.0f;
+    for (s32 y = tileY - 1; y <= tileY + 1; ++y)
+    {
+        for (s32 x = tileX - 1; x <= tileX + 1; ++x)
+        {
+            if (Level_GetTileAt(level, x, y, Layer_Wall) == 0)
+            {
+                continue;
+            }
+
+            glm::vec3 closest = glm::vec3(glm::clamp(p.x, (f32)x, (f32)(x + 1)), p.y, glm::clamp(p.z, (f32)y, (f32)(y + 1)));
+            occlusion += GetOccluderWeight(p, normal, closest);
+        }
+    }
+    occlusion += GetOccluderWeight(p, normal, glm::vec3(p.x, 0.0f, p.z));
+    occlusion += GetOccluderWeight(p, normal, glm::vec3(p.x, 1.0f, p.z));
+
+    return 1.0f - glm::min(occlusion * strength, 1.0f);
+}
+
+// Occludes the ambient light of every luxel of the tile and stores the occlusion per luxel.
+static void ApplyAmbientOcclusion(HdrImage* image, u8* outOcclusion, const Surface* surface, const Level* level, s32 padding, f32 ambientLight, f32 strength)
+{
+    s32 luxelsPerRow = image->width - padding * 2;
+    s32 luxelsPerCol = image->height - padding * 2;
+    glm::vec3 uAxis = surface->vertices[1] - surface->vertices[0];
+    glm::vec3 vAxis = surface->vertices[3] - surface->vertices[0];
+
+    for (s32 y = 0; y < luxelsPerCol; ++y)
+    {
+        for (s32 x = 0; x < luxelsPerRow; ++x)
+        {
+            glm::vec3 position = surface->vertices[0] + uAxis * (((f32)x + 0.5f) / luxelsPerRow) + vAxis * (((f32)y + 0.5f) / luxelsPerCol);
+            f32 occlusion = GetAmbientOcclusion(level, position, surface->normal, strength);
+
+            image->pixels[(y + padding) * image->width + x + padding] -= glm::vec3(ambientLight * (1.0f - occlusion));
+            outOcclusion[y * luxelsPerRow + x] = (u8)(occlusion * 255.0f + 0.5f);
+        }
+    }
+}
+
+// Stores the average direct light of the luxels of each patch of baked surface j.
+static void LightBounce_StoreDirect(LightBounce* bounce, s32 j, const HdrImage* image, s32 padding, f32 ambientLight)
+{
+    glm::ivec2 grid = bounce->patchGrid[j];
+    s32 luxelsPerRow = image->width - padding * 2;
+    s32 luxelsPerCol = image->height - padding * 2;
+
+    for (s32 py = 0; py < grid.y; ++py)
+    {
+        s32 y0 = py * luxelsPerCol / grid.y;
+        s32 y1 = glm::max((py + 1) * luxelsPerCol / grid.y, y0 + 1);
+        for (s32 px = 0; px < grid.x; ++px)
+        {
+            s32 x0 = px * luxelsPerRow / grid.x;
+            s32 x1 = glm::max((px + 1) * luxelsPerRow / grid.x, x0 + 1);
+
+            glm::vec3 sum = glm::vec3(0.0f);
+            for (s32 y = y0; y < y1; ++y)
+            {
+                for (s32 x = x0; x < x1; ++x)
+                {
+                    sum += image->pixels[(y + padding) * image->width + x + padding];
+                }
+            }
+
+            glm::vec3 direct = sum / (f32)((x1 - x0) * (y1 - y0)) - glm::vec3(ambientLight);
+            bounce->patches[bounce->patchStart[j] + py * grid.x + px].direct = glm::max(direct, glm::vec3(0.0f));
+        }
+    }
+}
+
+// Every surface is baked by exactly one job with all of its lights at once, so its tile
+// is written once and no other job ever touches it.
+static void BakeSurfaceLightmaps(void* userData, s32 begin, s32 end, s32 workerIndex)
+{
+    LightmapJob* job = (LightmapJob*)userData;
+    Atlas* atlas = job->atlas;
+    Arena* scratch = Jobs_GetScratchArena();
+
+    s64 raysCast = 0;
+    s64 raysSaved = 0;
+    s64 supersampledLuxels = 0;
+
+    for (s32 j = job->firstSurface + begin; j < job->firstSurface + end; ++j)
+    {
+        const Surface* surface = &job->surfaces[job->surfaceIndices ? job->surfaceIndices[j] : j];
+        SurfaceLights lights = {};
+        lights.lights = job->surfaceLights + job->lightStart[j];
+        lights.visibility = job->surfaceVisibility + job->lightStart[j];
+        lights.indices = job->surfaceLightIndices + job->lightStart[j];
+        lights.count = job->lightStart[j + 1] - job->lightStart[j];
+        lights.grid = &job->lightGrid;
+
+        AtlasTile tile = surface->lightmapTile;
+        s32 tileWidth = tile.width + atlas->padding * 2;
+        s32 tileHeight = tile.height + atlas->padding * 2;
+
+        u64 scratchOffset = scratch->offset;
+        HdrImage tImage = HdrImage_Create(tileWidth, tileHeight, scratch);
+
+        if (lights.count == 0)
+        {
+            // No light reaches the surface, no need to shade it.
+            HdrImage_Fill(&tImage, glm::vec3(job->ambientLight));
+        }
+        else if (job->coarse)
+        {
+            raysCast += CreateCoarseLightmapForSurface(&tImage, surface, job->level, &lights, job->ambientLight, atlas->padding);
+        }
+        else if (atlas->quality == LightmapQuality_Fast)
+        {
+            s32 rayCount = CreateLightmapForSurface(&tImage, surface, job->level, &lights, job->ambientLight, tile.width, tile.height, atlas->padding);
+            raysCast += rayCount;
+            raysSaved += rayCount * 3;
+        }
+        else if (atlas->quality == LightmapQuality_Adaptive)
+        {
+            s32 baseRayCount, supersampledCount;
+            s32 rayCount = CreateAdaptiveLightmapForSurface(&tImage, surface, job->level, &lights, job->ambientLight, tile.width, tile.height, atlas->padding,
+                &baseRayCount, &supersampledCount);
+            raysCast += rayCount;
+            raysSaved += baseRayCount * 4 - rayCount;
+            supersampledLuxels += supersampledCount;
+        }
+        else
+        {
+            HdrImage tImage2 = HdrImage_Create(tileWidth * 2, tileHeight * 2, scratch);
+
+            s32 luxelsPerRow = tile.width * 2;
+            s32 luxelsPerCol = tile.height * 2;
+            s32 lightmapPadding = atlas->padding * 2;
+
+            raysCast += CreateLightmapForSurface(&tImage2, surface, job->level, &lights, job->ambientLight, luxelsPerRow, luxelsPerCol, lightmapPadding);
+            HdrImage_Downsample2x(&tImage, &tImage2);
+            supersampledLuxels += tImage.width * tImage.height;
+        }
+
+        LightBounce* bounce = job->coarse ? 0 : job->bounce;
+        if (bounce)
+        {
+            LightBounce_StoreDirect(bounce, j, &tImage, atlas->padding, job->ambientLight);
+        }
+
+        u8* occlusion = 0;
+        if (atlas->occlusionStrength > 0.0f)
+        {
+            occlusion = bounce ? bounce->occlusion + bounce->luxelStart[j] : ArenaPushArray(scratch, u8, tile.width * tile.height);
+            Platform_Assert(occlusion, "Scratch arena is full.");
+            ApplyAmbientOcclusion(&tImage, occlusion, surface, job->level, atlas->padding, job->ambientLight, atlas->occlusionStrength);
+        }
+
+        if (bounce)
+        {
+            // Kept in float until the bounces are added, ApplyBounceLight quantizes the tile.
+            glm::vec3* luxels = bounce->luxels + bounce->luxelStart[j];
+            for (s32 y = 0; y < tile.height; ++y)
+            {
+                memcpy(luxels + y * tile.width, tImage.pixels + (y + atlas->padding) * tImage.width + atlas->padding, sizeof(glm::vec3) * tile.width);
+            }
+            scratch->offset = scratchOffset;
+            continue;
+        }
+
+        // Light is summed in float until here, the tile is quantized once straight into the atlas.
+        Image* page = &atlas->pages[tile.page].image;
+        Image_QuantizeHdr(page, tile.x, tile.y, &tImage, atlas->padding, atlas->padding, tile.width, tile.height, occlusion);
+        Image_DilateRect(page, tile.x, tile.y, tile.width, tile.height, atlas->padding);
+
+        scratch->offset = scratchOffset;
+    }
+
+    job->raysCast += raysCast;
+    job->raysSaved += raysSaved;
+    job->supersampledLuxels += supersampledLuxels;
+}
+
+// Surfaces bucketed by the level tiles their luxels cover, so a light only visits the surfaces near it.
+struct SurfaceGrid
+{
+    s32 minX; // Level tile of the first cell, the grid only covers the tiles of the baked surfaces.
+    s32 minY;
+    s32 width;
+    s32 height;
+    s32* cellStart; // Offsets into entries per cell, one past the end for the last.
+    s32* entries;   // Indices into the list of baked surfaces.
+};
+
+static void GetGridCellRange(const SurfaceGrid* grid, f32 minX, f32 minY, f32 maxX, f32 maxY, glm::ivec2* outMin, glm::ivec2* outMax)
+{
+    outMin->x = glm::clamp((s32)glm::floor(minX) - grid->minX, 0, grid->width - 1);
+    outMin->y = glm::clamp((s32)glm::floor(minY) - grid->minY, 0, grid->height - 1);
+    outMax->x = glm::clamp((s32)glm::floor(maxX) - grid->minX, 0, grid->width - 1);
+    outMax->y = glm::clamp((s32)glm::floor(maxY) - grid->minY, 0, grid->height - 1);
+}
+
+// Returns the bounds of the luxels of a surface including its padding, which is placed past the surface edges.
+static Box3 GetSurfaceLuxelBounds(const Atlas* atlas, const Surface* surface)
+{
+    const AtlasTile* tile = &surface->lightmapTile;
+    f32 margin = (f32)atlas->padding * glm::max(surface->size.x / (f32)tile->width, surface->size.y / (f32)tile->height);
+
+    Box3 bounds = CreateBox3(surface->vertices[0], surface->vertices[0]);
+    for (s32 j = 1; j < 4; ++j)
+    {
+        bounds.min = glm::min(bounds.min, surface->vertices[j]);
+        bounds.max = glm::max(bounds.max, surface->vertices[j]);
+    }
+    bounds.min -= glm::vec3(margin);
+    bounds.max += glm::vec3(margin);
+    return bounds;
+}
+
+// Returns the level tiles the luxels of the baked surfaces lie in, clamped to the level. The bake grids only cover
+// these, so a small rebake does not pay for the whole level.
+static LevelRegion GetBakeRegion(const Atlas* atlas, const Level* level, const Surface* surfaces, const s32* surfaceIndices, s32 count)
+{
+    LevelRegion region = { 0, 0, 0, 0 };
+    for (s32 i = 0; i < count; ++i)
+    {
+        Box3 bounds = GetSurfaceLuxelBounds(atlas, &surfaces[surfaceIndices ? surfaceIndices[i] : i]);
+        s32 minX = glm::clamp((s32)glm::floor(bounds.min.x), 0, glm::max(level->width - 1, 0));
+        s32 minY = glm::clamp((s32)glm::floor(bounds.min.z), 0, glm::max(level->height - 1, 0));
+        s32 maxX = glm::clamp((s32)glm::floor(bounds.max.x), 0, glm::max(level->width - 1, 0));
+        s32 maxY = glm::clamp((s32)glm::floor(bounds.max.z), 0, glm::max(level->height - 1, 0));
+        if (i == 0)
+        {
+            region = { minX, minY, maxX, maxY };
+        }
+        else
+        {
+            region.minX = glm::min(region.minX, minX);
+            region.minY = glm::min(region.minY, minY);
+            region.maxX = glm::max(region.maxX, maxX);
+            region.maxY = glm::max(region.maxY, maxY);
+        }
+    }
+    return region;
+}
+
+// Returns true if the square around a light that holds its range overlaps the region.
+static b32 IsLightNearRegion(const Light* light, const LevelRegion* region)
+{
+    return light->position.x + light->range >= (f32)region->minX && light->position.x - light->range < (f32)(region->maxX + 1) &&
+           light->position.z + light->range >= (f32)region->minY && light->position.z - light->range < (f32)(region->maxY + 1);
+}
+
+static SurfaceGrid CreateSurfaceGrid(const LevelRegion* region, const Box3* bounds, s32 count)
+{
+    SurfaceGrid grid = {};
+    grid.minX = region->minX;
+    grid.minY = region->minY;
+    grid.width = region->maxX - region->minX + 1;
+    grid.height = region->maxY - region->minY + 1;
+
+    s32 cellCount = grid.width * grid.height;
+    grid.cellStart = (s32*)Platform_Alloc(sizeof(s32) * (cellCount + 1));
+    Platform_ClearMemory(grid.cellStart, sizeof(s32) * (cellCount + 1));
+
+    // Count the entries per cell, turn the counts into end offsets, then fill each cell back to front.
+    for (s32 pass = 0; pass < 2; ++pass)
+    {
+        for (s32 i = 0; i < count; ++i)
+        {
+            glm::ivec2 cellMin, cellMax;
+            GetGridCellRange(&grid, bounds[i].min.x, bounds[i].min.z, bounds[i].max.x, bounds[i].max.z, &cellMin, &cellMax);
+
+            for (s32 y = cellMin.y; y <= cellMax.y; ++y)
+            {
+                for (s32 x = cellMin.x; x <= cellMax.x; ++x)
+                {
+                    s32 cell = y * grid.width + x;
+                    if (pass == 0) grid.cellStart[cell]++;
+                    else grid.entries[--grid.cellStart[cell]] = i;
+                }
+            }
+        }
+
+        if (pass == 0)
+        {
+            for (s32 cell = 1; cell <= cellCount; ++cell)
+            {
+                grid.cellStart[cell] += grid.cellStart[cell - 1];
+            }
+            grid.entries = (s32*)Platform_Alloc(sizeof(s32) * glm::max(grid.cellStart[cellCount], 1));
+        }
+    }
+
+    return grid;
+}
+
+static void DestroySurfaceGrid(SurfaceGrid* grid)
+{
+    Platform_Free(grid->cellStart);
+    Platform_Free(grid->entries);
+}
+
+// Gathers the lights that can reach each baked surface: the luxels must be within the light range and the light
+// must not lie behind the surface, lights in its plane still reach it. Lights keep their order so the shading sums
+// the same way.
+static void AssignSurfaceLights(const Atlas* atlas, const LevelRegion* region, const Surface* surfaces, const s32* surfaceIndices, s32 count,
+    const Light* lights, s32 lightCount, s32** outLightStart, Light** outSurfaceLights, s32** outSurfaceLightIndices)
+{
+    Box3* bounds = (Box3*)Platform_Alloc(sizeof(Box3) * glm::max(count, 1));
+    for (s32 i = 0; i < count; ++i)
+    {
+        bounds[i] = GetSurfaceLuxelBounds(atlas, &surfaces[surfaceIndices ? surfaceIndices[i] : i]);
+    }
+
+    SurfaceGrid grid = CreateSurfaceGrid(region, bounds, count);
+
+    s32* lightStart = (s32*)Platform_Alloc(sizeof(s32) * (count + 1));
+    Platform_ClearMemory(lightStart, sizeof(s32) * (count + 1));
+    s32* visitedBy = (s32*)Platform_Alloc(sizeof(s32) * glm::max(count, 1));
+    Light* surfaceLights = 0;
+    s32* surfaceLightIndices = 0;
+
+    // Count the lights per surface, then fill them in the same order.
+    for (s32 pass = 0; pass < 2; ++pass)
+    {
+        for (s32 i = 0; i < count; ++i) visitedBy[i] = -1;
+
+        for (s32 l = 0; l < lightCount; ++l)
+        {
+            const Light* light = &lights[l];
+            if (!IsLightNearRegion(light, region))
+            {
+                continue;
+            }
+
+            glm::ivec2 cellMin, cellMax;
+            GetGridCellRange(&grid, light->position.x - light->range, light->position.z - light->range,
+                light->position.x + light->range, light->position.z + light->range, &cellMin, &cellMax);
+
+            for (s32 y = cellMin.y; y <= cellMax.y; ++y)
+            {
+                for (s32 x = cellMin.x; x <= cellMax.x; ++x)
+                {
+                    s32 cell = y * grid.width + x;
+                    for (s32 e = grid.cellStart[cell]; e < grid.cellStart[cell + 1]; ++e)
+                    {
+                        s32 i = grid.entries[e];
+                        if (visitedBy[i] == l)
+                        {
+                            continue;
+                        }
+                        visitedBy[i] = l;
+
+                        const Surface* surface = &surfaces[surfaceIndices ? surfaceIndices[i] : i];
+                        if (glm::dot(surface->normal, light->position - surface->vertices[0]) < 0.0f ||
+                            !Box3_SphereIntersect(&bounds[i], light->position, light->range))
+                        {
+                            continue;
+                        }
+
+                        if (pass == 0)
+                        {
+                            lightStart[i + 1]++;
+                        }
+                        else
+                        {
+                            surfaceLightIndices[lightStart[i]] = l;
+                            surfaceLights[lightStart[i]++] = *light;
+                        }
+                    }
+                }
+            }
+        }
+
+        if (pass == 0)
+        {
+            for (s32 i = 1; i <= count; ++i)
+            {
+                lightStart[i] += lightStart[i - 1];
+            }
+            surfaceLights = (Light*)Platform_Alloc(sizeof(Light) * glm::max(lightStart[count], 1));
+            surfaceLightIndices = (s32*)Platform_Alloc(sizeof(s32) * glm::max(lightStart[count], 1));
+        }
+        else
+        {
+            // Filling advanced every offset to the start of the next surface.
+            for (s32 i = count; i > 0; --i)
+            {
+                lightStart[i] = lightStart[i - 1];
+            }
+            lightStart[0] = 0;
+        }
+    }
+
+    Platform_Free(visitedBy);
+    DestroySurfaceGrid(&grid);
+    Platform_Free(bounds);
+
+    *outLightStart = lightStart;
+    *outSurfaceLights = surfaceLights;
+    *outSurfaceLightIndices = surfaceLightIndices;
+}
+
+// Slack on the light range, so luxels that round onto the edge of a tile still find every light of it.
+#define LIGHT_GRID_MARGIN 0.001f
+
+// Buckets the lights marked as used per tile of the region.
+static LightGrid CreateLightGrid(const LevelRegion* region, const Light* lights, const b32* usedLights, s32 lightCount)
+{
+    LightGrid grid = {};
+    grid.minX = region->minX;
+    grid.minY = region->minY;
+    grid.width = region->maxX - region->minX + 1;
+    grid.height = region->maxY - region->minY + 1;
+
+    s32 cellCount = grid.width * grid.height;
+    grid.cellStart = (s32*)Platform_Alloc(sizeof(s32) * (cellCount + 1));
+    Platform_ClearMemory(grid.cellStart, sizeof(s32) * (cellCount + 1));
+
+    // Count the lights per cell, turn the counts into end offsets, then fill each cell back to front
+    // from the last light on, which leaves the lights of a cell in ascending order.
+    for (s32 pass = 0; pass < 2; ++pass)
+    {
+        for (s32 l = lightCount - 1; l >= 0; --l)
+        {
+            const Light* light = &lights[l];
+            if (!usedLights[l])
+            {
+                continue;
+            }
+
+            f32 range = light->range + LIGHT_GRID_MARGIN;
+            s32 minX = glm::clamp((s32)glm::floor(light->position.x - range), region->minX, region->maxX);
+            s32 minY = glm::clamp((s32)glm::floor(light->position.z - range), region->minY, region->maxY);
+            s32 maxX = glm::clamp((s32)glm::floor(light->position.x + range), region->minX, region->maxX);
+            s32 maxY = glm::clamp((s32)glm::floor(light->position.z + range), region->minY, region->maxY);
+
+            for (s32 y = minY; y <= maxY; ++y)
+            {
+                for (s32 x = minX; x <= maxX; ++x)
+                {
+                    // Distance from the light to the closest point of the tile.
+                    f32 dx = glm::max(glm::max((f32)x - light->position.x, light->position.x - (f32)(x + 1)), 0.0f);
+                    f32 dz = glm::max(glm::max((f32)y - light->position.z, light->position.z - (f32)(y + 1)), 0.0f);
+                    if (dx * dx + dz * dz > range * range)
+                    {
+                        continue;
+                    }
+
+                    s32 cell = (y - grid.minY) * grid.width + (x - grid.minX);
+                    if (pass == 0) grid.cellStart[cell]++;
+                    else grid.entries[--grid.cellStart[cell]] = l;
+                }
+            }
+        }
+
+        if (pass == 0)
+        {
+            for (s32 cell = 1; cell <= cellCount; ++cell)
+            {
+                grid.cellStart[cell] += grid.cellStart[cell - 1];
+            }
+            grid.entries = (s32*)Platform_Alloc(sizeof(s32) * glm::max(grid.cellStart[cellCount], 1));
+        }
+    }
+
+    return grid;
+}
+
+static void DestroyLightGrid(LightGrid* grid)
+{
+    Platform_Free(grid->cellStart);
+    Platform_Free(grid->entries);
+}
+
+struct LightVisibilityJob
+{
+    const Level* level;
+    const Light* lights;
+    const s32* lightIndices; // Lights to compute the visibility of, all of them when null.
+    LightVisibility* visibility;
+};
+
+static void ComputeLightVisibilities(void* userData, s32 begin, s32 end, s32 workerIndex)
+{
+    const LightVisibilityJob* job = (const LightVisibilityJob*)userData;
+    for (s32 i = begin; i < end; ++i)
+    {
+        s32 light = job->lightIndices ? job->lightIndices[i] : i;
+        LightVisibility_Compute(&job->visibility[light], job->level, &job->lights[light]);
+    }
+}
+
+// Returns the most scratch memory a job baking one of the surfaces pushes: the float tile, the tile at twice the
+// resolution for Full quality, the supersample flags, the ambient occlusion and the lights of the surface shader.
+static u64 GetBakeScratchSize(const Atlas* atlas, const Surface* surfaces, const s32* surfaceIndices, s32 count, s32 lightCount)
+{
+    u64 maxLuxelCount = 0;
+    u64 maxWidth = 0;
+    for (s32 j = 0; j < count; ++j)
+    {
+        glm::ivec2 size = GetSurfaceTileSize(atlas, &surfaces[surfaceIndices ? surfaceIndices[j] : j]);
+        u64 width = (u64)(size.x + atlas->padding * 2);
+        u64 height = (u64)(size.y + atlas->padding * 2);
+        maxLuxelCount = glm::max(maxLuxelCount, width * height);
+        maxWidth = glm::max(maxWidth, width);
+    }
+
+    u64 lightSize = sizeof(s32) * 2 + sizeof(Light) + sizeof(LightVisibility);
+    return maxLuxelCount * (sizeof(glm::vec3) * 5 + 2) + maxWidth * 4 * sizeof(glm::vec3) + (u64)glm::max(lightCount, 1) * lightSize +
+           16 * MEMORY_DEFAULT_ALIGNMENT;
+}
+
+// Gathers the lights of every surface to bake, computes the visibility of the lights that reach any of them and
+// buckets those lights per level tile. Lights that reach none of the surfaces cost nothing, so small rebakes are cheap.
+static void LightmapJob_Begin(LightmapJob* job, Atlas* atlas, const Level* level, const Surface* surfaces, const s32* surfaceIndices, s32 count, const Light* lights, s32 lightCount)
+{
+    job->startTime = Platform_GetTime();
+    job->atlas = atlas;
+    job->level = level;
+    job->surfaces = surfaces;
+    job->surfaceIndices = surfaceIndices;
+    job->count = count;
+    job->lightCount = lightCount;
+    job->ambientLight = LIGHTMAP_AMBIENT_LIGHT;
+
+    // Large tiles at high quality need more than the default scratch arena.
+    Jobs_ReserveScratchArena(GetBakeScratchSize(atlas, surfaces, surfaceIndices, count, lightCount));
+
+    LevelRegion region = GetBakeRegion(atlas, level, surfaces, surfaceIndices, count);
+
+    s32* lightStart;
+    Light* surfaceLights;
+    s32* surfaceLightIndices;
+    AssignSurfaceLights(atlas, &region, surfaces, surfaceIndices, count, lights, lightCount, &lightStart, &surfaceLights, &surfaceLightIndices);
+
+    b32* usedLights = (b32*)Platform_Alloc(sizeof(b32) * glm::max(lightCount, 1));
+    Platform_ClearMemory(usedLights, sizeof(b32) * glm::max(lightCount, 1));
+    for (s32 i = 0; i < lightStart[count]; ++i)
+    {
+        usedLights[surfaceLightIndices[i]] = true;
+    }
+
+    s32* usedLightIndices = (s32*)Platform_Alloc(sizeof(s32) * glm::max(lightCount, 1));
+    s32 usedLightCount = 0;
+    for (s32 l = 0; l < lightCount; ++l)
+    {
+        if (usedLights[l])
+        {
+            usedLightIndices[usedLightCount++] = l;
+        }
+    }
+
+    // Tile visibility per light, so most luxels skip their shadow rays.
+    job->visibility = (LightVisibility*)Platform_Alloc(sizeof(LightVisibility) * glm::max(lightCount, 1));
+    Platform_ClearMemory(job->visibility, sizeof(LightVisibility) * glm::max(lightCount, 1));
+    LightVisibilityJob visibilityJob = {};
+    visibilityJob.level = level;
+    visibilityJob.lights = lights;
+    visibilityJob.lightIndices = usedLightIndices;
+    visibilityJob.visibility = job->visibility;
+    Jobs_ParallelFor(usedLightCount, 1, ComputeLightVisibilities, &visibilityJob);
+
+    LightVisibility* surfaceVisibility = (LightVisibility*)Platform_Alloc(sizeof(LightVisibility) * glm::max(lightStart[count], 1));
+    for (s32 i = 0; i < lightStart[count]; ++i)
+    {
+        surfaceVisibility[i] = job->visibility[surfaceLightIndices[i]];
+    }
+
+    job->lightStart = lightStart;
+    job->surfaceLights = surfaceLights;
+    job->surfaceVisibility = surfaceVisibility;
+    job->surfaceLightIndices = surfaceLightIndices;
+    job->lightGrid = CreateLightGrid(&region, lights, usedLights, lightCount);
+
+    Platform_Free(usedLightIndices);
+    Platform_Free(usedLights);
+}
+
+// Stores the counts of the bake in the atlas stats, logs them and starts counting again.
+static void LightmapJob_RecordStats(LightmapJob* job, const char* pass)
+{
+    Atlas* atlas = job->atlas;
+    atlas->stats.surfaceCount = job->count;
+    atlas->stats.raysCast = job->raysCast.exchange(0);
+    atlas->stats.raysSaved = job->raysSaved.exchange(0);
+    atlas->stats.supersampledLuxels = job->supersampledLuxels.exchange(0);
+    atlas->stats.seconds = Platform_GetTime() - job->startTime;
+    Platform_LogInfo("Baked %d lightmap surfaces%s in %.3fs: %lld shadow rays, %lld saved, %lld luxels supersampled\n", job->count, pass, atlas->stats.seconds,
+        (long long)atlas->stats.raysCast, (long long)atlas->stats.raysSaved, (long long)atlas->stats.supersampledLuxels);
+}
+
+static void LightmapJob_End(LightmapJob* job)
+{
+    Platform_Free((void*)job->lightStart);
+    Platform_Free((void*)job->surfaceLights);
+    Platform_Free((void*)job->surfaceVisibility);
+    Platform_Free((void*)job->surfaceLightIndices);
+    DestroyLightGrid(&job->lightGrid);
+
+    for (s32 i = 0; i < job->lightCount; ++i)
+    {
+        LightVisibility_Destroy(&job->visibility[i]);
+    }
+    Platform_Free(job->visibility);
+}
+
+// Fraction of the light a patch sends on. The level has no material data, so every surface is a mid grey.
+#define LIGHTMAP_BOUNCE_ALBEDO 0.5f
+
+// A node sends as a whole once its size is below this fraction of its distance, roughly the angle it spans.
+#define LIGHTMAP_BOUNCE_OPENING 0.5f
+
+#define MAX_BOUNCE_STACK 256
+
+#define LIGHTMAP_PI 3.14159265f
+
+static glm::ivec2 GetSurfacePatchGrid(const Surface* surface)
+{
+    return glm::ivec2(glm::max((s32)(surface->size.x + 0.5f), 1), glm::max((s32)(surface->size.y + 0.5f), 1));
+}
+
+// Surfaces are axis aligned, so their normal is one of six facings.
+static s32 GetFacing(glm::vec3 normal)
+{
+    glm::vec3 a = glm::abs(normal);
+    s32 axis = a.x >= a.y && a.x >= a.z ? 0 : (a.y >= a.z ? 1 : 2);
+    return axis * 2 + (normal[axis] < 0.0f ? 1 : 0);
+}
+
+static u32 SpreadBits(u32 value)
+{
+    value &= 0xFFFF;
+    value = (value | (value << 8)) & 0x00FF00FF;
+    value = (value | (value << 4)) & 0x0F0F0F0F;
+    value = (value | (value << 2)) & 0x33333333;
+    value = (value | (value << 1)) & 0x55555555;
+    return value;
+}
+
+struct BounceKey
+{
+    s32 facing;
+    u32 code; // Morton code of the level tile in front of the patch.
+    s32 patch;
+};
+
+// Builds the node of keys [begin, end), which share the bits of their codes above the given level.
+static void BuildBounceNode(LightBounce* bounce, const BounceKey* keys, s32 nodeIndex, s32 begin, s32 end, s32 level)
+{
+    BounceNode* node = &bounce->nodes[nodeIndex];
+    node->patch = -1;
+
+    if (end - begin == 1)
+    {
+        const BouncePatch* patch = &bounce->patches[keys[begin].patch];
+        node->position = patch->position;
+        node->normal = patch->normal;
+        node->area = patch->area;
+        node->size = 1.0f;
+        node->patch = keys[begin].patch;
+        return;
+    }
+
+    // Skip the levels where every code of the range agrees, they would only add nodes with one child.
+    while (level >= 0 && ((keys[begin].code >> (level * 2)) & 3) == ((keys[end - 1].code >> (level * 2)) & 3))
+    {
+        --level;
+    }
+
+    s32 childBegin[5];
+    s32 childCount = 0;
+    if (level < 0)
+    {
+        // Several patches in front of the same tile, each becomes a leaf.
+        for (s32 i = begin; i < end && childCount < 4; ++i) childBegin[childCount++] = i;
+        childBegin[childCount] = end;
+        Platform_Assert(end - begin <= 4, "Too many bounce patches in one tile.");
+    }
+    else
+    {
+        for (s32 i = begin; i < end; ++i)
+        {
+            if (i == begin || ((keys[i].code >> (level * 2)) & 3) != ((keys[i - 1].code >> (level * 2)) & 3))
+            {
+                childBegin[childCount++] = i;
+            }
+        }
+        childBegin[childCount] = end;
+    }
+
+    s32 firstChild = bounce->nodeCount;
+    bounce->nodeCount += childCount;
+    node->firstChild = firstChild;
+    node->childCount = childCount;
+    node->size = (f32)(1 << (glm::max(level, 0) + 1));
+
+    glm::vec3 weightedPosition = glm::vec3(0.0f);
+    f32 area = 0.0f;
+    for (s32 i = 0; i < childCount; ++i)
+    {
+        BuildBounceNode(bounce, keys, firstChild + i, childBegin[i], childBegin[i + 1], level - 1);
+        const BounceNode* child = &bounce->nodes[firstChild + i];
+        weightedPosition += child->position * child->area;
+        area += child->area;
+    }
+
+    node->position = weightedPosition / area;
+    node->normal = bounce->nodes[firstChild].normal;
+    node->area = area;
+}
+
+// Lays out the patches and luxels of the surfaces to bake. Their direct light is stored while the tiles are baked.
+static void LightBounce_Init(LightBounce* bounce, const Atlas* atlas, const Surface* surfaces, const s32* surfaceIndices, s32 count)
+{
+    *bounce = {};
+    bounce->surfaceCount = count;
+    bounce->patchStart = (s32*)Platform_Alloc(sizeof(s32) * (count + 1));
+    bounce->patchGrid = (glm::ivec2*)Platform_Alloc(sizeof(glm::ivec2) * glm::max(count, 1));
+    bounce->luxelStart = (s64*)Platform_Alloc(sizeof(s64) * (count + 1));
+
+    bounce->patchStart[0] = 0;
+    bounce->luxelStart[0] = 0;
+    for (s32 j = 0; j < count; ++j)
+    {
+        const Surface* surface = &surfaces[surfaceIndices ? surfaceIndices[j] : j];
+        bounce->patchGrid[j] = GetSurfacePatchGrid(surface);
+        bounce->patchStart[j + 1] = bounce->patchStart[j] + bounce->patchGrid[j].x * bounce->patchGrid[j].y;
+        bounce->luxelStart[j + 1] = bounce->luxelStart[j] + (s64)surface->lightmapTile.width * surface->lightmapTile.height;
+    }
+    bounce->patchCount = bounce->patchStart[count];
+
+    s64 luxelCount = glm::max(bounce->luxelStart[count], (s64)1);
+    bounce->luxels = (glm::vec3*)Platform_Alloc(sizeof(glm::vec3) * luxelCount);
+    if (atlas->occlusionStrength > 0.0f)
+    {
+        bounce->occlusion = (u8*)Platform_Alloc(sizeof(u8) * luxelCount);
+    }
+
+    bounce->patches = (BouncePatch*)Platform_Alloc(sizeof(BouncePatch) * glm::max(bounce->patchCount, 1));
+    bounce->gathered = (glm::vec3*)Platform_Alloc(sizeof(glm::vec3) * glm::max(bounce->patchCount, 1));
+    for (s32 j = 0; j < count; ++j)
+    {
+        const Surface* surface = &surfaces[surfaceIndices ? surfaceIndices[j] : j];
+        glm::ivec2 grid = bounce->patchGrid[j];
+        glm::vec3 uAxis = surface->vertices[1] - surface->vertices[0];
+        glm::vec3 vAxis = surface->vertices[3] - surface->vertices[0];
+        f32 area = glm::length(uAxis) * glm::length(vAxis) / (f32)(grid.x * grid.y);
+
+        for (s32 py = 0; py < grid.y; ++py)
+        {
+            for (s32 px = 0; px < grid.x; ++px)
+            {
+                BouncePatch* patch = &bounce->patches[bounce->patchStart[j] + py * grid.x + px];
+                *patch = {};
+                patch->position = surface->vertices[0] + uAxis * (((f32)px + 0.5f) / grid.x) + vAxis * (((f32)py + 0.5f) / grid.y);
+                patch->normal = surface->normal;
+                patch->area = area;
+            }
+        }
+    }
+}
+
+static void LightBounce_Destroy(LightBounce* bounce)
+{
+    Platform_Free(bounce->patchStart);
+    Platform_Free(bounce->patchGrid);
+    Platform_Free(bounce->patches);
+    Platform_Free(bounce->gathered);
+    Platform_Free(bounce->nodes);
+    Platform_Free(bounce->luxelStart);
+    Platform_Free(bounce->luxels);
+    Platform_Free(bounce->occlusion);
+}
+
+// Sorts the patches by facing and then along a Morton curve over the level tiles, and builds a quadtree per facing.
+static void LightBounce_BuildTrees(LightBounce* bounce)
+{
+    BounceKey* keys = (BounceKey*)Platform_Alloc(sizeof(BounceKey) * glm::max(bounce->patchCount, 1));
+    for (s32 i = 0; i < bounce->patchCount; ++i)
+    {
+        const BouncePatch* patch = &bounce->patches[i];
+        glm::vec3 front = patch->position + patch->normal * 0.5f;
+        keys[i].facing = GetFacing(patch->normal);
+        keys[i].code = SpreadBits((u32)glm::max((s32)glm::floor(front.x), 0)) | (SpreadBits((u32)glm::max((s32)glm::floor(front.z), 0)) << 1);
+        keys[i].patch = i;
+    }
+    std::sort(keys, keys + bounce->patchCount, [](const BounceKey& a, const BounceKey& b)
+    {
+        return a.facing != b.facing ? a.facing < b.facing : (a.code != b.code ? a.code < b.code : a.patch < b.patch);
+    });
+
+    // Every inner node has at least two children, so there are fewer nodes than twice the patches.
+    bounce->nodes = (BounceNode*)Platform_Alloc(sizeof(BounceNode) * glm::max(bounce->patchCount * 2, 1));
+    bounce->nodeCount = 0;
+    for (s32 facing = 0, begin = 0; facing < 6; ++facing)
+    {
+        s32 end = begin;
+        while (end < bounce->patchCount && keys[end].facing == facing) ++end;
+
+        bounce->roots[facing] = -1;
+        if (end > begin)
+        {
+            bounce->roots[facing] = bounce->nodeCount++;
+            BuildBounceNode(bounce, keys, bounce->roots[facing], begin, end, 15);
+        }
+        begin = end;
+    }
+
+    Platform_Free(keys);
+}
+
+// Sums the power of the children into every node. Children always come after their parent.
+static void LightBounce_UpdatePower(LightBounce* bounce)
+{
+    for (s32 i = 0; i < bounce->patchCount; ++i)
+    {
+        const BouncePatch* patch = &bounce->patches[i];
+        bounce->gathered[i] = (patch->direct + patch->indirect) * LIGHTMAP_BOUNCE_ALBEDO * patch->area;
+    }
+
+    for (s32 i = bounce->nodeCount - 1; i >= 0; --i)
+    {
+        BounceNode* node = &bounce->nodes[i];
+        if (node->patch >= 0)
+        {
+            node->power = bounce->gathered[node->patch];
+            continue;
+        }
+
+        node->power = glm::vec3(0.0f);
+        for (s32 c = 0; c < node->childCount; ++c)
+        {
+            node->power += bounce->nodes[node->firstChild + c].power;
+        }
+    }
+}
+
+static b32 IsPatchVisible(const Level* level, glm::vec3 from, glm::vec3 fromNormal, glm::vec3 to, glm::vec3 toNormal)
+{
+    // Step off both surfaces so the ray starts and ends in front of the walls.
+    glm::vec3 start = from + fromNormal * 0.01f;
+    glm::vec3 target = to + toNormal * 0.01f;
+    glm::vec2 delta = glm::vec2(target.x - start.x, target.z - start.z);
+    f32 distance = glm::length(delta);
+    if (distance < 0.001f)
+    {
+        return true;
+    }
+
+    RayCastHit hit = {};
+    if (!Level_CastRay(level, glm::vec2(start.x, start.z), delta / distance, &hit, distance + 1.0f))
+    {
+        return true;
+    }
+    return hit.distance + 0.02f > distance;
+}
+
+struct BounceJob
+{
+    LightBounce* bounce;
+    const Level* level;
+};
+
+static void GatherBounceLight(void* userData, s32 begin, s32 end, s32 workerIndex)
+{
+    BounceJob* job = (BounceJob*)userData;
+    LightBounce* bounce = job->bounce;
+
+    s32 stack[MAX_BOUNCE_STACK];
+    for (s32 i = begin; i < end; ++i)
+    {
+        const BouncePatch* receiver = &bounce->patches[i];
+        glm::vec3 gathered = glm::vec3(0.0f);
+
+        s32 stackSize = 0;
+        for (s32 facing = 0; facing < 6; ++facing)
+        {
+            if (bounce->roots[facing] >= 0) stack[stackSize++] = bounce->roots[facing];
+        }
+
+        while (stackSize > 0)
+        {
+            const BounceNode* node = &bounce->nodes[stack[--stackSize]];
+            if (node->patch == i)
+            {
+                continue;
+            }
+
+            glm::vec3 delta = node->position - receiver->position;
+            f32 distanceSquared = glm::dot(delta, delta);
+            f32 distance = glm::sqrt(distanceSquared);
+
+            if (node->patch < 0 && node->size >= LIGHTMAP_BOUNCE_OPENING * distance)
+            {
+                Platform_Assert(stackSize + node->childCount <= MAX_BOUNCE_STACK, "Bounce stack overflow.");
+                for (s32 c = 0; c < node->childCount; ++c)
+                {
+                    stack[stackSize++] = node->firstChild + c;
                 }
-                
+                continue;
+            }
+
+            // Form factor of a disc of the node area seen from the receiver.
+            glm::vec3 direction = delta / glm::max(distance, 0.0001f);
+            f32 receiverCos = glm::dot(receiver->normal, direction);
+            f32 senderCos = -glm::dot(node->normal, direction);
+            if (receiverCos <= 0.0f || senderCos <= 0.0f)
+            {
+                continue;
+            }
+
+            if (!IsPatchVisible(job->level, receiver->position, receiver->normal, node->position, node->normal))
+            {
+                continue;
+            }
+
+            f32 formFactor = receiverCos * senderCos / (LIGHTMAP_PI * distanceSquared + node->area);
+            gathered += node->power * formFactor;
+        }
+
+        bounce->gathered[i] = gathered;
+    }
+}
+
+struct BounceApplyJob
+{
+    const LightBounce* bounce;
+    Atlas* atlas;
+    const Surface* surfaces;
+    const s32* surfaceIndices;
+};
+
+// Adds the indirect light of the patches to the direct light of each tile, interpolated between the patch centers,
+// and quantizes the tile into the atlas.
+static void ApplyBounceLight(void* userData, s32 begin, s32 end, s32 workerIndex)
+{
+    BounceApplyJob* job = (BounceApplyJob*)userData;
+    const LightBounce* bounce = job->bounce;
+    Atlas* atlas = job->atlas;
+    Arena* scratch = Jobs_GetScratchArena();
+
+    for (s32 j = begin; j < end; ++j)
+    {
+        const Surface* surface = &job->surfaces[job->surfaceIndices ? job->surfaceIndices[j] : j];
+        AtlasTile tile = surface->lightmapTile;
+        glm::ivec2 grid = bounce->patchGrid[j];
+        const BouncePatch* patches = bounce->patches + bounce->patchStart[j];
+        Image* page = &atlas->pages[tile.page].image;
+
+        u64 scratchOffset = scratch->offset;
+        HdrImage luxels = HdrImage_Create(tile.width, tile.height, scratch);
+        const glm::vec3* direct = bounce->luxels + bounce->luxelStart[j];
+        const u8* occlusion = bounce->occlusion ? bounce->occlusion + bounce->luxelStart[j] : 0;
+
+        for (s32 y = 0; y < tile.height; ++y)
+        {
+            f32 fy = glm::clamp(((f32)y + 0.5f) * grid.y / tile.height - 0.5f, 0.0f, (f32)(grid.y - 1));
+            s32 y0 = (s32)fy;
+            s32 y1 = glm::min(y0 + 1, grid.y - 1);
+            f32 ty = fy - (f32)y0;
+
+            for (s32 x = 0; x < tile.width; ++x)
+            {
+                f32 fx = glm::clamp(((f32)x + 0.5f) * grid.x / tile.width - 0.5f, 0.0f, (f32)(grid.x - 1));
+                s32 x0 = (s32)fx;
+                s32 x1 = glm::min(x0 + 1, grid.x - 1);
+                f32 tx = fx - (f32)x0;
+
+                glm::vec3 top = glm::mix(patches[y0 * grid.x + x0].indirect, patches[y0 * grid.x + x1].indirect, tx);
+                glm::vec3 bottom = glm::mix(patches[y1 * grid.x + x0].indirect, patches[y1 * grid.x + x1].indirect, tx);
+
+                luxels.pixels[y * tile.width + x] = direct[y * tile.width + x] + glm::mix(top, bottom, ty);
+            }
+        }
+
+        Image_QuantizeHdr(page, tile.x, tile.y, &luxels, 0, 0, tile.width, tile.height, occlusion);
+        Image_DilateRect(page, tile.x, tile.y, tile.width, tile.height, atlas->padding);
+
+        scratch->offset = scratchOffset;
+    }
+}
+
+// Bounces the direct light between the patches as often as the atlas asks for and the time budget allows,
+// then adds the gathered light to the baked tiles.
+static void LightBounce_Run(LightBounce* bounce, LightmapJob* lightmapJob)
+{
+    Atlas* atlas = lightmapJob->atlas;
+    f64 startTime = Platform_GetTime();
+
+    LightBounce_BuildTrees(bounce);
+
+    BounceJob job = {};
+    job.bounce = bounce;
+    job.level = lightmapJob->level;
+
+    s32 bounces = 0;
+    f64 bounceSeconds = 0.0;
+    while (bounces < atlas->bounceCount)
+    {
+        // Skip the bounce if it would likely run past the budget, building the trees counts against it too. There is
+        // no estimate before the first bounce, it only runs if the trees left some of the budget.
+        f64 elapsed = Platform_GetTime() - startTime;
+        if (elapsed + bounceSeconds > atlas->bounceTimeBudget)
+        {
+            break;
+        }
+
+        f64 bounceStart = Platform_GetTime();
+        LightBounce_UpdatePower(bounce);
+        Jobs_ParallelFor(bounce->patchCount, 64, GatherBounceLight, &job);
+        for (s32 i = 0; i < bounce->patchCount; ++i)
+        {
+            bounce->patches[i].indirect = bounce->gathered[i];
+        }
+        bounceSeconds = Platform_GetTime() - bounceStart;
+        bounces++;
+    }
+
+    BounceApplyJob applyJob = {};
+    applyJob.bounce = bounce;
+    applyJob.atlas = atlas;
+    applyJob.surfaces = lightmapJob->surfaces;
+    applyJob.surfaceIndices = lightmapJob->surfaceIndices;
+    Jobs_ParallelFor(bounce->surfaceCount, LIGHTMAP_SURFACES_PER_JOB, ApplyBounceLight, &applyJob);
+
+    atlas->stats.bounces = bounces;
+    Platform_LogInfo("Bounced light %d times between %d patches in %.3fs\n", bounces, bounce->patchCount, Platform_GetTime() - startTime);
+}
+
+static void BakeSurfaces(Atlas* atlas, const Level* level, const Surface* surfaces, const s32* surfaceIndices, s32 count, const Light* lights, s32 lightCount)
+{
+    LightmapJob job = {};
+    LightmapJob_Begin(&job, atlas, level, surfaces, surfaceIndices, count, lights, lightCount);
+
+    LightBounce bounce;
+    if (atlas->bounceCount > 0)
+    {
+        LightBounce_Init(&bounce, atlas, surfaces, surfaceIndices, count);
+        job.bounce = &bounce;
+    }
+
+    Jobs_ParallelFor(count, LIGHTMAP_SURFACES_PER_JOB, BakeSurfaceLightmaps, &job);
+
+    atlas->stats.bounces = 0;
+    if (job.bounce)
+    {
+        LightBounce_Run(&bounce, &job);
+        LightBounce_Destroy(&bounce);
+    }
+
+    LightmapJob_RecordStats(&job, "");
+    LightmapJob_End(&job);
+}
+
+// Fills the pages from firstPage on, so the space between tiles holds ambient light.
+static void FillAtlasPages(Atlas* atlas, s32 firstPage, f32 ambientLight)
+{
+    for (s32 i = firstPage; i < atlas->pageCount; ++i)
+    {
+        Image_FillColor(&atlas->pages[i].image, Color_ConvertToColor(glm::vec4(glm::vec3(ambientLight), 1.0f)));
+    }
+}
+
+void ComputeLightmap(Atlas* atlas, const Level* level, Surface* surfaces, s32 surfaceCount, const Light* lights, s32 lightCount)
+{
+    f32 ambientLight = LIGHTMAP_AMBIENT_LIGHT;
+
+    b32 packed = Atlas_PackSurfaces(atlas, surfaces, surfaceCount);
+    Platform_Assert(packed, "Lightmap atlas is full.");
+
+    FillAtlasPages(atlas, 0, ambientLight);
+
+    BakeSurfaces(atlas, level, surfaces, 0, surfaceCount, lights, lightCount);
+}
+
+// Batches of the progressive bake, in jobs per thread. Small enough to upload tiles often, large enough to keep the workers busy.
+#define PROGRESSIVE_LIGHTMAP_JOBS_PER_THREAD 4
+
+static void DestroyLightmapJob(LightmapJob* job)
+{
+    job->~LightmapJob();
+    Platform_Free(job);
+}
+
+static void ProgressiveLightmap_StartBatch(ProgressiveLightmap* bake, s32 begin)
+{
+    s32 batchSize = Jobs_GetThreadCount() * PROGRESSIVE_LIGHTMAP_JOBS_PER_THREAD * LIGHTMAP_SURFACES_PER_JOB;
+    bake->batchBegin = begin;
+    bake->batchEnd = glm::min(begin + batchSize, bake->surfaceCount);
+    bake->job->firstSurface = begin;
+    Jobs_ParallelForAsync(bake->batchEnd - bake->batchBegin, LIGHTMAP_SURFACES_PER_JOB, BakeSurfaceLightmaps, bake->job, &bake->counter);
+}
+
+void ProgressiveLightmap_Begin(ProgressiveLightmap* bake, Atlas* atlas, const Level* level, Surface* surfaces, s32 surfaceCount, const Light* lights, s32 lightCount)
+{
+    bake->atlas = atlas;
+    bake->surfaces = surfaces;
+    bake->surfaceCount = surfaceCount;
+    bake->counter.pendingCount = 0;
+    bake->finished = false;
+    atlas->stats.bounces = 0;
+
+    b32 packed = Atlas_PackSurfaces(atlas, surfaces, surfaceCount);
+    Platform_Assert(packed, "Lightmap atlas is full.");
+    FillAtlasPages(atlas, 0, LIGHTMAP_AMBIENT_LIGHT);
+    ComputeLightmapCoordinates(surfaces, surfaceCount, level, atlas);
+
+    // Constructed in place for its atomic counters.
+    bake->job = new (Platform_Alloc(sizeof(LightmapJob))) LightmapJob();
+    LightmapJob_Begin(bake->job, atlas, level, surfaces, 0, surfaceCount, lights, lightCount);
+
+    bake->job->coarse = true;
+    Jobs_ParallelFor(surfaceCount, LIGHTMAP_SURFACES_PER_JOB, BakeSurfaceLightmaps, bake->job);
+    LightmapJob_RecordStats(bake->job, " coarsely");
+    bake->job->coarse = false;
+
+    for (s32 i = 0; i < MAX_ATLAS_PAGES; ++i)
+    {
+        bake->textures[i] = i < atlas->pageCount ? Atlas_CreatePageTexture(atlas, i) : 0;
+    }
+
+    ProgressiveLightmap_StartBatch(bake, 0);
+}
+
+b32 ProgressiveLightmap_Update(ProgressiveLightmap* bake)
+{
+    if (bake->finished)
+    {
+        return true;
+    }
+
+    if (!Jobs_IsDone(&bake->counter))
+    {
+        return false;
+    }
+
+    // RGBA8 uploads read only the finished tiles, the next batch writing other tiles can run meanwhile. Compressed
+    // uploads grow to whole blocks and read the pixels of neighbouring tiles too, which the next batch may be writing.
+    Atlas* atlas = bake->atlas;
+    s32 begin = bake->batchBegin;
+    s32 end = bake->batchEnd;
+    b32 uploadFirst = atlas->format != TextureFormat_RGBA8;
+    if (!uploadFirst && end < bake->surfaceCount)
+    {
+        ProgressiveLightmap_StartBatch(bake, end);
+    }
+
+    for (s32 i = begin; i < end; ++i)
+    {
+        AtlasTile tile = bake->surfaces[i].lightmapTile;
+        Atlas_UpdatePageTexture(atlas, bake->textures[tile.page], tile.page, tile.x - atlas->padding, tile.y - atlas->padding,
+            tile.width + atlas->padding * 2, tile.height + atlas->padding * 2);
+    }
+
+    if (uploadFirst && end < bake->surfaceCount)
+    {
+        ProgressiveLightmap_StartBatch(bake, end);
+    }
+
+    if (end == bake->surfaceCount)
+    {
+        LightmapJob_RecordStats(bake->job, "");
+        LightmapJob_End(bake->job);
+        DestroyLightmapJob(bake->job);
+        bake->job = 0;
+        bake->finished = true;
+    }
+
+    return bake->finished;
+}
+
+void ProgressiveLightmap_Destroy(ProgressiveLightmap* bake)
+{
+    if (bake->job)
+    {
+        Jobs_Wait(&bake->counter);
+        LightmapJob_End(bake->job);
+        DestroyLightmapJob(bake->job);
+        bake->job = 0;
+    }
+    bake->finished = true;
+}
+
+void LightmapChanges_AddLight(LightmapChanges* changes, const Light* light)
+{
+    if (changes->lightCount >= MAX_LIGHTMAP_CHANGED_LIGHTS)
+    {
+        changes->overflow = true;
+        return;
+    }
+    changes->lights[changes->lightCount++] = *light;
+}
+
+static Box2 GetSurfaceBounds(const Surface* surface)
+{
+    Box2 bounds = CreateBox2(glm::vec2(surface->vertices[0].x, surface->vertices[0].z), glm::vec2(surface->vertices[0].x, surface->vertices[0].z));
+    for (s32 i = 1; i < 4; ++i)
+    {
+        glm::vec2 vertex = glm::vec2(surface->vertices[i].x, surface->vertices[i].z);
+        bounds.min = glm::min(bounds.min, vertex);
+        bounds.max = glm::max(bounds.max, vertex);
+    }
+    return bounds;
+}
+
+static f32 Cross2(glm::vec2 a, glm::vec2 b, glm::vec2 c)
+{
+    return (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+}
+
+// Returns true if a segment from the light to a point of the box within the light range can pass
+// through the region. Tests the box against the convex hull of the region and its shadow.
+static b32 CanRegionShadowBox(const LevelRegion* region, glm::vec2 lightPosition, f32 range, const Box2* box)
+{
+    glm::vec2 corners[4] = {
+        glm::vec2((f32)region->minX, (f32)region->minY),
+        glm::vec2((f32)region->maxX + 1.0f, (f32)region->minY),
+        glm::vec2((f32)region->maxX + 1.0f, (f32)region->maxY + 1.0f),
+        glm::vec2((f32)region->minX, (f32)region->maxY + 1.0f)
+    };
+
+    if (lightPosition.x >= corners[0].x && lightPosition.x <= corners[2].x &&
+        lightPosition.y >= corners[0].y && lightPosition.y <= corners[2].y)
+    {
+        return true;
+    }
+
+    glm::vec2 points[8];
+    for (s32 i = 0; i < 4; ++i)
+    {
+        points[i] = corners[i];
+        points[i + 4] = corners[i] + glm::normalize(corners[i] - lightPosition) * range;
+    }
+
+    // Convex hull of the points, monotone chain
+    for (s32 i = 1; i < 8; ++i)
+    {
+        for (s32 j = i; j > 0 && (points[j].x < points[j - 1].x || (points[j].x == points[j - 1].x && points[j].y < points[j - 1].y)); --j)
+        {
+            glm::vec2 temp = points[j];
+            points[j] = points[j - 1];
+            points[j - 1] = temp;
+        }
+    }
+
+    glm::vec2 hull[16];
+    s32 hullCount = 0;
+    for (s32 i = 0; i < 8; ++i)
+    {
+        while (hullCount >= 2 && Cross2(hull[hullCount - 2], hull[hullCount - 1], points[i]) <= 0.0f) hullCount--;
+        hull[hullCount++] = points[i];
+    }
+    for (s32 i = 6, lower = hullCount + 1; i >= 0; --i)
+    {
+        while (hullCount >= lower && Cross2(hull[hullCount - 2], hull[hullCount - 1], points[i]) <= 0.0f) hullCount--;
+        hull[hullCount++] = points[i];
+    }
+    hullCount--;
+
+    // Separating axis test between the hull and the box
+    Box2 hullBounds = CreateBox2(hull[0], hull[0]);
+    for (s32 i = 1; i < hullCount; ++i)
+    {
+        hullBounds.min = glm::min(hullBounds.min, hull[i]);
+        hullBounds.max = glm::max(hullBounds.max, hull[i]);
+    }
+    if (hullBounds.max.x < box->min.x || hullBounds.min.x > box->max.x ||
+        hullBounds.max.y < box->min.y || hullBounds.min.y > box->max.y)
+    {
+        return false;
+    }
+
+    glm::vec2 boxCorners[4] = { box->min, glm::vec2(box->max.x, box->min.y), box->max, glm::vec2(box->min.x, box->max.y) };
+    for (s32 i = 0; i < hullCount; ++i)
+    {
+        glm::vec2 a = hull[i];
+        glm::vec2 b = hull[(i + 1) % hullCount];
+
+        // The hull is counter-clockwise, so the box is separated if all corners are right of an edge.
+        b32 separated = true;
+        for (s32 j = 0; j < 4 && separated; ++j)
+        {
+            separated = Cross2(a, b, boxCorners[j]) < 0.0f;
+        }
+        if (separated)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Returns true if a segment from the light to a point of the box within the light range can pass through any dirty
+// region of the level.
+static b32 CanDirtyRegionsShadowBox(const Level* level, glm::vec2 lightPosition, f32 range, const Box2* box)
+{
+    for (s32 k = 0; k < level->dirtyRegionCount; ++k)
+    {
+        const LevelRegion* region = &level->dirtyRegions[k];
+        Box2 regionBounds = CreateBox2(glm::vec2((f32)region->minX, (f32)region->minY), glm::vec2(region->maxX + 1.0f, region->maxY + 1.0f));
+        if (Box2_CircleIntersect(&regionBounds, lightPosition, range) && CanRegionShadowBox(region, lightPosition, range, box))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Slack around a surface when looking up the visibility of its tiles, so wall faces on a tile edge take in the tile
+// in front of them.
+#define LIGHTMAP_SIGHT_MARGIN 0.01f
+
+struct SurfaceKey
+{
+    u64 hash;
+    s32 index;
+};
+
+static u64 HashSurfaceGeometry(const Surface* surface)
+{
+    // Surfaces are matched by geometry only, a texture change keeps the lightmap tile.
+    u64 hash = 14695981039346656037ull;
+    const u8* bytes = (const u8*)surface->vertices;
+    for (u64 i = 0; i < sizeof(surface->vertices); ++i)
+    {
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+static SurfaceKey* CreateSortedSurfaceKeys(const Surface* surfaces, s32 surfaceCount)
+{
+    SurfaceKey* keys = (SurfaceKey*)Platform_Alloc(sizeof(SurfaceKey) * glm::max(surfaceCount, 1));
+    for (s32 i = 0; i < surfaceCount; ++i)
+    {
+        keys[i].hash = HashSurfaceGeometry(&surfaces[i]);
+        keys[i].index = i;
+    }
+    std::sort(keys, keys + surfaceCount, [](const SurfaceKey& a, const SurfaceKey& b) { return a.hash < b.hash; });
+    return keys;
+}
+
+s32 UpdateLightmap(Atlas* atlas, const Level* level, Surface* surfaces, s32 surfaceCount, const Surface* previousSurfaces, s32 previousSurfaceCount, const Light* lights, s32 lightCount, const LightmapChanges* changes)
+{
+    // Tiles that are not rebaked keep the light already in the pages.
+    Atlas_DecodePages(atlas);
+
+    b32* needsBake = (b32*)Platform_Alloc(sizeof(b32) * glm::max(surfaceCount, 1));
+    Platform_ClearMemory(needsBake, sizeof(b32) * glm::max(surfaceCount, 1));
+
+    // Hand out the tiles of the previous surfaces to the matching new ones, new surfaces get fresh tiles.
+    if (previousSurfaces)
+    {
+        SurfaceKey* previousKeys = CreateSortedSurfaceKeys(previousSurfaces, previousSurfaceCount);
+        SurfaceKey* keys = CreateSortedSurfaceKeys(surfaces, surfaceCount);
+
+        for (s32 i = 0, j = 0; i < surfaceCount; ++i)
+        {
+            while (j < previousSurfaceCount && previousKeys[j].hash < keys[i].hash) j++;
+
+            Surface* surface = &surfaces[keys[i].index];
+            if (j < previousSurfaceCount && previousKeys[j].hash == keys[i].hash)
+            {
+                surface->lightmapTile = previousSurfaces[previousKeys[j].index].lightmapTile;
+                j++;
+            }
+            else
+            {
+                needsBake[keys[i].index] = true;
+            }
+        }
+
+        // Tiles of removed surfaces are not reused, once every page is full everything is packed and baked again.
+        s32 pageCount = atlas->pageCount;
+        b32 allocated = true;
+        for (s32 i = 0; i < surfaceCount && allocated; ++i)
+        {
+            if (needsBake[i])
+            {
+                glm::ivec2 size = GetSurfaceTileSize(atlas, &surfaces[i]);
+                allocated = Atlas_AllocateTile(atlas, size.x, size.y, &surfaces[i].lightmapTile);
+            }
+        }
+
+        if (!allocated)
+        {
+            b32 packed = Atlas_PackSurfaces(atlas, surfaces, surfaceCount);
+            Platform_Assert(packed, "Lightmap atlas is full.");
+            for (s32 i = 0; i < surfaceCount; ++i)
+            {
+                needsBake[i] = true;
+            }
+            pageCount = 0;
+        }
+        FillAtlasPages(atlas, pageCount, LIGHTMAP_AMBIENT_LIGHT);
+
+        Platform_Free(keys);
+        Platform_Free(previousKeys);
+    }
+
+    s32* surfaceIndices = (s32*)Platform_Alloc(sizeof(s32) * glm::max(surfaceCount, 1));
+    s32 bakeCount = 0;
+
+    // Tile visibility of the old and new states of the changed lights in the level as it is now.
+    LightVisibility* changedVisibility = (LightVisibility*)Platform_Alloc(sizeof(LightVisibility) * glm::max(changes->lightCount, 1));
+    LightVisibilityJob visibilityJob = {};
+    visibilityJob.level = level;
+    visibilityJob.lights = changes->lights;
+    visibilityJob.visibility = changedVisibility;
+    Jobs_ParallelFor(changes->lightCount, 1, ComputeLightVisibilities, &visibilityJob);
+
+    // Lights in range of a changed region, only they can see a surface through one.
+    s32* regionLights = (s32*)Platform_Alloc(sizeof(s32) * glm::max(lightCount, 1));
+    s32 regionLightCount = 0;
+    for (s32 j = 0; j < lightCount; ++j)
+    {
+        glm::vec2 lightPosition = glm::vec2(lights[j].position.x, lights[j].position.z);
+        for (s32 k = 0; k < level->dirtyRegionCount; ++k)
+        {
+            const LevelRegion* region = &level->dirtyRegions[k];
+            Box2 regionBounds = CreateBox2(glm::vec2((f32)region->minX, (f32)region->minY), glm::vec2(region->maxX + 1.0f, region->maxY + 1.0f));
+            if (Box2_CircleIntersect(&regionBounds, lightPosition, lights[j].range))
+            {
+                regionLights[regionLightCount++] = j;
+                break;
+            }
+        }
+    }
+
+    for (s32 i = 0; i < surfaceCount; ++i)
+    {
+        Box2 bounds = GetSurfaceBounds(&surfaces[i]);
+        b32 affected = needsBake[i] || changes->overflow;
+
+        // Everything in range and in sight of the old or new state of a changed light. A state lit the surface before
+        // the edits only if it sees it now, or if the line of sight runs through a changed region.
+        for (s32 j = 0; j < changes->lightCount && !affected; ++j)
+        {
+            const Light* light = &changes->lights[j];
+            glm::vec2 lightPosition = glm::vec2(light->position.x, light->position.z);
+            affected = Box2_CircleIntersect(&bounds, lightPosition, light->range) &&
+                       (!LightVisibility_IsAreaShadowed(&changedVisibility[j], level, light, bounds.min.x - LIGHTMAP_SIGHT_MARGIN, bounds.min.y - LIGHTMAP_SIGHT_MARGIN,
+                            bounds.max.x + LIGHTMAP_SIGHT_MARGIN, bounds.max.y + LIGHTMAP_SIGHT_MARGIN) ||
+                        CanDirtyRegionsShadowBox(level, lightPosition, light->range, &bounds));
+        }
 
-                Platform_Free(tImage.pixels);
-                Platform_Free(tImage2.pixels);
-                Platform_Free(tImage3.pixels);
-            });
+        // Everything close enough to a changed region for its ambient occlusion to change.
+        for (s32 k = 0; k < level->dirtyRegionCount && !affected && atlas->occlusionStrength > 0.0f; ++k)
+        {
+            const LevelRegion* region = &level->dirtyRegions[k];
+            affected = bounds.max.x >= region->minX - LIGHTMAP_OCCLUSION_RADIUS && bounds.min.x <= region->maxX + 1.0f + LIGHTMAP_OCCLUSION_RADIUS &&
+                       bounds.max.y >= region->minY - LIGHTMAP_OCCLUSION_RADIUS && bounds.min.y <= region->maxY + 1.0f + LIGHTMAP_OCCLUSION_RADIUS;
+        }
+
+        // Everything a light can see through a changed region.
+        for (s32 j = 0; j < regionLightCount && !affected; ++j)
+        {
+            const Light* light = &lights[regionLights[j]];
+            glm::vec2 lightPosition = glm::vec2(light->position.x, light->position.z);
+            if (!Box2_CircleIntersect(&bounds, lightPosition, light->range))
+            {
+                continue;
+            }
+
+            affected = CanDirtyRegionsShadowBox(level, lightPosition, light->range, &bounds);
         }
 
-        for (auto& thread : threads)
+        if (affected)
         {
-            thread.join();
+            surfaceIndices[bakeCount++] = i;
         }
     }
+
+    // Indirect light carries any change across the whole level.
+    if (atlas->bounceCount > 0 && bakeCount > 0)
+    {
+        bakeCount = surfaceCount;
+        BakeSurfaces(atlas, level, surfaces, 0, surfaceCount, lights, lightCount);
+    }
+    else
+    {
+        BakeSurfaces(atlas, level, surfaces, surfaceIndices, bakeCount, lights, lightCount);
+    }
+    ComputeLightmapCoordinates(surfaces, surfaceCount, level, atlas);
+
+    for (s32 j = 0; j < changes->lightCount; ++j)
+    {
+        LightVisibility_Destroy(&changedVisibility[j]);
+    }
+    Platform_Free(changedVisibility);
+    Platform_Free(regionLights);
+    Platform_Free(surfaceIndices);
+    Platform_Free(needsBake);
+
+    return bakeCount;
 }
 
 void ComputeLightmapCoordinates(Surface* surfaces, s32 surfaceCount, const Level* level, const Atlas* atlas)
@@ -398,14 +2524,15 @@ void ComputeLightmapCoordinates(Surface* surfaces, s32 surfaceCount, const Level
     for (s32 i = 0; i < surfaceCount; ++i)
     {
         Surface* surface = &surfaces[i];
-        glm::ivec2 tileMin = Atlas_GetTileMinAt(atlas, i);
-        f32 u = ((f32)tileMin.x + atlas->padding) / (f32)atlas->image.width;
-        f32 v = ((f32)tileMin.y + atlas->padding) / (f32)atlas->image.height;
-        f32 lx = atlas->tileWidth / (f32)atlas->image.width;
-
-        surface->lightmap[0] = glm::vec2(u     , v     );
-        surface->lightmap[1] = glm::vec2(u + lx, v     );
-        surface->lightmap[2] = glm::vec2(u + lx, v + lx);
-        surface->lightmap[3] = glm::vec2(u     , v + lx);
+        AtlasTile tile = surface->lightmapTile;
+        f32 u0 = (f32)tile.x / (f32)atlas->pageWidth;
+        f32 v0 = (f32)tile.y / (f32)atlas->pageHeight;
+        f32 u1 = (f32)(tile.x + tile.width) / (f32)atlas->pageWidth;
+        f32 v1 = (f32)(tile.y + tile.height) / (f32)atlas->pageHeight;
+
+        surface->lightmap[0] = glm::vec2(u0, v0);
+        surface->lightmap[1] = glm::vec2(u1, v0);
+        surface->lightmap[2] = glm::vec2(u1, v1);
+        surface->lightmap[3] = glm::vec2(u0, v1);
     }
 }
\ No newline at end of file
@@ -3,38 +3,178 @@
 #include "scene/level.h"
 #include "renderer/image.h"
 #include "renderer/renderer.h"
+#include "core/jobs.h"
 #include <glm/glm.hpp>
 
+// Rectangle of a surface lightmap in an atlas page, without the padding around it.
+struct AtlasTile
+{
+    s32 page;
+    s32 x;
+    s32 y;
+    s32 width;
+    s32 height;
+};
+
 struct Surface
 {
     glm::vec3 vertices[4];
-    glm::vec2 texcoords[4];
-    glm::vec2 lightmap[4];
+    glm::vec2 texcoords[4]; // Corners of one tileset tile. Each level tile the surface covers shows the whole tile, see CreateSurfaceMesh.
+    glm::vec2 lightmap[4];  // UVs in the atlas page of lightmapTile.
     glm::vec3 normal;
+    glm::vec2 size;         // Extent in level tiles along vertices[1] - vertices[0] and vertices[3] - vertices[0].
     u32 texture;
+    AtlasTile lightmapTile;
+};
+
+#define MAX_ATLAS_PAGES 8
+
+// Span of page columns whose lowest free row is y.
+struct SkylineNode
+{
+    s32 x;
+    s32 y;
+    s32 width;
+};
+
+struct AtlasPage
+{
+    Image image;
+    SkylineNode* skyline; // Left to right, covering the whole page width.
+    s32 skylineCount;
+    void* blocks; // Page in the atlas format as loaded from the lightmap cache.
+    b32 encoded;  // Only blocks holds the page, the pixels are decoded once a bake needs them.
+};
+
+enum LightmapQuality
+{
+    LightmapQuality_Fast,     // One sample per luxel.
+    LightmapQuality_Adaptive, // One sample per luxel, 2x2 samples where neighbouring luxels disagree.
+    LightmapQuality_Full      // 2x2 samples per luxel.
+};
+
+// Counts of the last bake into an atlas. Rays saved are estimated against Full quality,
+// which casts about four rays for every ray of a single sample per luxel.
+struct LightmapBakeStats
+{
+    s32 surfaceCount;
+    s64 raysCast;
+    s64 raysSaved;
+    s64 supersampledLuxels;
+    s32 bounces; // Indirect light bounces that fit in the time budget.
+    f64 seconds;
 };
 
+// Lightmap tiles packed with a skyline packer into pages of the same size. Each page is its own lightmap texture.
+// The alpha of each luxel holds its ambient occlusion, already applied to the ambient light in the color. Only RGBA8
+// and BC3 pages keep it, pick BC3 over the default BC1 only for a shader that samples it.
 struct Atlas
 {
     s32 padding;
-    s32 tileWidth;
-    s32 tileHeight;
-    s32 tilesPerRow;
-    s32 tilesPerCol;
-    Image image;
+    s32 luxelsPerUnit; // Luxels per level tile along each surface axis.
+    LightmapQuality quality;
+    s32 bounceCount;        // Bounces of indirect light added to the direct light, 0 for none.
+    f32 bounceTimeBudget;   // Seconds the bounces may take including their setup, the ones that would not fit are skipped.
+    f32 occlusionStrength;  // Darkening of the ambient light per nearby wall, floor or ceiling at contact, 0 for no ambient occlusion.
+    TextureFormat format;   // Format of the page textures and of the pages stored on disk, baking always works on RGBA8 pages.
+    s32 pageWidth;
+    s32 pageHeight;
+    AtlasPage pages[MAX_ATLAS_PAGES];
+    s32 pageCount;     // Pages holding tiles, the ones past it may still keep their memory.
+    Arena* arena;      // Backs the pages, allocated when they are first used.
+    LightmapBakeStats stats;
+};
+
+#define MAX_LIGHTMAP_CHANGED_LIGHTS 64
+
+// Lights whose contribution to the lightmap changed since the last bake.
+struct LightmapChanges
+{
+    Light lights[MAX_LIGHTMAP_CHANGED_LIGHTS];
+    s32 lightCount;
+    b32 overflow;
+};
+
+struct LightmapJob;
+
+// Lightmap baked in the background. A coarse pass with one sample per level tile is shown right away,
+// then the job workers bake the tiles at the atlas quality in batches that are uploaded as they finish.
+// Only bakes direct light, the atlas bounces are left out.
+struct ProgressiveLightmap
+{
+    Atlas* atlas;
+    const Surface* surfaces;
+    s32 surfaceCount;
+    TextureId textures[MAX_ATLAS_PAGES]; // Lightmap texture per used atlas page, owned by the caller.
+    LightmapJob* job;
+    JobCounter counter;
+    s32 batchBegin; // Surfaces being baked.
+    s32 batchEnd;
+    b32 finished;
 };
 
-// Creates and initializes an atlas.
-Atlas CreateAtlas(s32 width, s32 height, s32 tileWidth, s32 tileHeight, s32 padding, Arena* arena);
+// Creates and initializes an atlas with adaptive quality, ambient occlusion, BC1 textures and no bounces, pages are allocated from the arena as the tiles need them.
+Atlas CreateAtlas(s32 pageWidth, s32 pageHeight, s32 luxelsPerUnit, s32 padding, Arena* arena);
+
+// Frees every tile of the atlas.
+void Atlas_Clear(Atlas* atlas);
+
+// Allocates a tile of width x height luxels plus padding, in a new page if it fits in no used one.
+// Returns false if every page is full or the arena has no room for another page.
+b32 Atlas_AllocateTile(Atlas* atlas, s32 width, s32 height, AtlasTile* outTile);
+
+// Clears the atlas and allocates a tile for every surface, sized by its extent. Returns false if they do not fit.
+b32 Atlas_PackSurfaces(Atlas* atlas, Surface* surfaces, s32 surfaceCount);
+
+// Decodes the pages only held as blocks into their pixels. Incremental bakes call it before baking into the pages.
+void Atlas_DecodePages(Atlas* atlas);
 
-// Returns the min coordinates of the tile in the atlas without padding.
-glm::ivec2 Atlas_GetTileMinAt(const Atlas* atlas, s32 tileId);
+// Compresses a page into 4x4 blocks of the atlas format on the job workers, or copies its blocks while it is encoded.
+// Page width and height are multiples of 4.
+void Atlas_CompressPage(const Atlas* atlas, s32 page, void* outBlocks);
 
-// Initializes the atlas tiles from surfaces.
-void ComputeLightmap(Atlas* atlas, const Level* level, const Surface* surface, s32 surfaceCount, const Light* lights, s32 lightCount);
+// Creates the texture of a page in the atlas format, straight from its blocks while it is encoded.
+TextureId Atlas_CreatePageTexture(const Atlas* atlas, s32 page);
 
-// Creates a surface for each tile in the level
+// Uploads a rectangle of a page to its texture. Compressed formats grow it to whole blocks and read the pixels around it.
+void Atlas_UpdatePageTexture(const Atlas* atlas, TextureId texture, s32 page, s32 x, s32 y, s32 width, s32 height);
+
+// Returns the falloff the lightmap bake applies to a light at the distance, 1 at the light and 0 at its range.
+f32 ComputeLightFallOff(const Light* light, f32 distance);
+
+// Packs the surfaces into the atlas and bakes their tiles, direct light plus the bounces of the atlas.
+void ComputeLightmap(Atlas* atlas, const Level* level, Surface* surfaces, s32 surfaceCount, const Light* lights, s32 lightCount);
+
+// Packs the surfaces, bakes the coarse lightmap, creates a texture per atlas page from it and computes the lightmap
+// coordinates. Then starts baking the tiles in the background, the level and surfaces must stay valid until it is done.
+void ProgressiveLightmap_Begin(ProgressiveLightmap* bake, Atlas* atlas, const Level* level, Surface* surfaces, s32 surfaceCount, const Light* lights, s32 lightCount);
+
+// Uploads the tiles of a finished batch and starts the next one. Call once per frame on the thread owning the
+// textures. Returns true once every tile is baked.
+b32 ProgressiveLightmap_Update(ProgressiveLightmap* bake);
+
+// Waits for the batch being baked and stops the bake, the textures stay valid.
+void ProgressiveLightmap_Destroy(ProgressiveLightmap* bake);
+
+// Records a light that was added, removed or changed. Add both the old and the new state of a changed light.
+void LightmapChanges_AddLight(LightmapChanges* changes, const Light* light);
+
+// Rebakes only the tiles of surfaces whose lighting can be affected by the dirty regions of the level or by the
+// changed lights, then updates the lightmap coordinates. Indirect light reaches everywhere, so with bounces any change rebakes every tile. Surfaces matching one of previousSurfaces keep its
+// lightmap tile, pass null when the surfaces did not change. Returns the number of rebaked surfaces.
+s32 UpdateLightmap(Atlas* atlas, const Level* level, Surface* surfaces, s32 surfaceCount, const Surface* previousSurfaces, s32 previousSurfaceCount, const Light* lights, s32 lightCount, const LightmapChanges* changes);
+
+// Creates the surfaces of the level, adjacent coplanar faces with the same tile are merged into one surface so they
+// share a lightmap tile.
 Surface* CreateLevelSurfaces(const Level* level, const Tileset* tileset, Arena* transientStorage, s32* outSurfaceCount);
 
-// Compute the lightmap texture cooridantes for each surface
+// Creates the surfaces of the faces of the tiles in the region, merged only within the region. Wall faces still
+// look at the tiles next to the region, so the surfaces of neighbouring regions fit together.
+Surface* CreateLevelRegionSurfaces(const Level* level, const LevelRegion* region, const Tileset* tileset, Arena* transientStorage, s32* outSurfaceCount);
+
+// Creates a mesh with a quad per level tile of each surface, texCoord0 holds the UVs of the tileset tile and texCoord1
+// the lightmap UVs. Tileset tiles are sub-rects of the tileset texture and cannot repeat, so merged surfaces are split again.
+Mesh CreateSurfaceMesh(const Surface* surfaces, s32 surfaceCount);
+
+// Compute the lightmap texture cooridantes for each surface from its packed tile
 void ComputeLightmapCoordinates(Surface* surfaces, s32 surfaceCount, const Level* level, const Atlas* atlas);
\ No newline at end of file
@@ -0,0 +1,351 @@
+#include "level_stream.h"
+#include "renderer/rhi.h"
+
+#define LEVEL_FILE_MAGIC 0x4c56454c // "LEVL"
+#define LEVEL_FILE_VERSION 1
+
+// A chunk has at most a floor, a ceiling and four wall faces per open tile, far fewer luxels than a page at this density.
+#define LEVEL_STREAM_LIGHTMAP_SIZE 512
+#define LEVEL_STREAM_LUXELS_PER_UNIT 4
+#define LEVEL_STREAM_LIGHTMAP_PADDING 1
+
+// Followed by the chunks row by row, each with Layer_Count layers of LEVEL_CHUNK_TILE_COUNT row-major tiles.
+// Tiles of chunks on the right and bottom edge that are outside the level are stored as 0.
+struct LevelFileHeader
+{
+    u32 magic;
+    u32 version;
+    s32 width;
+    s32 height;
+    s32 chunkSize;
+};
+
+static u64 GetChunkFileOffset(const Level* level, s32 chunkX, s32 chunkY)
+{
+    u64 chunkSize = sizeof(u32) * Layer_Count * LEVEL_CHUNK_TILE_COUNT;
+    return sizeof(LevelFileHeader) + (u64)(chunkY * level->chunksPerRow + chunkX) * chunkSize;
+}
+
+b32 LevelFile_Save(const char* filename, const Level* level)
+{
+    // Tiles of chunks that are not resident read as -1, saving them would overwrite the level with walls.
+    if (level->layout == LevelLayout_Chunked)
+    {
+        Platform_LogWarning("Cannot save a chunked level to a level file: %s\n", filename);
+        return false;
+    }
+
+    FileHandle file = Platform_OpenFile(filename, FileMode_Write);
+    if (!file.handle)
+    {
+        Platform_LogWarning("Failed to write level file: %s\n", filename);
+        return false;
+    }
+
+    LevelFileHeader header = {};
+    header.magic = LEVEL_FILE_MAGIC;
+    header.version = LEVEL_FILE_VERSION;
+    header.width = level->width;
+    header.height = level->height;
+    header.chunkSize = LEVEL_CHUNK_SIZE;
+    Platform_WriteDataToFile(&file, &header, sizeof(header));
+
+    u32* tiles = (u32*)Platform_Alloc(sizeof(u32) * Layer_Count * LEVEL_CHUNK_TILE_COUNT);
+    s32 chunksPerRow = (level->width + LEVEL_CHUNK_SIZE - 1) >> LEVEL_CHUNK_SHIFT;
+    s32 chunkRows = (level->height + LEVEL_CHUNK_SIZE - 1) >> LEVEL_CHUNK_SHIFT;
+    for (s32 chunkY = 0; chunkY < chunkRows; ++chunkY)
+    {
+        for (s32 chunkX = 0; chunkX < chunksPerRow; ++chunkX)
+        {
+            for (s32 layer = 0; layer < Layer_Count; ++layer)
+            {
+                for (s32 y = 0; y < LEVEL_CHUNK_SIZE; ++y)
+                {
+                    for (s32 x = 0; x < LEVEL_CHUNK_SIZE; ++x)
+                    {
+                        s32 tileX = (chunkX << LEVEL_CHUNK_SHIFT) + x;
+                        s32 tileY = (chunkY << LEVEL_CHUNK_SHIFT) + y;
+                        b32 inside = tileX < level->width && tileY < level->height;
+                        tiles[layer * LEVEL_CHUNK_TILE_COUNT + y * LEVEL_CHUNK_SIZE + x] = inside ? Level_GetTileAt(level, tileX, tileY, (Layer)layer) : 0;
+                    }
+                }
+            }
+            Platform_WriteDataToFile(&file, tiles, sizeof(u32) * Layer_Count * LEVEL_CHUNK_TILE_COUNT);
+        }
+    }
+
+    Platform_Free(tiles);
+    Platform_CloseFile(&file);
+    return true;
+}
+
+b32 LevelStream_Open(LevelStream* stream, Level* level, const char* filename, s32 loadRadius, const Tileset* tileset, Arena* arena)
+{
+    FileHandle file = Platform_OpenFile(filename, FileMode_Read);
+    if (!file.handle)
+    {
+        return false;
+    }
+
+    LevelFileHeader header = {};
+    Platform_ReadDataFromFile(&file, &header, sizeof(header));
+    s32 chunkCount = ((header.width + LEVEL_CHUNK_SIZE - 1) >> LEVEL_CHUNK_SHIFT) * ((header.height + LEVEL_CHUNK_SIZE - 1) >> LEVEL_CHUNK_SHIFT);
+    if (header.magic != LEVEL_FILE_MAGIC || header.version != LEVEL_FILE_VERSION || header.chunkSize != LEVEL_CHUNK_SIZE ||
+        header.width <= 0 || header.height <= 0 ||
+        file.size != sizeof(header) + (u64)chunkCount * sizeof(u32) * Layer_Count * LEVEL_CHUNK_TILE_COUNT)
+    {
+        Platform_LogWarning("Not a level file: %s\n", filename);
+        Platform_CloseFile(&file);
+        return false;
+    }
+
+    // Chunks are only evicted once they are more than a chunk past the load radius, so that many can be resident.
+    s32 residentSide = 2 * (loadRadius + 1) + 1;
+    s32 residentChunkCount = residentSide * residentSide;
+    Level_InitChunked(level, header.width, header.height, residentChunkCount, arena);
+
+    *stream = {};
+    stream->level = level;
+    stream->file = file;
+    stream->tileset = tileset;
+    stream->loadRadius = loadRadius;
+    stream->chunks = ArenaPushArray(arena, LevelStreamChunk, residentChunkCount);
+    stream->chunkTiles = ArenaPushArray(arena, u32, Layer_Count * LEVEL_CHUNK_TILE_COUNT);
+
+    // Every tile of a chunk can have a floor, a ceiling and four wall faces.
+    u64 surfaceStorageSize = sizeof(Surface) * 6 * LEVEL_CHUNK_TILE_COUNT + MEMORY_DEFAULT_ALIGNMENT;
+    void* surfaceStorage = Arena_PushSize(arena, surfaceStorageSize);
+    Platform_Assert(stream->chunks && stream->chunkTiles && surfaceStorage, "Arena is full.");
+    Arena_Init(&stream->surfaceStorage, surfaceStorageSize, surfaceStorage);
+
+    for (s32 i = 0; i < residentChunkCount; ++i)
+    {
+        stream->chunks[i] = {};
+        stream->chunks[i].chunkX = -1;
+        stream->chunks[i].chunkY = -1;
+    }
+    return true;
+}
+
+static LevelStreamChunk* FindStreamChunk(LevelStream* stream, s32 chunkX, s32 chunkY)
+{
+    for (s32 i = 0; i < stream->level->residentChunkCount; ++i)
+    {
+        if (stream->chunks[i].chunkX == chunkX && stream->chunks[i].chunkY == chunkY)
+        {
+            return &stream->chunks[i];
+        }
+    }
+    return nullptr;
+}
+
+static void FreeChunkSurfaces(LevelStreamChunk* chunk)
+{
+    if (chunk->mesh.indexCount)
+    {
+        DestroyMesh(&chunk->mesh);
+    }
+    if (chunk->surfaces)
+    {
+        Platform_Free(chunk->surfaces);
+    }
+    chunk->surfaces = nullptr;
+    chunk->surfaceCount = 0;
+    chunk->lit = false;
+}
+
+// Rebuilds the surfaces of the resident neighbours of a chunk, whose walls facing it gain or lose their faces
+// when it is loaded or evicted.
+static void MarkNeighbourSurfaces(LevelStream* stream, s32 chunkX, s32 chunkY)
+{
+    static const s32 neighbours[4][2] = { { 1, 0 }, { -1, 0 }, { 0, 1 }, { 0, -1 } };
+    for (s32 i = 0; i < 4; ++i)
+    {
+        LevelStreamChunk* neighbour = FindStreamChunk(stream, chunkX + neighbours[i][0], chunkY + neighbours[i][1]);
+        if (neighbour)
+        {
+            neighbour->needsSurfaces = true;
+        }
+    }
+}
+
+static void EvictStreamChunk(LevelStream* stream, LevelStreamChunk* chunk)
+{
+    FreeChunkSurfaces(chunk);
+    Level_EvictChunk(stream->level, chunk->chunkX, chunk->chunkY);
+    MarkNeighbourSurfaces(stream, chunk->chunkX, chunk->chunkY);
+    chunk->chunkX = -1;
+    chunk->chunkY = -1;
+    chunk->needsSurfaces = false;
+}
+
+static void LoadStreamChunk(LevelStream* stream, s32 chunkX, s32 chunkY)
+{
+    LevelStreamChunk* chunk = FindStreamChunk(stream, -1, -1);
+    Platform_Assert(chunk, "No free chunk slot.");
+
+    Platform_SeekFile(&stream->file, GetChunkFileOffset(stream->level, chunkX, chunkY));
+    Platform_ReadDataFromFile(&stream->file, stream->chunkTiles, sizeof(u32) * Layer_Count * LEVEL_CHUNK_TILE_COUNT);
+
+    const u32* layers[Layer_Count];
+    for (s32 i = 0; i < Layer_Count; ++i)
+    {
+        layers[i] = stream->chunkTiles + i * LEVEL_CHUNK_TILE_COUNT;
+    }
+    Level_LoadChunk(stream->level, chunkX, chunkY, layers);
+
+    chunk->chunkX = chunkX;
+    chunk->chunkY = chunkY;
+    chunk->needsSurfaces = true;
+    MarkNeighbourSurfaces(stream, chunkX, chunkY);
+}
+
+// Bakes the surfaces of the chunk into the page of its atlas and uploads it. Surfaces that need more than the page
+// keep their zero lightmap coordinates and the chunk is left unlit.
+static void BakeChunkLightmap(LevelStream* stream, LevelStreamChunk* chunk)
+{
+    if (!chunk->atlasStorage.base)
+    {
+        // Room for one page, so packing fails instead of spilling into a second page.
+        u64 atlasStorageSize = sizeof(u32) * LEVEL_STREAM_LIGHTMAP_SIZE * LEVEL_STREAM_LIGHTMAP_SIZE +
+            sizeof(SkylineNode) * (LEVEL_STREAM_LIGHTMAP_SIZE + 1) + 2 * MEMORY_DEFAULT_ALIGNMENT;
+        Arena_Init(&chunk->atlasStorage, atlasStorageSize, Platform_Alloc(atlasStorageSize));
+        chunk->atlas = CreateAtlas(LEVEL_STREAM_LIGHTMAP_SIZE, LEVEL_STREAM_LIGHTMAP_SIZE, LEVEL_STREAM_LUXELS_PER_UNIT,
+            LEVEL_STREAM_LIGHTMAP_PADDING, &chunk->atlasStorage);
+    }
+
+    if (!Atlas_PackSurfaces(&chunk->atlas, chunk->surfaces, chunk->surfaceCount))
+    {
+        Platform_LogWarning("Lightmap of chunk %d, %d does not fit in a page, drawing it unlit.\n", chunk->chunkX, chunk->chunkY);
+        return;
+    }
+
+    ComputeLightmap(&chunk->atlas, stream->level, chunk->surfaces, chunk->surfaceCount, stream->lights, stream->lightCount);
+    ComputeLightmapCoordinates(chunk->surfaces, chunk->surfaceCount, stream->level, &chunk->atlas);
+    if (chunk->lightmap)
+    {
+        Atlas_UpdatePageTexture(&chunk->atlas, chunk->lightmap, 0, 0, 0, chunk->atlas.pageWidth, chunk->atlas.pageHeight);
+    }
+    else
+    {
+        chunk->lightmap = Atlas_CreatePageTexture(&chunk->atlas, 0);
+    }
+    chunk->lit = true;
+}
+
+static void BuildChunkSurfaces(LevelStream* stream, LevelStreamChunk* chunk)
+{
+    const Level* level = stream->level;
+    LevelRegion region = {};
+    region.minX = chunk->chunkX << LEVEL_CHUNK_SHIFT;
+    region.minY = chunk->chunkY << LEVEL_CHUNK_SHIFT;
+    region.maxX = glm::min(region.minX + LEVEL_CHUNK_SIZE, level->width) - 1;
+    region.maxY = glm::min(region.minY + LEVEL_CHUNK_SIZE, level->height) - 1;
+
+    FreeChunkSurfaces(chunk);
+
+    Arena_Clear(&stream->surfaceStorage);
+    s32 surfaceCount = 0;
+    Surface* surfaces = CreateLevelRegionSurfaces(level, &region, stream->tileset, &stream->surfaceStorage, &surfaceCount);
+    if (surfaceCount > 0)
+    {
+        chunk->surfaces = (Surface*)Platform_Alloc(sizeof(Surface) * surfaceCount);
+        Platform_CopyMemory(chunk->surfaces, surfaces, sizeof(Surface) * surfaceCount);
+        chunk->surfaceCount = surfaceCount;
+        BakeChunkLightmap(stream, chunk);
+        chunk->mesh = CreateSurfaceMesh(chunk->surfaces, surfaceCount);
+    }
+    chunk->needsSurfaces = false;
+}
+
+void LevelStream_Update(LevelStream* stream, glm::vec2 playerPosition)
+{
+    Level* level = stream->level;
+    s32 playerChunkX = (s32)glm::floor(playerPosition.x / LEVEL_CHUNK_SIZE);
+    s32 playerChunkY = (s32)glm::floor(playerPosition.y / LEVEL_CHUNK_SIZE);
+
+    for (s32 i = 0; i < level->residentChunkCount; ++i)
+    {
+        LevelStreamChunk* chunk = &stream->chunks[i];
+        if (chunk->chunkX >= 0 &&
+            glm::max(glm::abs(chunk->chunkX - playerChunkX), glm::abs(chunk->chunkY - playerChunkY)) > stream->loadRadius + 1)
+        {
+            EvictStreamChunk(stream, chunk);
+        }
+    }
+
+    // Ring by ring outwards from the chunk of the player.
+    s32 loads = 0;
+    for (s32 ring = 0; ring <= stream->loadRadius; ++ring)
+    {
+        for (s32 chunkY = playerChunkY - ring; chunkY <= playerChunkY + ring; ++chunkY)
+        {
+            for (s32 chunkX = playerChunkX - ring; chunkX <= playerChunkX + ring; ++chunkX)
+            {
+                b32 onRing = glm::max(glm::abs(chunkX - playerChunkX), glm::abs(chunkY - playerChunkY)) == ring;
+                b32 inside = chunkX >= 0 && chunkY >= 0 && chunkX < level->chunksPerRow && chunkY < level->chunkRows;
+                if (!onRing || !inside || Level_IsChunkResident(level, chunkX, chunkY))
+                {
+                    continue;
+                }
+                if (stream->maxLoadsPerUpdate > 0 && loads == stream->maxLoadsPerUpdate)
+                {
+                    continue;
+                }
+
+                LoadStreamChunk(stream, chunkX, chunkY);
+                loads++;
+            }
+        }
+    }
+
+    for (s32 i = 0; i < level->residentChunkCount; ++i)
+    {
+        if (stream->chunks[i].chunkX >= 0 && stream->chunks[i].needsSurfaces)
+        {
+            BuildChunkSurfaces(stream, &stream->chunks[i]);
+        }
+    }
+}
+
+void LevelStream_Draw(const LevelStream* stream, const Material* material)
+{
+    for (s32 i = 0; i < stream->level->residentChunkCount; ++i)
+    {
+        const LevelStreamChunk* chunk = &stream->chunks[i];
+        if (chunk->chunkX >= 0 && chunk->mesh.indexCount)
+        {
+            // Unlit chunks fall back to the lights of the renderer.
+            Material chunkMaterial = *material;
+            chunkMaterial.lightmapTexture = chunk->lightmap;
+            chunkMaterial.useLightmap = material->useLightmap && chunk->lit;
+            Renderer_DrawMesh(&chunk->mesh, &chunkMaterial, glm::mat4(1.0f));
+        }
+    }
+}
+
+void LevelStream_Close(LevelStream* stream)
+{
+    for (s32 i = 0; i < stream->level->residentChunkCount; ++i)
+    {
+        if (stream->chunks[i].chunkX >= 0)
+        {
+            EvictStreamChunk(stream, &stream->chunks[i]);
+        }
+    }
+    for (s32 i = 0; i < stream->level->residentChunkCount; ++i)
+    {
+        LevelStreamChunk* chunk = &stream->chunks[i];
+        if (chunk->lightmap)
+        {
+            RHI_DestroyTexture(chunk->lightmap);
+        }
+        if (chunk->atlasStorage.base)
+        {
+            Platform_Free(chunk->atlasStorage.base);
+        }
+        chunk->lightmap = 0;
+        chunk->atlasStorage = {};
+    }
+    Platform_CloseFile(&stream->file);
+}
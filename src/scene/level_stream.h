@@ -0,0 +1,60 @@
+#pragma once
+#include "core/types.h"
+#include "core/memory.h"
+#include "core/platform.h"
+#include "scene/level.h"
+#include "scene/level_builder.h"
+#include "renderer/renderer.h"
+
+// Surfaces, mesh and lightmap of a resident chunk of a streamed level.
+struct LevelStreamChunk
+{
+    s32 chunkX; // -1 when the entry is free.
+    s32 chunkY;
+    Surface* surfaces; // With lightmap tiles in the atlas of the chunk when it is lit.
+    s32 surfaceCount;
+    Mesh mesh;         // Quads of the surfaces, empty when there are none.
+    b32 needsSurfaces; // Built again at the end of the update, the chunk or a neighbour was loaded or evicted.
+    b32 lit;           // The surfaces are baked into the lightmap, false if they do not fit in its page.
+    Atlas atlas;       // One page, kept by the entry for the chunks loaded into it later.
+    Arena atlasStorage; // Backs the atlas page, allocated the first time the entry bakes a chunk.
+    TextureId lightmap; // Texture of the atlas page.
+};
+
+// Chunked level streamed from a level file around the player. Chunks within loadRadius chunks of the player are
+// loaded and the ones more than a chunk further away evicted, so walking back and forth over a chunk border does not
+// load the same chunks again and again. Edits to the level are not written back to the file.
+// Each chunk bakes its own lightmap whenever its surfaces are built. Tiles of chunks that are not resident block
+// light like walls, so a chunk is baked again once its neighbours are loaded.
+struct LevelStream
+{
+    Level* level;
+    FileHandle file;
+    const Tileset* tileset;
+    s32 loadRadius;
+    s32 maxLoadsPerUpdate;    // Chunks read from the file per LevelStream_Update, 0 for no limit.
+    const Light* lights;      // Baked into the chunk lightmaps, set by the caller and kept valid while the stream is open.
+    s32 lightCount;
+    LevelStreamChunk* chunks; // As many as the level has chunk slots.
+    u32* chunkTiles;          // Tiles of a chunk read from the file, one layer after the other.
+    Arena surfaceStorage;     // Surfaces of the chunk being built, before they are copied to the chunk.
+};
+
+// Writes the level to a level file. The tiles are stored chunk by chunk so a chunk can be read on its own.
+// Returns false for levels of LevelLayout_Chunked, which do not have every chunk in memory.
+b32 LevelFile_Save(const char* filename, const Level* level);
+
+// Opens a level file and initializes the level as a chunked level with room for the chunks around the player.
+// No chunk is loaded until the first LevelStream_Update. Returns false if the file is missing or not a level file.
+b32 LevelStream_Open(LevelStream* stream, Level* level, const char* filename, s32 loadRadius, const Tileset* tileset, Arena* arena);
+
+// Evicts the chunks far from the player and loads the missing ones around it, nearest first. Then builds the
+// surfaces, lightmaps and meshes of the loaded chunks and of the resident chunks next to them. The position is in
+// level tiles.
+void LevelStream_Update(LevelStream* stream, glm::vec2 playerPosition);
+
+// Draws the meshes of the resident chunks, each with the material and its own lightmap.
+void LevelStream_Draw(const LevelStream* stream, const Material* material);
+
+// Evicts every chunk, frees their surfaces, meshes and lightmaps and closes the level file.
+void LevelStream_Close(LevelStream* stream);
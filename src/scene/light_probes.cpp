@@ -0,0 +1,178 @@
+#include "light_probes.h"
+#include "level_builder.h"
+#include "core/jobs.h"
+#include "core/platform.h"
+
+// Probes sit half way between the floor at 0 and the ceiling at 1.
+#define LIGHT_PROBE_HEIGHT 0.5f
+
+struct LightProbeJob
+{
+    LightProbeGrid* grid;
+    const Level* level;
+    const Light* lights;
+    s32 lightCount;
+    f32 ambientLight;
+};
+
+// Casts the shadow ray from the light towards the probe in the xz plane, the same way the lightmap luxels do.
+static b32 IsProbeVisible(const Level* level, const Light* light, glm::vec3 position)
+{
+    glm::vec2 delta = glm::vec2(position.x - light->position.x, position.z - light->position.z);
+    f32 planarDistance = glm::length(delta);
+    if (planarDistance < 0.0001f)
+    {
+        return true;
+    }
+
+    glm::vec2 direction = delta / planarDistance;
+    glm::vec2 origin = glm::vec2(light->position.x, light->position.z) + direction * 0.01f;
+
+    RayCastHit hit = {};
+    if (Level_CastRay(level, origin, direction, &hit))
+    {
+        return hit.distance + 0.02f > planarDistance;
+    }
+    return false;
+}
+
+static void BakeProbe(AmbientCube* probe, const LightProbeJob* job, glm::vec3 position)
+{
+    for (s32 i = 0; i < 6; ++i)
+    {
+        probe->colors[i] = glm::vec3(job->ambientLight);
+    }
+
+    for (s32 i = 0; i < job->lightCount; ++i)
+    {
+        const Light* light = &job->lights[i];
+        glm::vec3 toLight = light->position - position;
+        f32 distance = glm::length(toLight);
+        if (distance >= light->range || !IsProbeVisible(job->level, light, position))
+        {
+            continue;
+        }
+
+        // Same falloff as the lightmap, split between the axes the light arrives from.
+        f32 falloff = ComputeLightFallOff(light, distance);
+        glm::vec3 radiance = glm::clamp(light->color * light->intensity * falloff, 0.0f, 1.0f);
+        glm::vec3 direction = distance > 0.0001f ? toLight / distance : glm::vec3(0.0f, 1.0f, 0.0f);
+
+        probe->colors[0] += radiance * glm::max(direction.x, 0.0f);
+        probe->colors[1] += radiance * glm::max(-direction.x, 0.0f);
+        probe->colors[2] += radiance * glm::max(direction.y, 0.0f);
+        probe->colors[3] += radiance * glm::max(-direction.y, 0.0f);
+        probe->colors[4] += radiance * glm::max(direction.z, 0.0f);
+        probe->colors[5] += radiance * glm::max(-direction.z, 0.0f);
+    }
+}
+
+static void BakeProbeRows(void* userData, s32 begin, s32 end, s32 workerIndex)
+{
+    LightProbeJob* job = (LightProbeJob*)userData;
+    LightProbeGrid* grid = job->grid;
+
+    for (s32 y = begin; y < end; ++y)
+    {
+        for (s32 x = 0; x < grid->width; ++x)
+        {
+            if (!Level_IsSolid(job->level, x, y))
+            {
+                glm::vec3 position = glm::vec3((f32)x + 0.5f, LIGHT_PROBE_HEIGHT, (f32)y + 0.5f);
+                BakeProbe(&grid->probes[y * grid->width + x], job, position);
+            }
+        }
+    }
+}
+
+void LightProbeGrid_Init(LightProbeGrid* grid, const Level* level, Arena* arena)
+{
+    grid->width = level->width;
+    grid->height = level->height;
+    grid->probes = ArenaPushArray(arena, AmbientCube, level->width * level->height);
+    Platform_Assert(grid->probes, "Arena is full.");
+}
+
+void LightProbeGrid_Bake(LightProbeGrid* grid, const Level* level, const Light* lights, s32 lightCount, f32 ambientLight)
+{
+    Platform_Assert(grid->width == level->width && grid->height == level->height, "Light probe grid does not match the level.");
+
+    LightProbeJob job = {};
+    job.grid = grid;
+    job.level = level;
+    job.lights = lights;
+    job.lightCount = lightCount;
+    job.ambientLight = ambientLight;
+    Jobs_ParallelFor(grid->height, 1, BakeProbeRows, &job);
+
+    // Probes in solid tiles are only reached by interpolation, give them the light of the open tiles next to them
+    // so objects close to a wall are not darkened by it.
+    static const s32 offsets[4][2] = { { 1, 0 }, { -1, 0 }, { 0, 1 }, { 0, -1 } };
+    for (s32 y = 0; y < grid->height; ++y)
+    {
+        for (s32 x = 0; x < grid->width; ++x)
+        {
+            if (!Level_IsSolid(level, x, y))
+            {
+                continue;
+            }
+
+            AmbientCube sum = {};
+            s32 count = 0;
+            for (s32 i = 0; i < 4; ++i)
+            {
+                s32 nx = x + offsets[i][0];
+                s32 ny = y + offsets[i][1];
+                if (Level_IsSolid(level, nx, ny))
+                {
+                    continue;
+                }
+
+                const AmbientCube* neighbour = &grid->probes[ny * grid->width + nx];
+                for (s32 j = 0; j < 6; ++j)
+                {
+                    sum.colors[j] += neighbour->colors[j];
+                }
+                count++;
+            }
+
+            AmbientCube* probe = &grid->probes[y * grid->width + x];
+            for (s32 j = 0; j < 6; ++j)
+            {
+                probe->colors[j] = count > 0 ? sum.colors[j] / (f32)count : glm::vec3(ambientLight);
+            }
+        }
+    }
+}
+
+AmbientCube LightProbeGrid_Sample(const LightProbeGrid* grid, glm::vec3 position)
+{
+    f32 fx = glm::clamp(position.x - 0.5f, 0.0f, (f32)(grid->width - 1));
+    f32 fy = glm::clamp(position.z - 0.5f, 0.0f, (f32)(grid->height - 1));
+    s32 x0 = (s32)fx;
+    s32 y0 = (s32)fy;
+    s32 x1 = glm::min(x0 + 1, grid->width - 1);
+    s32 y1 = glm::min(y0 + 1, grid->height - 1);
+    f32 tx = fx - (f32)x0;
+    f32 ty = fy - (f32)y0;
+
+    const AmbientCube* p00 = &grid->probes[y0 * grid->width + x0];
+    const AmbientCube* p10 = &grid->probes[y0 * grid->width + x1];
+    const AmbientCube* p01 = &grid->probes[y1 * grid->width + x0];
+    const AmbientCube* p11 = &grid->probes[y1 * grid->width + x1];
+
+    AmbientCube result;
+    for (s32 i = 0; i < 6; ++i)
+    {
+        glm::vec3 top = glm::mix(p00->colors[i], p10->colors[i], tx);
+        glm::vec3 bottom = glm::mix(p01->colors[i], p11->colors[i], tx);
+        result.colors[i] = glm::mix(top, bottom, ty);
+    }
+    return result;
+}
+
+void LightProbeGrid_DrawMesh(const LightProbeGrid* grid, const Mesh* mesh, const Material* material, const glm::mat4& transform)
+{
+    AmbientCube ambientCube = LightProbeGrid_Sample(grid, glm::vec3(transform[3]));
+    Renderer_DrawMesh(mesh, material, transform, &ambientCube);
+}
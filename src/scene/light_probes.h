@@ -0,0 +1,26 @@
+#pragma once
+#include "core/types.h"
+#include "core/memory.h"
+#include "scene/level.h"
+#include "renderer/renderer.h"
+
+// Irradiance probe in the middle of every level tile, half way between floor and ceiling. Lights dynamic
+// objects like entities and doors that have no lightmap, baked from the same lights and shadow rays.
+struct LightProbeGrid
+{
+    s32 width;
+    s32 height;
+    AmbientCube* probes; // Row-major like the level tiles. Probes in solid tiles hold the average of their open neighbours.
+};
+
+// Allocates a probe for every tile of the level.
+void LightProbeGrid_Init(LightProbeGrid* grid, const Level* level, Arena* arena);
+
+// Bakes the direct light of the lights into every probe, plus the ambient light from all directions.
+void LightProbeGrid_Bake(LightProbeGrid* grid, const Level* level, const Light* lights, s32 lightCount, f32 ambientLight);
+
+// Returns the lighting at a point in level space, interpolated between the four closest probes.
+AmbientCube LightProbeGrid_Sample(const LightProbeGrid* grid, glm::vec3 position);
+
+// Draws a mesh without a lightmap, like an entity or a door, lit by the probes sampled at the origin of its transform.
+void LightProbeGrid_DrawMesh(const LightProbeGrid* grid, const Mesh* mesh, const Material* material, const glm::mat4& transform);
@@ -0,0 +1,319 @@
+#include "light_visibility.h"
+#include "core/platform.h"
+
+// The shadow rays start 0.01 ahead of the light, keep that start inside the light tile.
+#define LIGHT_EDGE_MARGIN 0.02f
+
+// A shadowed tile needs every ray to be inside a wall this far before the tile,
+// well past the 0.02 the shadow ray test tolerates.
+#define SHADOW_WALL_MARGIN 0.05f
+
+// Shadow rays give up after 128 units, stay clear of that.
+#define MAX_VISIBILITY_DISTANCE 127.0f
+
+// Slopes of rays in the local space of a shadowcasting pass: secondary over primary offset from the light.
+struct SlopeInterval
+{
+    f32 min;
+    f32 max;
+};
+
+struct SlopeSet
+{
+    SlopeInterval* intervals;
+    s32 count;
+};
+
+// Relative to the slope, capped so the rays right beside the light with infinite slopes still compare.
+static f32 GetSlopeTolerance(f32 slope)
+{
+    return glm::min(1e-3f * (1.0f + glm::abs(slope)), 1.0f);
+}
+
+// Slopes of all rays from the light through the box [nearP, farP] x [minQ, maxQ], nearP may be zero.
+static SlopeInterval GetBoxSlopes(f32 nearP, f32 farP, f32 minQ, f32 maxQ)
+{
+    SlopeInterval slopes;
+    slopes.min = glm::min(minQ / nearP, minQ / farP);
+    slopes.max = glm::max(maxQ / nearP, maxQ / farP);
+    return slopes;
+}
+
+static b32 SlopeInterval_Overlap(SlopeInterval a, SlopeInterval b)
+{
+    return a.min <= b.max && b.min <= a.max;
+}
+
+// Overlap by more than the tolerance, so a ray grazing the corner between two walls is not counted as blocked.
+static b32 SlopeInterval_OverlapStrict(SlopeInterval a, SlopeInterval b)
+{
+    return a.min < b.max - GetSlopeTolerance(b.max) && b.min < a.max - GetSlopeTolerance(a.max);
+}
+
+static void SlopeSet_Add(SlopeSet* set, SlopeInterval interval, b32 strict)
+{
+    for (s32 i = 0; i < set->count;)
+    {
+        SlopeInterval other = set->intervals[i];
+        if (strict ? SlopeInterval_OverlapStrict(interval, other) : SlopeInterval_Overlap(interval, other))
+        {
+            interval.min = glm::min(interval.min, other.min);
+            interval.max = glm::max(interval.max, other.max);
+            set->intervals[i] = set->intervals[--set->count];
+            i = 0;
+            continue;
+        }
+        i++;
+    }
+    set->intervals[set->count++] = interval;
+}
+
+static b32 SlopeSet_Intersects(const SlopeSet* set, SlopeInterval interval)
+{
+    for (s32 i = 0; i < set->count; ++i)
+    {
+        if (SlopeInterval_Overlap(set->intervals[i], interval)) return true;
+    }
+    return false;
+}
+
+static b32 SlopeSet_Covers(const SlopeSet* set, SlopeInterval interval)
+{
+    for (s32 i = 0; i < set->count; ++i)
+    {
+        if (set->intervals[i].min <= interval.min && set->intervals[i].max >= interval.max) return true;
+    }
+    return false;
+}
+
+static b32 IsBorderSolid(const Level* level)
+{
+    for (s32 x = 0; x < level->width; ++x)
+    {
+        if (!Level_IsSolid(level, x, 0) || !Level_IsSolid(level, x, level->height - 1)) return false;
+    }
+    for (s32 y = 0; y < level->height; ++y)
+    {
+        if (!Level_IsSolid(level, 0, y) || !Level_IsSolid(level, level->width - 1, y)) return false;
+    }
+    return true;
+}
+
+// With a solid border, a shadow ray always ends on a wall unless it runs out of distance first. Returns true
+// if every ray of the pass with the given slopes reaches the border within the ray distance.
+static b32 DoRaysReachBorder(f32 borderP, f32 minBorderQ, f32 maxBorderQ, f32 lightP, f32 lightQ, SlopeInterval slopes)
+{
+    f32 distanceP = glm::abs(borderP - lightP);
+    f32 distanceQ = 0.0f;
+    if (slopes.max > 0.0f) distanceQ = glm::max(distanceQ, maxBorderQ - lightQ);
+    if (slopes.min < 0.0f) distanceQ = glm::max(distanceQ, lightQ - minBorderQ);
+    return distanceP * distanceP + distanceQ * distanceQ < MAX_VISIBILITY_DISTANCE * MAX_VISIBILITY_DISTANCE;
+}
+
+void LightVisibility_Compute(LightVisibility* visibility, const Level* level, const Light* light)
+{
+    *visibility = {};
+
+    f32 lightX = light->position.x;
+    f32 lightY = light->position.z;
+    s32 tileX = (s32)glm::floor(lightX);
+    s32 tileY = (s32)glm::floor(lightY);
+
+    // Lights inside walls or too close to a tile edge keep every tile partial.
+    if (tileX < 0 || tileY < 0 || tileX >= level->width || tileY >= level->height || Level_IsSolid(level, tileX, tileY) ||
+        lightX - tileX < LIGHT_EDGE_MARGIN || tileX + 1 - lightX < LIGHT_EDGE_MARGIN ||
+        lightY - tileY < LIGHT_EDGE_MARGIN || tileY + 1 - lightY < LIGHT_EDGE_MARGIN)
+    {
+        return;
+    }
+
+    s32 radius = (s32)glm::ceil(glm::min(light->range, MAX_VISIBILITY_DISTANCE));
+    s32 minX = glm::max(tileX - radius, 0);
+    s32 minY = glm::max(tileY - radius, 0);
+    s32 maxX = glm::min(tileX + radius, level->width - 1);
+    s32 maxY = glm::min(tileY + radius, level->height - 1);
+
+    visibility->minX = minX;
+    visibility->minY = minY;
+    visibility->width = maxX - minX + 1;
+    visibility->height = maxY - minY + 1;
+
+    s32 tileCount = visibility->width * visibility->height;
+    visibility->tiles = (u8*)Platform_Alloc(tileCount);
+
+    // Tiles out of range get no light, whatever is in between. Luxels lying right under
+    // the light have no ray direction, so the light tile is always partial.
+    f32 outOfRange = light->range + 0.01f;
+    for (s32 y = minY; y <= maxY; ++y)
+    {
+        for (s32 x = minX; x <= maxX; ++x)
+        {
+            f32 dx = glm::max(glm::max((f32)x - lightX, lightX - (f32)(x + 1)), 0.0f);
+            f32 dy = glm::max(glm::max((f32)y - lightY, lightY - (f32)(y + 1)), 0.0f);
+            b32 inRange = dx * dx + dy * dy < outOfRange * outOfRange;
+            visibility->tiles[(y - minY) * visibility->width + (x - minX)] = (u8)(inRange ? TileVisibility_Partial : TileVisibility_Shadowed);
+        }
+    }
+
+    b32 borderSolid = IsBorderSolid(level);
+
+    SlopeSet litBlockers = {};
+    SlopeSet shadowBlockers = {};
+    litBlockers.intervals = (SlopeInterval*)Platform_Alloc(sizeof(SlopeInterval) * tileCount);
+    shadowBlockers.intervals = (SlopeInterval*)Platform_Alloc(sizeof(SlopeInterval) * tileCount);
+
+    // Four passes, one per half plane: +x, -x, +y, -y. Each sweeps rows of tiles away from the light
+    // along its primary axis and collects the slopes blocked by the walls of the rows so far. The x passes
+    // classify every tile of their half plane, the y passes only the column of the light.
+    for (s32 pass = 0; pass < 4; ++pass)
+    {
+        s32 axis = pass / 2;
+        s32 sign = (pass % 2) ? -1 : 1;
+
+        f32 lightP = axis ? lightY : lightX;
+        f32 lightQ = axis ? lightX : lightY;
+        s32 tileP = axis ? tileY : tileX;
+        s32 tileQ = axis ? tileX : tileY;
+        s32 minQ = axis ? minX : minY;
+        s32 maxQ = axis ? maxX : maxY;
+        s32 rowCount = sign > 0 ? (axis ? maxY : maxX) - tileP : tileP - (axis ? minY : minX);
+        f32 borderP = sign > 0 ? (f32)(axis ? level->height : level->width) : 0.0f;
+        f32 borderQ = (f32)(axis ? level->width : level->height);
+
+        litBlockers.count = 0;
+        shadowBlockers.count = 0;
+
+        for (s32 d = 0; d <= rowCount; ++d)
+        {
+            s32 row = tileP + sign * d;
+            f32 nearP = d == 0 ? 0.0f : (sign > 0 ? (f32)row - lightP : lightP - (f32)(row + 1));
+            f32 farP = sign > 0 ? (f32)(row + 1) - lightP : lightP - (f32)row;
+
+            for (s32 q = (d > 0 ? minQ : maxQ + 1); q <= maxQ; ++q)
+            {
+                if (axis == 1 && q != tileQ)
+                {
+                    continue;
+                }
+
+                s32 x = axis ? q : row;
+                s32 y = axis ? row : q;
+                u8* tile = &visibility->tiles[(y - minY) * visibility->width + (x - minX)];
+                if (*tile != TileVisibility_Partial || Level_IsSolid(level, x, y))
+                {
+                    continue;
+                }
+
+                SlopeInterval slopes = GetBoxSlopes(nearP, farP, (f32)q - lightQ, (f32)(q + 1) - lightQ);
+                slopes.min -= GetSlopeTolerance(slopes.min);
+                slopes.max += GetSlopeTolerance(slopes.max);
+
+                // Walls of the same row only block the rays if they lie between the light and the tile.
+                b32 lit = borderSolid && DoRaysReachBorder(borderP, 0.0f, borderQ, lightP, lightQ, slopes) &&
+                          !SlopeSet_Intersects(&litBlockers, slopes);
+                for (s32 w = minQ; w <= maxQ && lit; ++w)
+                {
+                    b32 between = (w > q && (f32)w <= lightQ) || (w < q && (f32)(w + 1) >= lightQ);
+                    if (between && Level_IsSolid(level, axis ? w : row, axis ? row : w))
+                    {
+                        lit = !SlopeInterval_Overlap(slopes, GetBoxSlopes(nearP, farP, (f32)w - lightQ, (f32)(w + 1) - lightQ));
+                    }
+                }
+
+                if (lit)
+                {
+                    *tile = TileVisibility_Lit;
+                }
+                else if (SlopeSet_Covers(&shadowBlockers, slopes))
+                {
+                    *tile = TileVisibility_Shadowed;
+                }
+            }
+
+            for (s32 q = minQ; q <= maxQ; ++q)
+            {
+                if (!Level_IsSolid(level, axis ? q : row, axis ? row : q))
+                {
+                    continue;
+                }
+
+                SlopeSet_Add(&litBlockers, GetBoxSlopes(nearP, farP, (f32)q - lightQ, (f32)(q + 1) - lightQ), false);
+
+                // Only count the part of the wall well before the next row as shadowing.
+                f32 shadowFarP = farP - SHADOW_WALL_MARGIN;
+                if (shadowFarP > nearP)
+                {
+                    SlopeSet_Add(&shadowBlockers, GetBoxSlopes(nearP, shadowFarP, (f32)q - lightQ, (f32)(q + 1) - lightQ), true);
+                }
+            }
+        }
+    }
+
+    Platform_Free(litBlockers.intervals);
+    Platform_Free(shadowBlockers.intervals);
+}
+
+void LightVisibility_Destroy(LightVisibility* visibility)
+{
+    if (visibility->tiles)
+    {
+        Platform_Free(visibility->tiles);
+    }
+    *visibility = {};
+}
+
+TileVisibility LightVisibility_GetAt(const LightVisibility* visibility, f32 x, f32 y)
+{
+    if (!visibility->tiles)
+    {
+        return TileVisibility_Partial;
+    }
+
+    s32 tileX = (s32)glm::floor(x) - visibility->minX;
+    s32 tileY = (s32)glm::floor(y) - visibility->minY;
+    if (tileX < 0 || tileY < 0 || tileX >= visibility->width || tileY >= visibility->height)
+    {
+        return TileVisibility_Partial;
+    }
+    return (TileVisibility)visibility->tiles[tileY * visibility->width + tileX];
+}
+
+b32 LightVisibility_IsAreaShadowed(const LightVisibility* visibility, const Level* level, const Light* light, f32 minX, f32 minY, f32 maxX, f32 maxY)
+{
+    if (!visibility->tiles)
+    {
+        return false;
+    }
+
+    f32 lightX = light->position.x;
+    f32 lightY = light->position.z;
+    f32 outOfRange = light->range + 0.01f;
+
+    s32 openTiles = 0;
+    for (s32 y = (s32)glm::floor(minY); y <= (s32)glm::floor(maxY); ++y)
+    {
+        for (s32 x = (s32)glm::floor(minX); x <= (s32)glm::floor(maxX); ++x)
+        {
+            if (Level_IsSolid(level, x, y))
+            {
+                continue;
+            }
+
+            // Tiles out of range get no light, also the ones past the tiles the visibility covers.
+            f32 dx = glm::max(glm::max((f32)x - lightX, lightX - (f32)(x + 1)), 0.0f);
+            f32 dy = glm::max(glm::max((f32)y - lightY, lightY - (f32)(y + 1)), 0.0f);
+            if (dx * dx + dy * dy >= outOfRange * outOfRange)
+            {
+                openTiles++;
+                continue;
+            }
+
+            if (LightVisibility_GetAt(visibility, (f32)x, (f32)y) != TileVisibility_Shadowed)
+            {
+                return false;
+            }
+            openTiles++;
+        }
+    }
+    return openTiles > 0;
+}
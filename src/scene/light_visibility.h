@@ -0,0 +1,37 @@
+#pragma once
+#include "core/types.h"
+#include "scene/level.h"
+#include "renderer/renderer.h"
+
+enum TileVisibility
+{
+    TileVisibility_Partial,  // Needs a ray per luxel.
+    TileVisibility_Lit,      // Every point of the tile is visible from the light.
+    TileVisibility_Shadowed  // No point of the tile receives light, either occluded or out of range.
+};
+
+// Visibility of the level tiles around a light, computed with shadowcasting over Layer_Wall.
+// The classification is conservative: a luxel in a lit or shadowed tile gets the same result
+// as casting its shadow ray, anything uncertain is left partial.
+struct LightVisibility
+{
+    s32 minX;
+    s32 minY;
+    s32 width;
+    s32 height;
+    u8* tiles; // TileVisibility per tile, null when every tile is partial.
+};
+
+// Computes the visibility of the tiles within range of the light.
+void LightVisibility_Compute(LightVisibility* visibility, const Level* level, const Light* light);
+
+// Frees the tiles of the visibility.
+void LightVisibility_Destroy(LightVisibility* visibility);
+
+// Returns the visibility of the tile containing the point x, y in level space.
+TileVisibility LightVisibility_GetAt(const LightVisibility* visibility, f32 x, f32 y);
+
+// Returns true if every open tile overlapping the area is shadowed or out of range of the light the visibility was
+// computed for, so no luxel in it receives light. Walls are skipped, the luxels of their faces are looked up in the
+// tiles in front of them. An area without open tiles is not shadowed.
+b32 LightVisibility_IsAreaShadowed(const LightVisibility* visibility, const Level* level, const Light* light, f32 minX, f32 minY, f32 maxX, f32 maxY);
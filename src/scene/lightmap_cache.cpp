@@ -0,0 +1,255 @@
+#include "lightmap_cache.h"
+#include "core/platform.h"
+
+#include <string.h>
+
+#define LIGHTMAP_CACHE_MAGIC 0x50414d4c // "LMAP"
+
+struct LightmapCacheHeader
+{
+    u32 magic;
+    u32 version;
+    u64 key;
+    s32 width;
+    s32 height;
+    s32 surfaceCount;
+    s32 pageCount;
+    s32 format;  // TextureFormat of the stored pages.
+    s32 bounces; // Bounces the bake ran, only bakes that ran every bounce of the atlas are stored.
+};
+
+struct LightmapCacheSurface
+{
+    AtlasTile lightmapTile;
+    glm::vec2 lightmap[4];
+};
+
+static u64 HashData(u64 hash, const void* data, u64 size)
+{
+    const u8* bytes = (const u8*)data;
+    u64 i = 0;
+
+    for (; i + sizeof(u64) <= size; i += sizeof(u64))
+    {
+        u64 word;
+        memcpy(&word, bytes + i, sizeof(u64));
+        hash = (hash ^ word) * 0x100000001b3ull;
+        hash ^= hash >> 29;
+    }
+
+    for (; i < size; ++i)
+    {
+        hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+    }
+
+    return hash;
+}
+
+static const char* GetCacheFilename(const char* directory, u64 key)
+{
+    return TextFormat("%s/%016llx.lightmap", directory, (unsigned long long)key);
+}
+
+u64 LightmapCache_ComputeKey(const Level* level, const Light* lights, s32 lightCount, const Atlas* atlas, s32 surfaceCount)
+{
+    u64 hash = 14695981039346656037ull;
+
+    s32 version = LIGHTMAP_BAKER_VERSION;
+    hash = HashData(hash, &version, sizeof(version));
+
+    hash = HashData(hash, &level->width, sizeof(level->width));
+    hash = HashData(hash, &level->height, sizeof(level->height));
+
+    // Row by row in level order, so the key does not depend on the tile layout.
+    u32* row = (u32*)Platform_Alloc(sizeof(u32) * glm::max(level->width, 1));
+    for (s32 i = 0; i < Layer_Count; ++i)
+    {
+        for (s32 y = 0; y < level->height; ++y)
+        {
+            for (s32 x = 0; x < level->width; ++x)
+            {
+                row[x] = Level_GetTileAt(level, x, y, (Layer)i);
+            }
+            hash = HashData(hash, row, sizeof(u32) * level->width);
+        }
+    }
+    Platform_Free(row);
+    hash = HashData(hash, level->blockingBits, sizeof(u64) * ((level->width * level->height + 63) / 64));
+
+    hash = HashData(hash, &lightCount, sizeof(lightCount));
+    for (s32 i = 0; i < lightCount; ++i)
+    {
+        const Light* light = &lights[i];
+        hash = HashData(hash, &light->position, sizeof(light->position));
+        hash = HashData(hash, &light->color, sizeof(light->color));
+        hash = HashData(hash, &light->intensity, sizeof(light->intensity));
+        hash = HashData(hash, &light->range, sizeof(light->range));
+    }
+
+    s32 atlasLayout[] = { atlas->pageWidth, atlas->pageHeight, atlas->luxelsPerUnit, atlas->padding, (s32)atlas->quality, atlas->bounceCount, (s32)atlas->format, surfaceCount };
+    hash = HashData(hash, atlasLayout, sizeof(atlasLayout));
+    hash = HashData(hash, &atlas->occlusionStrength, sizeof(atlas->occlusionStrength));
+    hash = HashData(hash, &atlas->bounceTimeBudget, sizeof(atlas->bounceTimeBudget));
+
+    return hash;
+}
+
+b32 LightmapCache_Load(const char* directory, u64 key, Atlas* atlas, Surface* surfaces, s32 surfaceCount)
+{
+    FileHandle file = Platform_OpenFile(GetCacheFilename(directory, key), FileMode_Read);
+    if (!file.handle)
+    {
+        return false;
+    }
+
+    // The packer is deterministic, packing again restores its state for later updates and must give the stored tiles.
+    if (!Atlas_PackSurfaces(atlas, surfaces, surfaceCount))
+    {
+        Platform_CloseFile(&file);
+        return false;
+    }
+
+    u64 pixelSize = Image_GetFormatSize(atlas->pageWidth, atlas->pageHeight, atlas->format);
+    u64 surfaceSize = sizeof(LightmapCacheSurface) * surfaceCount;
+
+    LightmapCacheHeader header = {};
+    if (file.size != sizeof(header) + pixelSize * atlas->pageCount + surfaceSize)
+    {
+        Platform_CloseFile(&file);
+        return false;
+    }
+
+    Platform_ReadDataFromFile(&file, &header, sizeof(header));
+    if (header.magic != LIGHTMAP_CACHE_MAGIC || header.version != LIGHTMAP_BAKER_VERSION || header.key != key ||
+        header.width != atlas->pageWidth || header.height != atlas->pageHeight || header.surfaceCount != surfaceCount ||
+        header.pageCount != atlas->pageCount || header.format != (s32)atlas->format || header.bounces != atlas->bounceCount)
+    {
+        Platform_CloseFile(&file);
+        return false;
+    }
+    atlas->stats.bounces = header.bounces;
+
+    // Compressed pages are kept as stored, their textures are created from the blocks and an incremental update decodes
+    // them to bake into what the textures show.
+    LightmapCacheSurface* cacheSurfaces = (LightmapCacheSurface*)Platform_Alloc(glm::max(surfaceSize, (u64)1));
+    for (s32 i = 0; i < atlas->pageCount; ++i)
+    {
+        AtlasPage* page = &atlas->pages[i];
+        if (atlas->format == TextureFormat_RGBA8)
+        {
+            Platform_ReadDataFromFile(&file, page->image.pixels, pixelSize);
+            continue;
+        }
+
+        if (!page->blocks)
+        {
+            page->blocks = Arena_PushSize(atlas->arena, pixelSize);
+            Platform_Assert(page->blocks, "Arena is full.");
+        }
+        Platform_ReadDataFromFile(&file, page->blocks, pixelSize);
+        page->encoded = true;
+    }
+    Platform_ReadDataFromFile(&file, cacheSurfaces, surfaceSize);
+    Platform_CloseFile(&file);
+
+    b32 result = true;
+    for (s32 i = 0; i < surfaceCount && result; ++i)
+    {
+        result = memcmp(&surfaces[i].lightmapTile, &cacheSurfaces[i].lightmapTile, sizeof(AtlasTile)) == 0;
+        for (s32 j = 0; j < 4; ++j)
+        {
+            surfaces[i].lightmap[j] = cacheSurfaces[i].lightmap[j];
+        }
+    }
+
+    Platform_Free(cacheSurfaces);
+    return result;
+}
+
+void LightmapCache_Save(const char* directory, u64 key, const Atlas* atlas, const Surface* surfaces, s32 surfaceCount)
+{
+    if (!Platform_CreateDirectory(directory))
+    {
+        Platform_LogWarning("Failed to create lightmap cache directory: %s\n", directory);
+        return;
+    }
+
+    FileHandle file = Platform_OpenFile(GetCacheFilename(directory, key), FileMode_Write);
+    if (!file.handle)
+    {
+        Platform_LogWarning("Failed to write lightmap cache: %s\n", GetCacheFilename(directory, key));
+        return;
+    }
+
+    LightmapCacheHeader header = {};
+    header.magic = LIGHTMAP_CACHE_MAGIC;
+    header.version = LIGHTMAP_BAKER_VERSION;
+    header.key = key;
+    header.width = atlas->pageWidth;
+    header.height = atlas->pageHeight;
+    header.surfaceCount = surfaceCount;
+    header.pageCount = atlas->pageCount;
+    header.format = (s32)atlas->format;
+    header.bounces = atlas->stats.bounces;
+
+    u64 surfaceSize = sizeof(LightmapCacheSurface) * surfaceCount;
+    LightmapCacheSurface* cacheSurfaces = (LightmapCacheSurface*)Platform_Alloc(glm::max(surfaceSize, (u64)1));
+    for (s32 i = 0; i < surfaceCount; ++i)
+    {
+        cacheSurfaces[i].lightmapTile = surfaces[i].lightmapTile;
+        for (s32 j = 0; j < 4; ++j)
+        {
+            cacheSurfaces[i].lightmap[j] = surfaces[i].lightmap[j];
+        }
+    }
+
+    u64 pixelSize = Image_GetFormatSize(atlas->pageWidth, atlas->pageHeight, atlas->format);
+    void* blocks = atlas->format != TextureFormat_RGBA8 ? Platform_Alloc(pixelSize) : 0;
+
+    Platform_WriteDataToFile(&file, &header, sizeof(header));
+    for (s32 i = 0; i < atlas->pageCount; ++i)
+    {
+        if (blocks)
+        {
+            Atlas_CompressPage(atlas, i, blocks);
+            Platform_WriteDataToFile(&file, blocks, pixelSize);
+        }
+        else
+        {
+            Platform_WriteDataToFile(&file, atlas->pages[i].image.pixels, pixelSize);
+        }
+    }
+    Platform_WriteDataToFile(&file, cacheSurfaces, surfaceSize);
+    Platform_CloseFile(&file);
+
+    Platform_Free(cacheSurfaces);
+    if (blocks)
+    {
+        Platform_Free(blocks);
+    }
+}
+
+b32 ComputeLightmapCached(const char* directory, Atlas* atlas, const Level* level, Surface* surfaces, s32 surfaceCount, const Light* lights, s32 lightCount)
+{
+    u64 key = LightmapCache_ComputeKey(level, lights, lightCount, atlas, surfaceCount);
+
+    if (LightmapCache_Load(directory, key, atlas, surfaces, surfaceCount))
+    {
+        return true;
+    }
+
+    ComputeLightmap(atlas, level, surfaces, surfaceCount, lights, lightCount);
+    ComputeLightmapCoordinates(surfaces, surfaceCount, level, atlas);
+
+    // Bounces cut by the time budget depend on the machine and its load, the same key would not give the same lightmap.
+    if (atlas->stats.bounces == atlas->bounceCount)
+    {
+        LightmapCache_Save(directory, key, atlas, surfaces, surfaceCount);
+    }
+    else
+    {
+        Platform_LogInfo("Lightmap not cached, the time budget allowed %d of %d bounces\n", atlas->stats.bounces, atlas->bounceCount);
+    }
+
+    return false;
+}
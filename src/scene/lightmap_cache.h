@@ -0,0 +1,23 @@
+#pragma once
+#include "core/types.h"
+#include "scene/level.h"
+#include "scene/level_builder.h"
+#include "renderer/renderer.h"
+
+// Bump whenever the baker output changes for the same inputs, so stale cache entries are ignored.
+#define LIGHTMAP_BAKER_VERSION 15
+
+// Hashes everything the baked lightmap depends on: level layers and blocked tiles, lights, atlas settings and baker version.
+u64 LightmapCache_ComputeKey(const Level* level, const Light* lights, s32 lightCount, const Atlas* atlas, s32 surfaceCount);
+
+// Packs the surfaces and loads the atlas pages and surface lightmap coordinates stored for a key. Compressed pages stay
+// encoded until a bake needs their pixels. Returns false on a miss.
+b32 LightmapCache_Load(const char* directory, u64 key, Atlas* atlas, Surface* surfaces, s32 surfaceCount);
+
+// Stores the atlas pages in the atlas format, the surface lightmap tiles and the bounces of the last bake for a key.
+// Entries are only loaded if they ran every bounce of the atlas.
+void LightmapCache_Save(const char* directory, u64 key, const Atlas* atlas, const Surface* surfaces, s32 surfaceCount);
+
+// Loads the lightmap from the cache, or bakes it with ComputeLightmap and stores it on a miss unless the time budget
+// cut bounces. Returns true if the lightmap came from the cache.
+b32 ComputeLightmapCached(const char* directory, Atlas* atlas, const Level* level, Surface* surfaces, s32 surfaceCount, const Light* lights, s32 lightCount);
@@ -0,0 +1,476 @@
+#include "lightmap_kernel.h"
+
+#include "core/platform.h"
+
+#include <math.h>
+#include <string.h>
+
+#if defined(LIGHTMAP_FORCE_SCALAR)
+    #define LUXEL_LANES 1
+#elif defined(__AVX2__)
+    #include <immintrin.h>
+    #define LUXEL_LANES 8
+#elif defined(_M_X64) || defined(__SSE2__)
+    #include <emmintrin.h>
+    #define LUXEL_LANES 4
+#else
+    #define LUXEL_LANES 1
+#endif
+
+// Every path below performs the same IEEE operations in the same order, so the
+// SIMD paths stay bit-identical to the scalar reference. Keep them in sync.
+
+// Set by LightmapKernel_ForceScalar, makes ShadeLuxelRow run the scalar reference.
+static b32 forceScalar;
+
+void LightmapKernel_ForceScalar(b32 scalar)
+{
+    forceScalar = scalar;
+}
+
+// Casts the shadow ray from the light towards a luxel. The ray is cast in the
+// xz plane, direction is normalized and luxelDistance is its unnormalized length.
+static b32 IsLuxelVisible(const Level* level, const Light* light, f32 directionX, f32 directionZ, f32 luxelDistance)
+{
+    glm::vec2 direction = glm::vec2(directionX, directionZ);
+    glm::vec2 origin = glm::vec2(light->position.x + directionX * 0.01f, light->position.z + directionZ * 0.01f);
+
+    RayCastHit hit = {};
+    if (Level_CastRay(level, origin, direction, &hit))
+    {
+        return hit.distance + 0.02f > luxelDistance;
+    }
+    return false;
+}
+
+// Casts the shadow rays of up to RAY_PACKET_SIZE luxels together, all coming from the
+// same light. Returns the mask of luxels that are visible from the light.
+static u32 TraceShadowPacket(const Level* level, const Light* light, const f32* directionX, const f32* directionZ, const f32* luxelDistance, u32 activeMask)
+{
+    RayPacket packet;
+    for (s32 lane = 0; lane < RAY_PACKET_SIZE; ++lane)
+    {
+        packet.originX[lane] = light->position.x + directionX[lane] * 0.01f;
+        packet.originY[lane] = light->position.z + directionZ[lane] * 0.01f;
+        packet.directionX[lane] = directionX[lane];
+        packet.directionY[lane] = directionZ[lane];
+    }
+
+    RayCastHit hits[RAY_PACKET_SIZE];
+    u32 hitMask = Level_CastRayPacket(level, &packet, activeMask, hits);
+
+    u32 visibleMask = 0;
+    for (s32 lane = 0; lane < RAY_PACKET_SIZE; ++lane)
+    {
+        if ((hitMask & (1u << lane)) && hits[lane].distance + 0.02f > luxelDistance[lane])
+        {
+            visibleMask |= 1u << lane;
+        }
+    }
+    return visibleMask;
+}
+
+// Wall luxels lie on a tile edge, look them up in the tile in front of the wall.
+#define LUXEL_TILE_BIAS 0.001f
+
+static TileVisibility GetLuxelTileVisibility(const LuxelRow* row, s32 lightIndex, f32 x, f32 z)
+{
+    if (!row->visibility)
+    {
+        return TileVisibility_Partial;
+    }
+    return LightVisibility_GetAt(&row->visibility[lightIndex], x + row->normal.x * LUXEL_TILE_BIAS, z + row->normal.z * LUXEL_TILE_BIAS);
+}
+
+// Splits the luxels into the ones lit without a shadow ray and the ones that still need one.
+static void ClassifyLuxels(const LuxelRow* row, s32 lightIndex, const f32* luxelX, const f32* luxelZ, s32 laneCount, u32* outLitMask, u32* outTraceMask)
+{
+    u32 litMask = 0;
+    u32 traceMask = 0;
+    for (s32 lane = 0; lane < laneCount; ++lane)
+    {
+        TileVisibility tile = GetLuxelTileVisibility(row, lightIndex, luxelX[lane], luxelZ[lane]);
+        if (tile == TileVisibility_Lit) litMask |= 1u << lane;
+        else if (tile == TileVisibility_Partial) traceMask |= 1u << lane;
+    }
+    *outLitMask = litMask;
+    *outTraceMask = traceMask;
+}
+
+#if LUXEL_LANES != 1
+static s32 CountBits(u32 mask)
+{
+    s32 count = 0;
+    for (; mask; mask &= mask - 1)
+    {
+        count++;
+    }
+    return count;
+}
+#endif
+
+static f32 ClampUnit(f32 value)
+{
+    return glm::min(glm::max(value, 0.0f), 1.0f);
+}
+
+s32 ShadeLuxelRow_Scalar(const LuxelRow* row, glm::vec3* outColors)
+{
+    s32 rayCount = 0;
+    f32 padding = (f32)row->padding;
+    f32 luxelsPerRow = (f32)row->luxelsPerRow;
+
+    for (s32 x = 0; x < row->luxelCount; ++x)
+    {
+        f32 u = ((f32)x + 0.5f - padding) / luxelsPerRow;
+        f32 px = (row->origin.x + row->uAxis.x * u) + row->vAxis.x * row->vOffset;
+        f32 py = (row->origin.y + row->uAxis.y * u) + row->vAxis.y * row->vOffset;
+        f32 pz = (row->origin.z + row->uAxis.z * u) + row->vAxis.z * row->vOffset;
+
+        f32 r = row->ambientLight;
+        f32 g = row->ambientLight;
+        f32 b = row->ambientLight;
+
+        for (s32 i = 0; i < row->lightCount; ++i)
+        {
+            const Light* light = &row->lights[i];
+            TileVisibility tile = GetLuxelTileVisibility(row, i, px, pz);
+            if (tile == TileVisibility_Shadowed)
+            {
+                continue;
+            }
+
+            f32 dx = px - light->position.x;
+            f32 dy = py - light->position.y;
+            f32 dz = pz - light->position.z;
+
+            // Out of range the falloff is zero, no need for a shadow ray.
+            f32 distance = sqrtf(dx * dx + dy * dy + dz * dz);
+            if (distance >= light->range)
+            {
+                continue;
+            }
+
+            f32 planarDistance = sqrtf(dx * dx + dz * dz);
+            f32 invPlanarDistance = 1.0f / planarDistance;
+            if (tile == TileVisibility_Partial)
+            {
+                rayCount++;
+                if (!IsLuxelVisible(row->level, light, dx * invPlanarDistance, dz * invPlanarDistance, planarDistance))
+                {
+                    continue;
+                }
+            }
+
+            f32 falloff = ClampUnit(1.0f - distance / light->range);
+
+            r += ClampUnit(light->color.r * light->intensity * falloff);
+            g += ClampUnit(light->color.g * light->intensity * falloff);
+            b += ClampUnit(light->color.b * light->intensity * falloff);
+        }
+
+        outColors[x] = glm::vec3(r, g, b);
+    }
+
+    return rayCount;
+}
+
+#if LUXEL_LANES == 8
+
+s32 ShadeLuxelRow(const LuxelRow* row, glm::vec3* outColors)
+{
+    if (forceScalar)
+    {
+        return ShadeLuxelRow_Scalar(row, outColors);
+    }
+
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 half = _mm256_set1_ps(0.5f);
+    const __m256 laneOffset = _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f);
+    const __m256 padding = _mm256_set1_ps((f32)row->padding);
+    const __m256 luxelsPerRow = _mm256_set1_ps((f32)row->luxelsPerRow);
+    const __m256i laneBits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+
+    // The v offset is constant over the row, so origin + vAxis * v is added per lane just like the scalar path does.
+    const __m256 originX = _mm256_set1_ps(row->origin.x);
+    const __m256 originY = _mm256_set1_ps(row->origin.y);
+    const __m256 originZ = _mm256_set1_ps(row->origin.z);
+    const __m256 vOffsetX = _mm256_set1_ps(row->vAxis.x * row->vOffset);
+    const __m256 vOffsetY = _mm256_set1_ps(row->vAxis.y * row->vOffset);
+    const __m256 vOffsetZ = _mm256_set1_ps(row->vAxis.z * row->vOffset);
+
+    alignas(32) f32 directionX[8];
+    alignas(32) f32 directionZ[8];
+    alignas(32) f32 planarDistance[8];
+    alignas(32) f32 luxelX[8];
+    alignas(32) f32 luxelZ[8];
+    alignas(32) f32 red[8];
+    alignas(32) f32 green[8];
+    alignas(32) f32 blue[8];
+    s32 rayCount = 0;
+
+    for (s32 x0 = 0; x0 < row->luxelCount; x0 += 8)
+    {
+        s32 laneCount = glm::min(row->luxelCount - x0, 8);
+
+        __m256 x = _mm256_add_ps(_mm256_set1_ps((f32)x0), laneOffset);
+        __m256 u = _mm256_div_ps(_mm256_sub_ps(_mm256_add_ps(x, half), padding), luxelsPerRow);
+        __m256 px = _mm256_add_ps(_mm256_add_ps(originX, _mm256_mul_ps(_mm256_set1_ps(row->uAxis.x), u)), vOffsetX);
+        __m256 py = _mm256_add_ps(_mm256_add_ps(originY, _mm256_mul_ps(_mm256_set1_ps(row->uAxis.y), u)), vOffsetY);
+        __m256 pz = _mm256_add_ps(_mm256_add_ps(originZ, _mm256_mul_ps(_mm256_set1_ps(row->uAxis.z), u)), vOffsetZ);
+        _mm256_store_ps(luxelX, px);
+        _mm256_store_ps(luxelZ, pz);
+
+        __m256 r = _mm256_set1_ps(row->ambientLight);
+        __m256 g = r;
+        __m256 b = r;
+
+        for (s32 i = 0; i < row->lightCount; ++i)
+        {
+            const Light* light = &row->lights[i];
+            __m256 dx = _mm256_sub_ps(px, _mm256_set1_ps(light->position.x));
+            __m256 dy = _mm256_sub_ps(py, _mm256_set1_ps(light->position.y));
+            __m256 dz = _mm256_sub_ps(pz, _mm256_set1_ps(light->position.z));
+
+            __m256 dxx = _mm256_mul_ps(dx, dx);
+            __m256 dzz = _mm256_mul_ps(dz, dz);
+            __m256 planar = _mm256_sqrt_ps(_mm256_add_ps(dxx, dzz));
+            __m256 invPlanar = _mm256_div_ps(one, planar);
+            _mm256_store_ps(directionX, _mm256_mul_ps(dx, invPlanar));
+            _mm256_store_ps(directionZ, _mm256_mul_ps(dz, invPlanar));
+            _mm256_store_ps(planarDistance, planar);
+
+            // Out of range the falloff is zero, no need for a shadow ray.
+            __m256 distance = _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(dxx, _mm256_mul_ps(dy, dy)), dzz));
+            u32 inRangeMask = (u32)_mm256_movemask_ps(_mm256_cmp_ps(distance, _mm256_set1_ps(light->range), _CMP_LT_OQ));
+
+            u32 visibleMask, traceMask;
+            ClassifyLuxels(row, i, luxelX, luxelZ, laneCount, &visibleMask, &traceMask);
+            traceMask &= inRangeMask;
+            rayCount += CountBits(traceMask);
+            if (traceMask & 0xF)
+            {
+                visibleMask |= TraceShadowPacket(row->level, light, directionX, directionZ, planarDistance, traceMask & 0xF);
+            }
+            if (traceMask >> 4)
+            {
+                visibleMask |= TraceShadowPacket(row->level, light, directionX + 4, directionZ + 4, planarDistance + 4, traceMask >> 4) << 4;
+            }
+            __m256 mask = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32((s32)visibleMask), laneBits), laneBits));
+
+            __m256 falloff = _mm256_sub_ps(one, _mm256_div_ps(distance, _mm256_set1_ps(light->range)));
+            falloff = _mm256_min_ps(_mm256_max_ps(falloff, zero), one);
+
+            __m256 cr = _mm256_mul_ps(_mm256_set1_ps(light->color.r * light->intensity), falloff);
+            __m256 cg = _mm256_mul_ps(_mm256_set1_ps(light->color.g * light->intensity), falloff);
+            __m256 cb = _mm256_mul_ps(_mm256_set1_ps(light->color.b * light->intensity), falloff);
+            r = _mm256_add_ps(r, _mm256_and_ps(mask, _mm256_min_ps(_mm256_max_ps(cr, zero), one)));
+            g = _mm256_add_ps(g, _mm256_and_ps(mask, _mm256_min_ps(_mm256_max_ps(cg, zero), one)));
+            b = _mm256_add_ps(b, _mm256_and_ps(mask, _mm256_min_ps(_mm256_max_ps(cb, zero), one)));
+        }
+
+        _mm256_store_ps(red, r);
+        _mm256_store_ps(green, g);
+        _mm256_store_ps(blue, b);
+        for (s32 lane = 0; lane < laneCount; ++lane)
+        {
+            outColors[x0 + lane] = glm::vec3(red[lane], green[lane], blue[lane]);
+        }
+    }
+
+    return rayCount;
+}
+
+#elif LUXEL_LANES == 4
+
+s32 ShadeLuxelRow(const LuxelRow* row, glm::vec3* outColors)
+{
+    if (forceScalar)
+    {
+        return ShadeLuxelRow_Scalar(row, outColors);
+    }
+
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 laneOffset = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+    const __m128 padding = _mm_set1_ps((f32)row->padding);
+    const __m128 luxelsPerRow = _mm_set1_ps((f32)row->luxelsPerRow);
+    const __m128i laneBits = _mm_setr_epi32(1, 2, 4, 8);
+
+    // The v offset is constant over the row, so origin + vAxis * v is added per lane just like the scalar path does.
+    const __m128 originX = _mm_set1_ps(row->origin.x);
+    const __m128 originY = _mm_set1_ps(row->origin.y);
+    const __m128 originZ = _mm_set1_ps(row->origin.z);
+    const __m128 vOffsetX = _mm_set1_ps(row->vAxis.x * row->vOffset);
+    const __m128 vOffsetY = _mm_set1_ps(row->vAxis.y * row->vOffset);
+    const __m128 vOffsetZ = _mm_set1_ps(row->vAxis.z * row->vOffset);
+
+    alignas(16) f32 directionX[4];
+    alignas(16) f32 directionZ[4];
+    alignas(16) f32 planarDistance[4];
+    alignas(16) f32 luxelX[4];
+    alignas(16) f32 luxelZ[4];
+    alignas(16) f32 red[4];
+    alignas(16) f32 green[4];
+    alignas(16) f32 blue[4];
+    s32 rayCount = 0;
+
+    for (s32 x0 = 0; x0 < row->luxelCount; x0 += 4)
+    {
+        s32 laneCount = glm::min(row->luxelCount - x0, 4);
+
+        __m128 x = _mm_add_ps(_mm_set1_ps((f32)x0), laneOffset);
+        __m128 u = _mm_div_ps(_mm_sub_ps(_mm_add_ps(x, half), padding), luxelsPerRow);
+        __m128 px = _mm_add_ps(_mm_add_ps(originX, _mm_mul_ps(_mm_set1_ps(row->uAxis.x), u)), vOffsetX);
+        __m128 py = _mm_add_ps(_mm_add_ps(originY, _mm_mul_ps(_mm_set1_ps(row->uAxis.y), u)), vOffsetY);
+        __m128 pz = _mm_add_ps(_mm_add_ps(originZ, _mm_mul_ps(_mm_set1_ps(row->uAxis.z), u)), vOffsetZ);
+        _mm_store_ps(luxelX, px);
+        _mm_store_ps(luxelZ, pz);
+
+        __m128 r = _mm_set1_ps(row->ambientLight);
+        __m128 g = r;
+        __m128 b = r;
+
+        for (s32 i = 0; i < row->lightCount; ++i)
+        {
+            const Light* light = &row->lights[i];
+            __m128 dx = _mm_sub_ps(px, _mm_set1_ps(light->position.x));
+            __m128 dy = _mm_sub_ps(py, _mm_set1_ps(light->position.y));
+            __m128 dz = _mm_sub_ps(pz, _mm_set1_ps(light->position.z));
+
+            __m128 dxx = _mm_mul_ps(dx, dx);
+            __m128 dzz = _mm_mul_ps(dz, dz);
+            __m128 planar = _mm_sqrt_ps(_mm_add_ps(dxx, dzz));
+            __m128 invPlanar = _mm_div_ps(one, planar);
+            _mm_store_ps(directionX, _mm_mul_ps(dx, invPlanar));
+            _mm_store_ps(directionZ, _mm_mul_ps(dz, invPlanar));
+            _mm_store_ps(planarDistance, planar);
+
+            // Out of range the falloff is zero, no need for a shadow ray.
+            __m128 distance = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(dxx, _mm_mul_ps(dy, dy)), dzz));
+            u32 inRangeMask = (u32)_mm_movemask_ps(_mm_cmplt_ps(distance, _mm_set1_ps(light->range)));
+
+            u32 visibleMask, traceMask;
+            ClassifyLuxels(row, i, luxelX, luxelZ, laneCount, &visibleMask, &traceMask);
+            traceMask &= inRangeMask;
+            rayCount += CountBits(traceMask);
+            if (traceMask)
+            {
+                visibleMask |= TraceShadowPacket(row->level, light, directionX, directionZ, planarDistance, traceMask);
+            }
+            __m128 mask = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32((s32)visibleMask), laneBits), laneBits));
+
+            __m128 falloff = _mm_sub_ps(one, _mm_div_ps(distance, _mm_set1_ps(light->range)));
+            falloff = _mm_min_ps(_mm_max_ps(falloff, zero), one);
+
+            __m128 cr = _mm_mul_ps(_mm_set1_ps(light->color.r * light->intensity), falloff);
+            __m128 cg = _mm_mul_ps(_mm_set1_ps(light->color.g * light->intensity), falloff);
+            __m128 cb = _mm_mul_ps(_mm_set1_ps(light->color.b * light->intensity), falloff);
+            r = _mm_add_ps(r, _mm_and_ps(mask, _mm_min_ps(_mm_max_ps(cr, zero), one)));
+            g = _mm_add_ps(g, _mm_and_ps(mask, _mm_min_ps(_mm_max_ps(cg, zero), one)));
+            b = _mm_add_ps(b, _mm_and_ps(mask, _mm_min_ps(_mm_max_ps(cb, zero), one)));
+        }
+
+        _mm_store_ps(red, r);
+        _mm_store_ps(green, g);
+        _mm_store_ps(blue, b);
+        for (s32 lane = 0; lane < laneCount; ++lane)
+        {
+            outColors[x0 + lane] = glm::vec3(red[lane], green[lane], blue[lane]);
+        }
+    }
+
+    return rayCount;
+}
+
+#else
+
+s32 ShadeLuxelRow(const LuxelRow* row, glm::vec3* outColors)
+{
+    return ShadeLuxelRow_Scalar(row, outColors);
+}
+
+#endif
+
+#define SELF_TEST_LEVEL_SIZE 48
+#define SELF_TEST_LIGHTS 6
+#define SELF_TEST_ROWS 2000
+#define SELF_TEST_MAX_LUXELS 72
+
+static f32 NextSelfTestRandom(u32* state)
+{
+    u32 x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return (f32)(x >> 8) / (f32)(1 << 24);
+}
+
+s32 LightmapKernel_SelfTest()
+{
+    u64 levelArenaSize = (u64)(SELF_TEST_LEVEL_SIZE + 8) * (SELF_TEST_LEVEL_SIZE + 8) * 16 + 4096;
+    Arena levelArena;
+    Arena_Init(&levelArena, levelArenaSize, Platform_Alloc(levelArenaSize));
+
+    // Scattered pillars inside a solid border.
+    u32 random = 2024;
+    Level level = {};
+    Level_Init(&level, SELF_TEST_LEVEL_SIZE, SELF_TEST_LEVEL_SIZE, &levelArena);
+    Level_Clear(&level);
+    for (s32 y = 0; y < level.height; ++y)
+    {
+        for (s32 x = 0; x < level.width; ++x)
+        {
+            b32 border = x == 0 || y == 0 || x == level.width - 1 || y == level.height - 1;
+            b32 pillar = NextSelfTestRandom(&random) < 0.08f;
+            Level_SetTileAt(&level, x, y, (border || pillar) ? 1 : 0, Layer_Wall);
+        }
+    }
+
+    Light lights[SELF_TEST_LIGHTS];
+    LightVisibility visibility[SELF_TEST_LIGHTS];
+    for (s32 i = 0; i < SELF_TEST_LIGHTS; ++i)
+    {
+        lights[i].position = glm::vec3(2.0f + NextSelfTestRandom(&random) * (level.width - 4), 0.5f, 2.0f + NextSelfTestRandom(&random) * (level.height - 4));
+        lights[i].color = glm::vec3(NextSelfTestRandom(&random), NextSelfTestRandom(&random), NextSelfTestRandom(&random));
+        lights[i].intensity = 0.5f + NextSelfTestRandom(&random) * 2.0f;
+        lights[i].range = 2.0f + NextSelfTestRandom(&random) * 20.0f;
+        LightVisibility_Compute(&visibility[i], &level, &lights[i]);
+    }
+
+    glm::vec3 colors[SELF_TEST_MAX_LUXELS];
+    glm::vec3 scalarColors[SELF_TEST_MAX_LUXELS];
+    for (s32 i = 0; i < SELF_TEST_ROWS; ++i)
+    {
+        // Floors, ceilings and walls of random size and direction, half of them with tile visibility.
+        LuxelRow row = {};
+        row.level = &level;
+        row.lights = lights;
+        row.visibility = (i & 1) ? visibility : nullptr;
+        row.lightCount = 1 + i % SELF_TEST_LIGHTS;
+        row.ambientLight = 0.1f;
+        row.origin = glm::vec3(4.0f + NextSelfTestRandom(&random) * (level.width - 8), (f32)(i % 3 == 2), 4.0f + NextSelfTestRandom(&random) * (level.height - 8));
+        row.uAxis = glm::vec3(NextSelfTestRandom(&random) * 6.0f - 3.0f, 0.0f, NextSelfTestRandom(&random) * 6.0f - 3.0f);
+        row.vAxis = (i % 3 == 0) ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(NextSelfTestRandom(&random) * 6.0f - 3.0f, 0.0f, NextSelfTestRandom(&random) * 6.0f - 3.0f);
+        row.normal = glm::normalize(glm::cross(row.uAxis, row.vAxis));
+        row.vOffset = NextSelfTestRandom(&random);
+        row.padding = i % 3;
+        row.luxelCount = 2 * row.padding + 1 + (s32)(NextSelfTestRandom(&random) * (SELF_TEST_MAX_LUXELS - 2 * row.padding - 1));
+        row.luxelsPerRow = row.luxelCount - 2 * row.padding;
+
+        s32 rayCount = ShadeLuxelRow(&row, colors);
+        s32 scalarRayCount = ShadeLuxelRow_Scalar(&row, scalarColors);
+        Platform_Assert(rayCount == scalarRayCount && memcmp(colors, scalarColors, sizeof(glm::vec3) * row.luxelCount) == 0,
+            "Luxel row %d differs from the scalar reference.", i);
+    }
+
+    for (s32 i = 0; i < SELF_TEST_LIGHTS; ++i)
+    {
+        LightVisibility_Destroy(&visibility[i]);
+    }
+    Platform_Free(levelArena.base);
+    return SELF_TEST_ROWS;
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include "core/types.h"
+#include "scene/level.h"
+#include "renderer/renderer.h"
+#include "scene/light_visibility.h"
+#include <glm/glm.hpp>
+
+// A row of luxels on a surface. Luxel x is placed at
+// origin + uAxis * ((x + 0.5 - padding) / luxelsPerRow) + vAxis * vOffset.
+struct LuxelRow
+{
+    const Level* level;
+    const Light* lights;
+    const LightVisibility* visibility; // One per light, null to cast a ray for every luxel.
+    s32 lightCount;
+    f32 ambientLight;
+
+    glm::vec3 origin;
+    glm::vec3 normal;
+    glm::vec3 uAxis; // Edges of the surface, not normalized.
+    glm::vec3 vAxis;
+    f32 vOffset;
+
+    s32 luxelCount;   // Number of luxels in the row including padding.
+    s32 luxelsPerRow; // Number of luxels the surface spans without padding.
+    s32 padding;
+};
+
+// Shades a row of luxels with every light and writes the summed linear colors, unclamped. Luxels in
+// tiles that are lit or shadowed for a light skip the shadow ray, as do luxels out of range.
+// Uses the widest SIMD path the build supports. Returns the number of shadow rays cast.
+s32 ShadeLuxelRow(const LuxelRow* row, glm::vec3* outColors);
+
+// Scalar reference of ShadeLuxelRow. Produces bit-identical colors and casts the same rays.
+s32 ShadeLuxelRow_Scalar(const LuxelRow* row, glm::vec3* outColors);
+
+// Makes ShadeLuxelRow run the scalar reference until called again with false, so whole bakes can be compared
+// against the SIMD paths. Call it while no bake is running.
+void LightmapKernel_ForceScalar(b32 scalar);
+
+// Shades random rows over a generated level through ShadeLuxelRow and ShadeLuxelRow_Scalar and asserts that
+// the colors are bit-identical and the same number of rays is cast. Returns the number of rows compared.
+s32 LightmapKernel_SelfTest();
@@ -0,0 +1,23 @@
+#include "core/platform.h"
+#include "scene/level_benchmark.h"
+
+#include <stdlib.h>
+
+// Times ray casts, surface building and collision queries in the row-major and the blocked tile layout of the same
+// generated level. Pass the level width and height in tiles, the default is a large level.
+
+#define LEVEL_BENCHMARK_DEFAULT_SIZE 1024
+
+int main(int argc, char** argv)
+{
+    s32 width = argc > 1 ? atoi(argv[1]) : LEVEL_BENCHMARK_DEFAULT_SIZE;
+    s32 height = argc > 2 ? atoi(argv[2]) : width;
+    if (width <= 0 || height <= 0)
+    {
+        Platform_LogError("Usage: LevelBenchmark [width] [height]\n");
+        return 1;
+    }
+
+    LevelBenchmark_RunLayouts(width, height);
+    return 0;
+}
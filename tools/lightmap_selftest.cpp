@@ -0,0 +1,139 @@
+#include "core/platform.h"
+#include "core/memory.h"
+#include "scene/level.h"
+#include "scene/level_builder.h"
+#include "scene/lightmap_kernel.h"
+
+#include <string.h>
+
+// Bakes a generated level once with the scalar luxel kernel and once with the SIMD kernel of the build, and checks
+// that the atlas pages come out bit-identical. Build with --avx2 to check the AVX2 path, without for SSE2.
+
+#define SELF_TEST_LEVEL_SIZE 64
+#define SELF_TEST_LIGHTS 8
+#define SELF_TEST_LEVEL_ARENA_SIZE (1024 * 1024)
+#define SELF_TEST_BAKE_ARENA_SIZE (256 * 1024 * 1024)
+
+static f32 NextRandom(u32* state)
+{
+    u32 x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return (f32)(x >> 8) / (f32)(1 << 24);
+}
+
+static Atlas BakeAtlas(const Level* level, Surface* surfaces, s32 surfaceCount, const Light* lights, LightmapQuality quality, b32 scalar, Arena* arena)
+{
+    Atlas atlas = CreateAtlas(1024, 1024, 8, 1, arena);
+    atlas.quality = quality;
+    atlas.bounceCount = 1;
+    atlas.bounceTimeBudget = 1e9f; // Bounces cut by time would differ between the bakes.
+
+    LightmapKernel_ForceScalar(scalar);
+    ComputeLightmap(&atlas, level, surfaces, surfaceCount, lights, SELF_TEST_LIGHTS);
+    LightmapKernel_ForceScalar(false);
+    return atlas;
+}
+
+// Returns the number of pages that differ, or -1 if the atlases do not even have the same tiles.
+static s32 CompareAtlases(const Atlas* a, const Atlas* b, const Surface* surfacesA, const Surface* surfacesB, s32 surfaceCount)
+{
+    if (a->pageCount != b->pageCount || memcmp(surfacesA, surfacesB, sizeof(Surface) * surfaceCount) != 0)
+    {
+        return -1;
+    }
+
+    s32 differentPages = 0;
+    for (s32 i = 0; i < a->pageCount; ++i)
+    {
+        if (memcmp(a->pages[i].image.pixels, b->pages[i].image.pixels, sizeof(u32) * a->pageWidth * a->pageHeight) != 0)
+        {
+            differentPages++;
+        }
+    }
+    return differentPages;
+}
+
+int main(int argc, char** argv)
+{
+    s32 rowCount = LightmapKernel_SelfTest();
+    Platform_LogInfo("Compared %d luxel rows with the scalar reference.\n", rowCount);
+
+    Arena levelArena;
+    Arena_Init(&levelArena, SELF_TEST_LEVEL_ARENA_SIZE, Platform_Alloc(SELF_TEST_LEVEL_ARENA_SIZE));
+    Arena bakeArena;
+    Arena_Init(&bakeArena, SELF_TEST_BAKE_ARENA_SIZE, Platform_Alloc(SELF_TEST_BAKE_ARENA_SIZE));
+
+    // Scattered pillars inside a solid border, floors and ceilings everywhere else.
+    u32 random = 1234;
+    Level level = {};
+    Level_Init(&level, SELF_TEST_LEVEL_SIZE, SELF_TEST_LEVEL_SIZE, &levelArena);
+    Level_Clear(&level);
+    for (s32 y = 0; y < level.height; ++y)
+    {
+        for (s32 x = 0; x < level.width; ++x)
+        {
+            b32 border = x == 0 || y == 0 || x == level.width - 1 || y == level.height - 1;
+            b32 pillar = NextRandom(&random) < 0.08f;
+            if (border || pillar)
+            {
+                Level_SetTileAt(&level, x, y, 1 + (x + y) % 3, Layer_Wall);
+            }
+            else
+            {
+                Level_SetTileAt(&level, x, y, 4 + (x / 5 + y / 7) % 2, Layer_Floor);
+                Level_SetTileAt(&level, x, y, 6, Layer_Ceiling);
+            }
+        }
+    }
+
+    Light lights[SELF_TEST_LIGHTS];
+    for (s32 i = 0; i < SELF_TEST_LIGHTS; ++i)
+    {
+        lights[i].position = glm::vec3(2.0f + NextRandom(&random) * (level.width - 4), 0.2f + NextRandom(&random) * 0.6f, 2.0f + NextRandom(&random) * (level.height - 4));
+        lights[i].color = glm::vec3(NextRandom(&random), NextRandom(&random), NextRandom(&random));
+        lights[i].intensity = 0.5f + NextRandom(&random) * 2.0f;
+        lights[i].range = 2.0f + NextRandom(&random) * 12.0f;
+    }
+
+    Tileset tileset = {};
+    tileset.image.width = 256;
+    tileset.image.height = 256;
+    tileset.tileWidth = 32;
+    tileset.tileHeight = 32;
+    tileset.columns = 8;
+
+    static const LightmapQuality qualities[] = { LightmapQuality_Fast, LightmapQuality_Adaptive, LightmapQuality_Full };
+    static const char* qualityNames[] = { "fast", "adaptive", "full" };
+
+    s32 failures = 0;
+    for (s32 i = 0; i < 3; ++i)
+    {
+        s32 surfaceCount = 0;
+        Surface* scalarSurfaces = CreateLevelSurfaces(&level, &tileset, &bakeArena, &surfaceCount);
+        Surface* simdSurfaces = CreateLevelSurfaces(&level, &tileset, &bakeArena, &surfaceCount);
+
+        Atlas scalar = BakeAtlas(&level, scalarSurfaces, surfaceCount, lights, qualities[i], true, &bakeArena);
+        s64 scalarRays = scalar.stats.raysCast;
+        Atlas simd = BakeAtlas(&level, simdSurfaces, surfaceCount, lights, qualities[i], false, &bakeArena);
+
+        s32 differentPages = CompareAtlases(&scalar, &simd, scalarSurfaces, simdSurfaces, surfaceCount);
+        if (differentPages != 0 || scalarRays != simd.stats.raysCast)
+        {
+            Platform_LogError("Quality %s: the SIMD bake differs from the scalar bake, %d pages differ, %lld and %lld rays.\n",
+                qualityNames[i], differentPages, (long long)scalarRays, (long long)simd.stats.raysCast);
+            failures++;
+        }
+        else
+        {
+            Platform_LogInfo("Quality %s: %d surfaces on %d pages are bit-identical.\n", qualityNames[i], surfaceCount, simd.pageCount);
+        }
+        Arena_Clear(&bakeArena);
+    }
+
+    Platform_Free(bakeArena.base);
+    Platform_Free(levelArena.base);
+    return failures ? 1 : 0;
+}